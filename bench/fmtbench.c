@@ -0,0 +1,286 @@
+/*
+ * Public Domain, 2026, Marco S Hyman <marc@snafu.org>
+ */
+
+#ifdef LINUX
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE	600		/* posix_openpt */
+#endif
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gpslib.h"
+
+/*
+ * Parser benchmark.
+ *
+ * Time the conversion of a gardump text file to upload packets.  Unless
+ * a file is named a track file of the requested number of points is
+ * generated first.  The file is read once before timing so both runs
+ * see a warm page cache.  The reference run is the fgets/sscanf loop
+ * the parser replaced, reduced to the latitude and longitude of each
+ * line; it does no encoding.  With -j the file is also converted to
+ * lists by that many threads.  Threads run in parallel so that run is
+ * timed by the wall clock.
+ */
+
+#define TRACK_POINTS	1000		/* points per generated track */
+
+static void
+usage(const char* prog, const char* err, ...)
+{
+	if (err) {
+		va_list ap;
+		va_start(ap, err);
+		vfprintf(stderr, err, ap);
+		va_end(ap);
+	}
+	fprintf(stderr, "usage: %s [-k] [-j jobs] [-n points] [file]\n", prog);
+	exit(1);
+}
+
+/*
+ * CPU time used so far.  Wall time on a busy machine says more about
+ * the machine than about the parser.
+ */
+static double
+now(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+	    ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+/*
+ * Write a track log of the given number of points.  Positions wander
+ * so that every line has a full set of digits.
+ */
+static void
+generate(const char *file, long points)
+{
+	double lat = 37.5;
+	double lon = -122.25;
+	long ix;
+	FILE *fp;
+
+	if ((fp = fopen(file, "w")) == NULL)
+		err(1, "%s", file);
+	fprintf(fp, TRK_HDR ", %ld records]\n", points);
+	for (ix = 0; ix < points; ix++) {
+		if (ix % TRACK_POINTS == 0)
+			fprintf(fp, "Track: BENCH %ld\n", ix / TRACK_POINTS);
+		lat += ((ix * 7919) % 2001 - 1000) * 1e-8;
+		lon += ((ix * 104729) % 2001 - 1000) * 1e-8;
+		fprintf(fp, "%04ld-%02ld-%02ld %02ld:%02ld:%02ld %12.8f %13.8f "
+			"%f%s\n", 2000 + ix / 31536000 % 100,
+			ix / 2592000 % 12 + 1, ix / 86400 % 28 + 1,
+			ix / 3600 % 24, ix / 60 % 60, ix % 60, lat, lon,
+			100 + (ix % 500) / 10.0,
+			ix % TRACK_POINTS == 0 ? " start" : "");
+	}
+	fprintf(fp, "[end transfer, %ld/%ld records]\n", points, points);
+	if (fclose(fp) == EOF)
+		err(1, "%s", file);
+}
+
+/*
+ * Read the file to get it into the page cache.  Returns its size.
+ */
+static double
+warm(const char *file)
+{
+	char buf[65536];
+	double bytes = 0;
+	size_t len;
+	FILE *fp;
+
+	if ((fp = fopen(file, "r")) == NULL)
+		err(1, "%s", file);
+	while ((len = fread(buf, 1, sizeof buf, fp)) > 0)
+		bytes += len;
+	fclose(fp);
+	return bytes;
+}
+
+static void
+report(const char *name, double bytes, long recs, double secs)
+{
+	printf("%-8s %10ld records %8.3f s %9.1f MB/s %8.1f ns/record\n",
+	       name, recs, secs, bytes / secs / 1e6,
+	       recs ? secs * 1e9 / recs : 0);
+}
+
+/*
+ * The parse the old code did: fgets into a fixed buffer and sscanf
+ */
+static long
+run_scanf(const char *file)
+{
+	char buf[GPS_BUF_LEN];
+	double lat;
+	double lon;
+	long recs = 0;
+	FILE *fp;
+
+	if ((fp = fopen(file, "r")) == NULL)
+		err(1, "%s", file);
+	while (fgets(buf, sizeof buf, fp))
+		if (strlen(buf) > 19 &&
+		    sscanf(buf + 19, "%lf %lf", &lat, &lon) == 2)
+			recs += 1;
+	fclose(fp);
+	return recs;
+}
+
+/*
+ * Elapsed time
+ */
+static double
+wall(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static long
+run_format(gps_handle gps, const char *file)
+{
+	struct gps_format_state fs;
+	long recs = 0;
+	FILE *fp;
+
+	if ((fp = fopen(file, "r")) == NULL)
+		err(1, "%s", file);
+	if (gps_format_open(gps, &fs, fp) == -1)
+		errx(1, "%s: can't read", file);
+	while (gps_format_next(gps, &fs) != GPS_FORMAT_EOF)
+		recs += fs.npkt;
+	gps_format_close(&fs);
+	fclose(fp);
+	return recs;
+}
+
+static long
+run_lists(gps_handle gps, const char *file, int jobs)
+{
+	struct gps_lists *lists;
+	struct gps_lists *cur;
+	long recs = 0;
+	FILE *fp;
+
+	if ((fp = fopen(file, "r")) == NULL)
+		err(1, "%s", file);
+	lists = gps_format_files(gps, &fp, 1, jobs);
+	for (cur = lists; cur; cur = cur->next)
+		recs += cur->list->count;
+	gps_lists_free(lists);
+	fclose(fp);
+	return recs;
+}
+
+int
+main(int argc, char * argv[])
+{
+	char tmp[] = "/tmp/fmtbench.XXXXXX";
+	const char *file = NULL;
+	gps_handle gps;
+	long points = 1000000;
+	int gen = 1;
+	int keep = 0;
+	int jobs = 0;
+	double bytes;
+	double t;
+	long recs;
+	char *rem;
+	int fd;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "j:kn:")) != -1) {
+		switch (ch) {
+		case 'j':
+			jobs = strtol(optarg, &rem, 0);
+			if (*rem || jobs <= 0)
+				usage(argv[0], "`%s' is a bad job count\n",
+				      optarg);
+			break;
+		case 'k':
+			keep = 1;
+			break;
+		case 'n':
+			points = strtol(optarg, &rem, 0);
+			if (*rem || points <= 0)
+				usage(argv[0], "`%s' is a bad point count\n",
+				      optarg);
+			break;
+		default:
+			usage(argv[0], 0);
+		}
+	}
+	if (argc > optind + 1)
+		usage(argv[0], "unknown command line argument: %s ...\n",
+		      argv[optind + 1]);
+	if (argc == optind + 1) {
+		file = argv[optind];
+		gen = access(file, F_OK) == -1;
+		keep = 1;
+	}
+
+	/* gps_open wants a terminal, give it the slave side of a pty */
+	if ((fd = posix_openpt(O_RDWR | O_NOCTTY)) == -1 ||
+	    grantpt(fd) == -1 || unlockpt(fd) == -1)
+		err(1, "pty");
+	gps = gps_open(ptsname(fd), 0);
+	gps_set_wpt_type(gps, D108);
+	gps_set_rte_hdr_type(gps, D202);
+	gps_set_rte_wpt_type(gps, D108);
+	gps_set_rte_lnk_type(gps, D210);
+	gps_set_trk_hdr_type(gps, D310);
+	gps_set_trk_type(gps, D301);
+
+	if (gen) {
+		if (file == NULL) {
+			if ((fd = mkstemp(tmp)) == -1)
+				err(1, "%s", tmp);
+			close(fd);
+			file = tmp;
+		}
+		printf("generating %ld points in %s\n", points, file);
+		generate(file, points);
+	}
+	bytes = warm(file);
+	printf("%.0f bytes\n", bytes);
+
+	t = now();
+	recs = run_scanf(file);
+	report("sscanf", bytes, recs, now() - t);
+
+	t = now();
+	recs = run_format(gps, file);
+	report("format", bytes, recs, now() - t);
+
+	if (jobs) {
+		t = wall();
+		recs = run_lists(gps, file, jobs);
+		report(jobs == 1 ? "lists" : "lists -j", bytes, recs,
+		       wall() - t);
+	}
+
+	if (! keep)
+		unlink(file);
+	gps_close(gps);
+	return 0;
+}
@@ -0,0 +1,375 @@
+/*
+ * Public Domain, 2026, Marco S Hyman <marc@snafu.org>
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gpslib.h"
+
+/*
+ * Test data generator.
+ *
+ * Write waypoints, routes, and track logs in the text format of
+ * gardump for load and conversion tests.  The same seed and sizes
+ * always give the same file, on any system.  Idents and comments run
+ * up to the longest a variable length field holds.  Route waypoints
+ * carry L: links.  Track logs are split into segments and points are a
+ * random walk with increasing times.
+ *
+ * With -d the given share of the low order bytes of every position and
+ * track time is made a DLE (0x10), which must be escaped on the serial
+ * line.  Only the two low bytes of a position are changed so points
+ * move by no more than 6 meters; a time is moved forward to the next
+ * second whose low byte is a DLE.
+ *
+ * With -i an upload image of the data, for the packet types of the -n
+ * profile, is written as well.
+ */
+
+#define UNIX_TIME_OFFSET 631065600L	/* GPS time 0 in UNIX time */
+#define SEMI_PER_DEG	(2147483648.0 / 180.0)
+
+#define WAYPOINTS	1000
+#define ROUTES		20
+#define ROUTE_WPTS	20
+#define POINTS		100000
+#define TRACK_POINTS	10000		/* points per track log */
+#define SEGMENT_ODDS	500		/* one in this many starts a segment */
+#define PROFILE		"A100 D108 A201 D202 D108 D210 A301 D310 D301"
+
+#define WPT_COMMENT	"# **n [route name]\n" \
+			"# lat long [A:alt] [S:sym] [D:display] [I:id] " \
+			"[C:cmnt] [W:wpt info] [L:link]\n"
+
+static u_int64_t rng;
+
+static void
+usage(const char* prog, const char* err, ...)
+{
+	if (err) {
+		va_list ap;
+		va_start(ap, err);
+		vfprintf(stderr, err, ap);
+		va_end(ap);
+	}
+	fprintf(stderr, "usage: %s [-s seed] [-w waypoints] [-r routes] "
+		"[-R route-waypoints]\n"
+		"          [-t points] [-T track-points] [-l length] "
+		"[-d dle-share]\n"
+		"          [-i image [-n profile]] [file]\n", prog);
+	exit(1);
+}
+
+/*
+ * xorshift64*: the same numbers from the same seed on every system
+ */
+static u_int64_t
+next(void)
+{
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	return rng * 2685821657736338717ULL;
+}
+
+/*
+ * A number from 0 up to but not including n
+ */
+static long
+pick(long n)
+{
+	return (long) ((next() >> 11) % (u_int64_t) n);
+}
+
+/*
+ * A number from 0 up to but not including 1
+ */
+static double
+uniform(void)
+{
+	return (next() >> 11) / 9007199254740992.0;
+}
+
+/*
+ * Move a position, in degrees, to a semicircle value whose two low
+ * bytes are each a DLE with the given odds.  The value returned is
+ * exact when printed with 8 decimals.
+ */
+static double
+position(double deg, double share)
+{
+	int32_t semi = (int32_t) lround(deg * SEMI_PER_DEG);
+	u_int32_t u = (u_int32_t) semi;
+
+	if (uniform() < share)
+		u = (u & ~0xffU) | dle;
+	if (uniform() < share)
+		u = (u & ~0xff00U) | dle << 8;
+	return (int32_t) u / SEMI_PER_DEG;
+}
+
+/*
+ * Fill buf with len random characters that can't be taken for a key
+ */
+static void
+text(char *buf, int len)
+{
+	static const char chars[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 -abcdefghijklmnopqrstuvwxyz";
+	int ix;
+
+	for (ix = 0; ix < len; ix++)
+		buf[ix] = chars[pick(sizeof chars - 1)];
+	buf[len] = 0;
+	/* no blank at either end, it would be lost */
+	if (len > 0)
+		buf[0] = buf[len - 1] = 'X';
+}
+
+/*
+ * One waypoint line, idents made unique by the prefix and number
+ */
+static void
+waypoint(FILE *fp, char prefix, long num, int maxlen, double share, int link)
+{
+	char ident[GPS_STRING_MAX + 1];
+	char cmnt[GPS_STRING_MAX + 1];
+	int len;
+
+	len = snprintf(ident, sizeof ident, "%c%ld", prefix, num);
+	if (len < maxlen)
+		text(ident + len, (int) pick(maxlen - len + 1));
+	text(cmnt, (int) pick(maxlen + 1));
+	fprintf(fp, "%12.8f %13.8f A:%f S:%ld D:%ld I:%s",
+		position(-60 + uniform() * 120, share),
+		position(-180 + uniform() * 360, share),
+		uniform() * 3000, pick(20), pick(3), ident);
+	if (cmnt[0])
+		fprintf(fp, " C:%s", cmnt);
+	if (link != -1)
+		fprintf(fp, " L:%d", link);
+	fprintf(fp, "\n");
+}
+
+static void
+waypoints(FILE *fp, long count, int maxlen, double share)
+{
+	long ix;
+
+	fprintf(fp, WPT_HDR ", %ld records]\n" WPT_COMMENT, count);
+	for (ix = 0; ix < count; ix++)
+		waypoint(fp, 'W', ix, maxlen, share, -1);
+	fprintf(fp, "[end transfer, %ld/%ld records]\n", count, count);
+}
+
+/*
+ * Routes of wpts waypoints each, every waypoint but the last followed
+ * by a link: a header, the waypoints, and the links are all records.
+ */
+static void
+routes(FILE *fp, long count, long wpts, int maxlen, double share)
+{
+	static const int links[] = { 0, 1, 3, 255 };
+	char name[GPS_STRING_MAX + 1];
+	long records = count * 2 * wpts;
+	long ix;
+	long jx;
+
+	fprintf(fp, RTE_HDR ", %ld records]\n" WPT_COMMENT, records);
+	for (ix = 0; ix < count; ix++) {
+		text(name, (int) pick(maxlen + 1));
+		fprintf(fp, "**%ld %s\n", ix, name);
+		for (jx = 0; jx < wpts; jx++)
+			waypoint(fp, 'R', ix * wpts + jx, maxlen, share,
+				 jx == wpts - 1 ? -1 : links[pick(4)]);
+	}
+	fprintf(fp, "[end transfer, %ld/%ld records]\n", records, records);
+}
+
+static void
+tracks(FILE *fp, long count, long per_log, int maxlen, double share)
+{
+	char name[GPS_STRING_MAX + 1];
+	long logs = (count + per_log - 1) / per_log;
+	long gps_time = 500000000 + pick(100000000);
+	double lat = -60 + uniform() * 120;
+	double lon = -180 + uniform() * 360;
+	double alt = uniform() * 2000;
+	double dlat = 0;
+	double dlon = 0;
+	char buf[24];
+	time_t tim;
+	long ix;
+
+	fprintf(fp, TRK_HDR ", %ld records]\n"
+		"# [Track: track name]\n"
+		"# [yyyy-mm-dd hh:mm:ss] lat long [alt] [start]\n",
+		count + logs);
+	for (ix = 0; ix < count; ix++) {
+		if (ix % per_log == 0) {
+			text(name, (int) pick(maxlen - 10 + 1));
+			fprintf(fp, "Track: %ld %s\n", ix / per_log, name);
+		}
+		/* a walk at up to about 30 m/s, one to five seconds apart */
+		gps_time += 1 + pick(5);
+		if (uniform() < share)
+			gps_time += (dle - gps_time) & 0xff;
+		dlat = dlat * 0.9 + (uniform() - 0.5) * 2e-5;
+		dlon = dlon * 0.9 + (uniform() - 0.5) * 2e-5;
+		lat += dlat;
+		lon += dlon;
+		if (lat > 80 || lat < -80)
+			dlat = -dlat;
+		alt += (uniform() - 0.5) * 4;
+		tim = (time_t) gps_time + UNIX_TIME_OFFSET;
+		strftime(buf, sizeof buf, "%Y-%m-%d %T", gmtime(&tim));
+		fprintf(fp, "%s %12.8f %13.8f %f%s\n", buf,
+			position(lat, share), position(lon, share), alt,
+			ix % per_log == 0 || pick(SEGMENT_ODDS) == 0 ?
+			" start" : "");
+	}
+	fprintf(fp, "[end transfer, %ld/%ld records]\n", count + logs,
+		count + logs);
+}
+
+/*
+ * Convert the text file to an upload image for the profile
+ */
+static void
+image(const char *file, const char *name, const char *profile)
+{
+	struct gps_lists *lists;
+	gps_handle gps;
+	FILE *in;
+	FILE *out;
+	int recs;
+
+	if ((gps = gps_open_profile(profile, 0)) == NULL)
+		errx(1, "`%s' is a bad profile", profile);
+	if ((in = fopen(file, "r")) == NULL)
+		err(1, "%s", file);
+	if ((out = fopen(name, "w")) == NULL)
+		err(1, "%s", name);
+	lists = gps_format(gps, in);
+	if ((recs = gps_image_write(gps, lists, out)) == -1 ||
+	    fclose(out) == EOF)
+		err(1, "%s", name);
+	fprintf(stderr, "%s: %d records\n", name, recs);
+	gps_lists_free(lists);
+	fclose(in);
+	gps_close(gps);
+}
+
+int
+main(int argc, char * argv[])
+{
+	const char *img = NULL;
+	const char *profile = PROFILE;
+	const char *file = NULL;
+	long seed = 1;
+	long wpts = WAYPOINTS;
+	long rtes = ROUTES;
+	long rte_wpts = ROUTE_WPTS;
+	long points = POINTS;
+	long per_log = TRACK_POINTS;
+	long maxlen = GPS_STRING_MAX - 1;
+	double share = 0;
+	FILE *fp = stdout;
+	char *rem;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "d:i:l:n:r:R:s:t:T:w:")) != -1) {
+		switch (ch) {
+		case 'd':
+			share = strtod(optarg, &rem);
+			if (*rem || share < 0 || share > 1)
+				usage(argv[0], "`%s' is a bad DLE share\n",
+				      optarg);
+			break;
+		case 'i':
+			img = optarg;
+			break;
+		case 'l':
+			maxlen = strtol(optarg, &rem, 0);
+			if (*rem || maxlen < 10 || maxlen >= GPS_STRING_MAX)
+				usage(argv[0], "`%s' is a bad length\n",
+				      optarg);
+			break;
+		case 'n':
+			profile = optarg;
+			break;
+		case 'r':
+			rtes = strtol(optarg, &rem, 0);
+			if (*rem || rtes < 0)
+				usage(argv[0], "`%s' is a bad route count\n",
+				      optarg);
+			break;
+		case 'R':
+			rte_wpts = strtol(optarg, &rem, 0);
+			if (*rem || rte_wpts <= 0)
+				usage(argv[0], "`%s' is a bad route length\n",
+				      optarg);
+			break;
+		case 's':
+			seed = strtol(optarg, &rem, 0);
+			if (*rem)
+				usage(argv[0], "`%s' is a bad seed\n", optarg);
+			break;
+		case 't':
+			points = strtol(optarg, &rem, 0);
+			if (*rem || points < 0)
+				usage(argv[0], "`%s' is a bad point count\n",
+				      optarg);
+			break;
+		case 'T':
+			per_log = strtol(optarg, &rem, 0);
+			if (*rem || per_log <= 0)
+				usage(argv[0], "`%s' is a bad track length\n",
+				      optarg);
+			break;
+		case 'w':
+			wpts = strtol(optarg, &rem, 0);
+			if (*rem || wpts < 0)
+				usage(argv[0], "`%s' is a bad waypoint count\n",
+				      optarg);
+			break;
+		default:
+			usage(argv[0], 0);
+		}
+	}
+	if (argc > optind + 1)
+		usage(argv[0], "unknown command line argument: %s ...\n",
+		      argv[optind + 1]);
+	if (argc == optind + 1)
+		file = argv[optind];
+	if (img && file == NULL)
+		usage(argv[0], "-i needs an output file\n");
+
+	/* never a zero state, xorshift would stay there */
+	rng = (u_int64_t) seed * 0x9e3779b97f4a7c15ULL + 1;
+	if (file && (fp = fopen(file, "w")) == NULL)
+		err(1, "%s", file);
+	if (wpts)
+		waypoints(fp, wpts, (int) maxlen, share);
+	if (rtes)
+		routes(fp, rtes, rte_wpts, (int) maxlen, share);
+	if (points)
+		tracks(fp, points, per_log, (int) maxlen, share);
+	if (fflush(fp) == EOF || ferror(fp))
+		err(1, "%s", file ? file : "stdout");
+	if (file)
+		fclose(fp);
+
+	if (img)
+		image(file, img, profile);
+	return 0;
+}
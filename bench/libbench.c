@@ -0,0 +1,560 @@
+/*
+ * Public Domain, 2026, Marco S Hyman <marc@snafu.org>
+ */
+
+#ifdef LINUX
+#define _DEFAULT_SOURCE
+#endif
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gpslib.h"
+
+/*
+ * Library micro benchmarks.
+ *
+ * Time the hot paths of the library on records made up in memory:
+ * framing packets, receiving frames, converting text to packets,
+ * printing each packet type, and decoding positions and floats.  Every
+ * benchmark runs the same work in several rounds and the fastest round
+ * is reported so results can be compared from run to run.  Frames are
+ * received from a file; gps_open uses a port that is not a terminal
+ * as is.  With -b the results are compared against a baseline written
+ * earlier with -w.
+ *
+ * After the timed rounds each benchmark is run once more with library
+ * memory accounting on to report the allocations per record and the
+ * peak of live heap bytes.  Growth in either over the baseline is
+ * flagged.
+ */
+
+#define RECORDS		100000		/* records per call */
+#define ROUNDS		5		/* rounds per benchmark */
+#define ROUND_MIN	0.1		/* seconds a round runs at least */
+#define BASE_MAX	64		/* benchmarks in a baseline */
+
+struct bench {
+	gps_handle gps;
+	long	records;		/* records per call of a benchmark */
+	const char *file;		/* input file, if any */
+	u_char	*pkts;			/* packets, GPS_FRAME_MAX apart */
+	int	*lens;			/* packet lengths */
+	u_char	pkt[GPS_FRAME_MAX];	/* one packet for the print test */
+	int	len;
+	double	bytes;			/* bytes processed per call */
+};
+
+typedef long (*bench_fn)(struct bench *);
+
+struct base {
+	char	name[32];
+	double	ns;			/* ns per record */
+	double	allocs;			/* allocations per record, -1 if none */
+	double	peak;			/* peak live bytes, -1 if none */
+};
+
+static struct base base[BASE_MAX];
+static int nbase;
+static FILE *base_out;
+
+static volatile double sink;		/* keeps results from the optimizer */
+
+static void
+usage(const char* prog, const char* err, ...)
+{
+	if (err) {
+		va_list ap;
+		va_start(ap, err);
+		vfprintf(stderr, err, ap);
+		va_end(ap);
+	}
+	fprintf(stderr, "usage: %s [-b baseline | -w baseline] [-n records] "
+		"[-r rounds]\n", prog);
+	exit(1);
+}
+
+/*
+ * CPU time used so far
+ */
+static double
+now(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+	    ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+/*
+ * Read a baseline written by -w: one benchmark per line, its name,
+ * the ns per record, and the allocations per record and peak live
+ * bytes.  Baselines written before the memory columns have only the
+ * first two.
+ */
+static void
+read_base(const char *file)
+{
+	char buf[128];
+	struct base *bp;
+	FILE *fp;
+
+	if ((fp = fopen(file, "r")) == NULL)
+		err(1, "%s", file);
+	while (nbase < BASE_MAX && fgets(buf, sizeof buf, fp)) {
+		bp = &base[nbase];
+		bp->allocs = bp->peak = -1;
+		if (buf[0] != '#' && sscanf(buf, "%31s %lf %lf %lf", bp->name,
+					    &bp->ns, &bp->allocs,
+					    &bp->peak) >= 2)
+			nbase += 1;
+	}
+	fclose(fp);
+}
+
+static const struct base *
+find_base(const char *name)
+{
+	int ix;
+
+	for (ix = 0; ix < nbase; ix++)
+		if (strcmp(base[ix].name, name) == 0)
+			return &base[ix];
+	return NULL;
+}
+
+/*
+ * Run a benchmark, report the fastest of the rounds, and compare it to
+ * the baseline.  A round repeats the benchmark until it has run for
+ * ROUND_MIN seconds so that short benchmarks are timed as well as the
+ * long ones.  The memory use comes from one more, untimed, call.
+ */
+static void
+run(const char *name, bench_fn fn, struct bench *b, int rounds)
+{
+	const struct base *old;
+	struct gps_mem_stats st;
+	double allocs;
+	double best = 0;
+	double start;
+	double secs;
+	double ns;
+	long recs = 0;
+	long total;
+	int ix;
+
+	for (ix = 0; ix < rounds; ix++) {
+		start = now();
+		total = 0;
+		do {
+			recs = fn(b);
+			total += recs;
+			secs = now() - start;
+		} while (secs < ROUND_MIN);
+		ns = total ? secs * 1e9 / total : 0;
+		if (ix == 0 || ns < best)
+			best = ns;
+	}
+	gps_mem_reset();
+	gps_mem_account(1);
+	recs = fn(b);
+	gps_mem_account(0);
+	gps_mem_stats(GPS_MEM_PHASES, &st);
+	allocs = recs ? (double) st.allocs / recs : 0;
+
+	printf("%-10s %9ld records %9.1f MB/s %9.1f ns/record", name, recs,
+	       best > 0 ? b->bytes / recs / best * 1e3 : 0, best);
+	if ((old = find_base(name)) != NULL && old->ns > 0)
+		printf("  %+6.1f%%", (best - old->ns) * 100 / old->ns);
+	else if (nbase)
+		printf("  (new)");
+	printf("  %6.2f allocs/record %9.1f KB peak", allocs, st.peak / 1024.0);
+	/* allow for the rounding of the baseline */
+	if (old != NULL &&
+	    ((old->allocs >= 0 && allocs > old->allocs * 1.01 + 0.0001) ||
+	     (old->peak >= 0 && st.peak > old->peak * 1.01)))
+		printf("  (more memory)");
+	printf("\n");
+	fflush(stdout);
+	if (base_out)
+		fprintf(base_out, "%s %.2f %.4f %lld\n", name, best, allocs,
+			st.peak);
+}
+
+/*
+ * Make up track points that wander so every field changes
+ */
+static void
+make_track(struct bench *b)
+{
+	const struct gps_trk_codec *tc = gps_trk_codec(D301);
+	struct gps_trk trk;
+	long ix;
+
+	b->pkts = malloc(b->records * GPS_FRAME_MAX);
+	b->lens = malloc(b->records * sizeof *b->lens);
+	if (b->pkts == NULL || b->lens == NULL)
+		err(1, "malloc");
+	memset(&trk, 0, sizeof trk);
+	trk.lat = 37.5;
+	trk.lon = -122.25;
+	for (ix = 0; ix < b->records; ix++) {
+		trk.lat += ((ix * 7919) % 2001 - 1000) * 1e-8;
+		trk.lon += ((ix * 104729) % 2001 - 1000) * 1e-8;
+		trk.time = 500000000 + ix;
+		trk.alt = 100 + (ix % 500) / 10.0;
+		trk.depth = no_val.f;
+		trk.new_trk = ix == 0;
+		b->pkts[ix * GPS_FRAME_MAX] = p_trk_data;
+		b->lens[ix] = tc->encode(&trk, &b->pkts[ix * GPS_FRAME_MAX]);
+	}
+}
+
+static long
+bench_frame(struct bench *b)
+{
+	u_char *frame;
+	size_t len;
+	long ix;
+
+	b->bytes = 0;
+	for (ix = 0; ix < b->records; ix++) {
+		len = b->lens[ix];
+		b->bytes += len;
+		if ((frame = gps_frame(&b->pkts[ix * GPS_FRAME_MAX], &len)) ==
+		    NULL)
+			errx(1, "gps_frame failed");
+		gps_free(frame);
+	}
+	return b->records;
+}
+
+/*
+ * Write the track points as frames to the input file
+ */
+static void
+make_frames(struct bench *b)
+{
+	u_char *frame;
+	size_t len;
+	long ix;
+	FILE *fp;
+
+	if ((fp = fopen(b->file, "w")) == NULL)
+		err(1, "%s", b->file);
+	b->bytes = 0;
+	for (ix = 0; ix < b->records; ix++) {
+		len = b->lens[ix];
+		frame = gps_frame(&b->pkts[ix * GPS_FRAME_MAX], &len);
+		if (frame == NULL)
+			errx(1, "gps_frame failed");
+		fwrite(frame, len, 1, fp);
+		b->bytes += len;
+		gps_free(frame);
+	}
+	if (fclose(fp) == EOF)
+		err(1, "%s", b->file);
+}
+
+static long
+bench_recv(struct bench *b)
+{
+	u_char buf[GPS_FRAME_MAX];
+	gps_handle gps;
+	long ix;
+	int len;
+
+	gps = gps_open(b->file, 0);
+	for (ix = 0; ix < b->records; ix++) {
+		len = sizeof buf;
+		if (gps_recv(gps, 1, buf, &len) != 1)
+			errx(1, "gps_recv failed at record %ld", ix);
+	}
+	gps_close(gps);
+	return b->records;
+}
+
+/*
+ * Write a text file of waypoints and a track log holding the given
+ * number of records in total, one waypoint for every ten points.
+ */
+static void
+make_text(struct bench *b)
+{
+	long wpts = b->records / 11;
+	long pts = b->records - wpts;
+	double lat = 37.5;
+	double lon = -122.25;
+	long ix;
+	FILE *fp;
+
+	if ((fp = fopen(b->file, "w")) == NULL)
+		err(1, "%s", b->file);
+	fprintf(fp, WPT_HDR ", %ld records]\n", wpts);
+	for (ix = 0; ix < wpts; ix++)
+		fprintf(fp, " %.8f %.8f S:18 D:0 I:W%05ld C:waypoint %ld\n",
+			lat + ix * 1e-4, lon - ix * 1e-4, ix % 100000, ix);
+	fprintf(fp, "[end transfer, %ld/%ld records]\n", wpts, wpts);
+	fprintf(fp, TRK_HDR ", %ld records]\n", pts);
+	for (ix = 0; ix < pts; ix++) {
+		if (ix % 1000 == 0)
+			fprintf(fp, "Track: BENCH %ld\n", ix / 1000);
+		lat += ((ix * 7919) % 2001 - 1000) * 1e-8;
+		lon += ((ix * 104729) % 2001 - 1000) * 1e-8;
+		fprintf(fp, "2026-01-%02ld %02ld:%02ld:%02ld %12.8f %13.8f "
+			"%f%s\n", ix / 86400 % 28 + 1, ix / 3600 % 24,
+			ix / 60 % 60, ix % 60, lat, lon,
+			100 + (ix % 500) / 10.0,
+			ix % 1000 == 0 ? " start" : "");
+	}
+	fprintf(fp, "[end transfer, %ld/%ld records]\n", pts, pts);
+	b->bytes = ftell(fp);
+	if (fclose(fp) == EOF)
+		err(1, "%s", b->file);
+}
+
+static long
+bench_format(struct bench *b)
+{
+	struct gps_lists *lists;
+	struct gps_lists *cur;
+	long recs = 0;
+	FILE *fp;
+
+	if ((fp = fopen(b->file, "r")) == NULL)
+		err(1, "%s", b->file);
+	lists = gps_format(b->gps, fp);
+	for (cur = lists; cur; cur = cur->next)
+		recs += cur->list->count;
+	gps_lists_free(lists);
+	fclose(fp);
+	return recs;
+}
+
+/*
+ * Print the one packet over and over with stdout sent to /dev/null
+ */
+static long
+bench_print(struct bench *b)
+{
+	int save;
+	int null;
+	long ix;
+
+	fflush(stdout);
+	if ((save = dup(STDOUT_FILENO)) == -1 ||
+	    (null = open("/dev/null", O_WRONLY)) == -1)
+		err(1, "/dev/null");
+	dup2(null, STDOUT_FILENO);
+	close(null);
+	for (ix = 0; ix < b->records; ix++)
+		gps_print(b->gps, CMD_WPT, b->pkt, b->len);
+	fflush(stdout);
+	dup2(save, STDOUT_FILENO);
+	close(save);
+	b->bytes = (double) b->len * b->records;
+	return b->records;
+}
+
+/*
+ * Time gps_print for every packet type the library knows
+ */
+static void
+print_types(struct bench *b, int rounds)
+{
+	static const struct {
+		int	type;
+		u_char	pid;
+	} types[] = {
+		{ D100, p_wpt_data }, { D101, p_wpt_data },
+		{ D102, p_wpt_data }, { D103, p_wpt_data },
+		{ D104, p_wpt_data }, { D105, p_wpt_data },
+		{ D106, p_wpt_data }, { D107, p_wpt_data },
+		{ D108, p_wpt_data }, { D109, p_wpt_data },
+		{ D200, p_rte_hdr }, { D201, p_rte_hdr },
+		{ D202, p_rte_hdr }, { D210, p_rte_link },
+		{ D300, p_trk_data }, { D301, p_trk_data },
+		{ D310, p_trk_hdr }
+	};
+	const struct gps_wpt_codec *wc;
+	const struct gps_rte_codec *rc;
+	const struct gps_trk_codec *tc;
+	struct gps_wpt wpt;
+	struct gps_rte rte;
+	struct gps_trk trk;
+	char name[32];
+	size_t ix;
+
+	memset(&wpt, 0, sizeof wpt);
+	wpt.lat = 37.5;
+	wpt.lon = -122.25;
+	wpt.alt = 100;
+	wpt.sym = 18;
+	wpt.ident.str = "BENCH1";
+	wpt.ident.len = 6;
+	wpt.cmnt.str = "benchmark waypoint";
+	wpt.cmnt.len = 18;
+	memset(&rte, 0, sizeof rte);
+	rte.num = 1;
+	rte.ident.str = "BENCH ROUTE";
+	rte.ident.len = 11;
+	memset(&trk, 0, sizeof trk);
+	trk.lat = 37.5;
+	trk.lon = -122.25;
+	trk.time = 500000000;
+	trk.alt = 100;
+	trk.depth = no_val.f;
+	trk.ident.str = "BENCH TRACK";
+	trk.ident.len = 11;
+
+	for (ix = 0; ix < sizeof types / sizeof types[0]; ix++) {
+		memset(b->pkt, 0, sizeof b->pkt);
+		b->pkt[0] = types[ix].pid;
+		switch (types[ix].pid) {
+		case p_wpt_data:
+			wc = gps_wpt_codec(types[ix].type);
+			gps_set_wpt_type(b->gps, types[ix].type);
+			b->len = wc->encode(&wpt, b->pkt);
+			break;
+		case p_rte_hdr:
+			rc = gps_rte_codec(types[ix].type);
+			gps_set_rte_hdr_type(b->gps, types[ix].type);
+			b->len = rc->encode(&rte, b->pkt);
+			break;
+		case p_rte_link:
+			rc = gps_rte_codec(types[ix].type);
+			gps_set_rte_lnk_type(b->gps, types[ix].type);
+			b->len = rc->encode(&rte, b->pkt);
+			break;
+		case p_trk_hdr:
+			tc = gps_trk_codec(types[ix].type);
+			gps_set_trk_hdr_type(b->gps, types[ix].type);
+			b->len = tc->encode(&trk, b->pkt);
+			break;
+		default:
+			tc = gps_trk_codec(types[ix].type);
+			gps_set_trk_type(b->gps, types[ix].type);
+			b->len = tc->encode(&trk, b->pkt);
+			break;
+		}
+		snprintf(name, sizeof name, "print-D%d", types[ix].type);
+		run(name, bench_print, b, rounds);
+	}
+}
+
+static long
+bench_semicircle(struct bench *b)
+{
+	double sum = 0;
+	long ix;
+
+	for (ix = 0; ix < b->records; ix++)
+		sum += gps_semicircle2double(&b->pkts[ix * GPS_FRAME_MAX + 1]);
+	sink = sum;
+	b->bytes = 4.0 * b->records;
+	return b->records;
+}
+
+static long
+bench_float(struct bench *b)
+{
+	double sum = 0;
+	long ix;
+
+	for (ix = 0; ix < b->records; ix++)
+		sum += gps_get_float(&b->pkts[ix * GPS_FRAME_MAX + 13]);
+	sink = sum;
+	b->bytes = 4.0 * b->records;
+	return b->records;
+}
+
+int
+main(int argc, char * argv[])
+{
+	char tmp[] = "/tmp/libbench.XXXXXX";
+	struct bench b;
+	const char *in = NULL;
+	const char *out = NULL;
+	long records = RECORDS;
+	int rounds = ROUNDS;
+	char *rem;
+	int fd;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "b:n:r:w:")) != -1) {
+		switch (ch) {
+		case 'b':
+			in = optarg;
+			break;
+		case 'n':
+			records = strtol(optarg, &rem, 0);
+			if (*rem || records <= 0)
+				usage(argv[0], "`%s' is a bad record count\n",
+				      optarg);
+			break;
+		case 'r':
+			rounds = strtol(optarg, &rem, 0);
+			if (*rem || rounds <= 0)
+				usage(argv[0], "`%s' is a bad round count\n",
+				      optarg);
+			break;
+		case 'w':
+			out = optarg;
+			break;
+		default:
+			usage(argv[0], 0);
+		}
+	}
+	if (argc != optind)
+		usage(argv[0], "unknown command line argument: %s ...\n",
+		      argv[optind]);
+	if (in && out)
+		usage(argv[0], "-b and -w may not be used together\n");
+	if (in)
+		read_base(in);
+	if (out && (base_out = fopen(out, "w")) == NULL)
+		err(1, "%s", out);
+
+	if ((fd = mkstemp(tmp)) == -1)
+		err(1, "%s", tmp);
+	close(fd);
+
+	memset(&b, 0, sizeof b);
+	b.records = records;
+	b.file = tmp;
+	b.gps = gps_open(tmp, 0);
+	gps_set_wpt_type(b.gps, D108);
+	gps_set_rte_hdr_type(b.gps, D202);
+	gps_set_rte_wpt_type(b.gps, D108);
+	gps_set_rte_lnk_type(b.gps, D210);
+	gps_set_trk_hdr_type(b.gps, D310);
+	gps_set_trk_type(b.gps, D301);
+
+	make_track(&b);
+	run("frame", bench_frame, &b, rounds);
+	make_frames(&b);
+	run("recv", bench_recv, &b, rounds);
+	make_text(&b);
+	run("format", bench_format, &b, rounds);
+	run("semicircle", bench_semicircle, &b, rounds);
+	run("getfloat", bench_float, &b, rounds);
+	print_types(&b, rounds);
+
+	if (base_out && fclose(base_out) == EOF)
+		err(1, "%s", out);
+	gps_close(b.gps);
+	unlink(tmp);
+	free(b.pkts);
+	free(b.lens);
+	return 0;
+}
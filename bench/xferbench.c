@@ -0,0 +1,558 @@
+/*
+ * Public Domain, 2026, Marco S Hyman <marc@snafu.org>
+ */
+
+#ifdef LINUX
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE	600		/* posix_openpt */
+#endif
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gpslib.h"
+
+/*
+ * Transfer benchmark.
+ *
+ * Run a download and an upload of a track log, as gardump -t and
+ * garload would, against a unit stand-in running in a thread on the
+ * master side of a pty.  The stand-in holds every frame for the time
+ * it takes on a serial line of the given baud rate, in both directions,
+ * and may wait before each ack, lose frames it sends, and corrupt
+ * frames in either direction.  A lost frame is sent again when its ack
+ * does not come; a corrupt frame is nak'd and sent again.
+ *
+ * For each session the records per second, the share of the elapsed
+ * time the line was busy, and the CPU time of the host side are
+ * reported.  What is left of the elapsed time is spent waiting on the
+ * stop-and-wait protocol.
+ */
+
+#define POINTS		200		/* track points per session */
+#define UNIT_TO		1.0		/* unit seconds to wait for an ack */
+#define UNIT_TRIES	10		/* unit sends of one frame */
+#define UNIT_PRODUCT	999		/* not in the known unit table */
+#define BIT_TIMES	10		/* start, 8 data, and stop bits */
+
+struct unit {
+	int	fd;			/* pty master */
+	double	baud;
+	double	ack_delay;		/* seconds before each ack */
+	double	loss;			/* share of frames lost */
+	double	corrupt;		/* share of frames corrupted */
+	u_int32_t seed;
+	long	points;			/* track points to send */
+	volatile int stop;
+	int	bufix;
+	int	bufcnt;
+	u_char	buf[GPS_BUF_LEN];
+	pthread_mutex_t lock;		/* protects the counters */
+	long	wire;			/* bytes on the line */
+	long	resent;			/* frames sent again, either way */
+	long	received;		/* records uploaded */
+};
+
+static void
+usage(const char* prog, const char* err, ...)
+{
+	if (err) {
+		va_list ap;
+		va_start(ap, err);
+		vfprintf(stderr, err, ap);
+		va_end(ap);
+	}
+	fprintf(stderr, "usage: %s [-a ack-ms] [-b baud] [-c corrupt] "
+		"[-l loss] [-n points] [-s seed]\n", prog);
+	exit(1);
+}
+
+static double
+wall(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*
+ * CPU time of the calling thread, the host side of the link
+ */
+static double
+host_cpu(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+pause_for(double secs)
+{
+	struct timespec ts;
+
+	if (secs <= 0)
+		return;
+	ts.tv_sec = (time_t) secs;
+	ts.tv_nsec = (long) ((secs - ts.tv_sec) * 1e9);
+	while (nanosleep(&ts, &ts) == -1)
+		continue;
+}
+
+/*
+ * Returns 1 with the given probability.  The generator is seeded so a
+ * run can be repeated.
+ */
+static int
+chance(struct unit *u, double p)
+{
+	u->seed = u->seed * 1103515245 + 12345;
+	return p > 0 && ((u->seed >> 8) & 0xffff) < p * 65536;
+}
+
+/*
+ * Account for len bytes crossing the line
+ */
+static void
+line(struct unit *u, long len)
+{
+	pthread_mutex_lock(&u->lock);
+	u->wire += len;
+	pthread_mutex_unlock(&u->lock);
+	pause_for(len * BIT_TIMES / u->baud);
+}
+
+static int
+unit_byte(struct unit *u, u_char *c, double to)
+{
+	struct timeval tv;
+	fd_set readfds;
+
+	if (u->bufix >= u->bufcnt) {
+		tv.tv_sec = (long) to;
+		tv.tv_usec = (long) ((to - tv.tv_sec) * 1e6);
+		FD_ZERO(&readfds);
+		FD_SET(u->fd, &readfds);
+		if (select(u->fd + 1, &readfds, 0, 0, &tv) != 1)
+			return 0;
+		u->bufcnt = (int) read(u->fd, u->buf, sizeof u->buf);
+		if (u->bufcnt <= 0)
+			return 0;
+		u->bufix = 0;
+	}
+	*c = u->buf[u->bufix++];
+	return 1;
+}
+
+/*
+ * Read a frame from the host.  The packet, id first, is put in pkt and
+ * its length in *len.  The frame is held for its time on the line.
+ * Returns 1, -1 for a bad frame, or 0 on timeout.
+ */
+static int
+unit_recv(struct unit *u, u_char *pkt, int *len, double to)
+{
+	u_char c;
+	long raw = 1;
+	int dle_seen = 0;
+	int sum = 0;
+	int n = 0;
+
+	do {
+		if (! unit_byte(u, &c, to))
+			return 0;
+	} while (c != dle);
+	for (;;) {
+		if (! unit_byte(u, &c, UNIT_TO))
+			return 0;
+		raw += 1;
+		if (dle_seen) {
+			dle_seen = 0;
+			if (c == etx)
+				break;
+		} else if (c == dle) {
+			dle_seen = 1;
+			continue;
+		}
+		sum += c;
+		if (n < GPS_FRAME_MAX + 2)
+			pkt[n++] = c;
+	}
+	line(u, raw);
+	if (n < 3 || (sum & 0xff) != 0 || pkt[1] != n - 3)
+		return -1;
+	/* drop the length and checksum */
+	memmove(pkt + 1, pkt + 2, n - 3);
+	*len = n - 2;
+	return 1;
+}
+
+/*
+ * Send a packet to the host, losing or corrupting it if asked
+ */
+static void
+unit_send(struct unit *u, const u_char *pkt, int len, int faults)
+{
+	u_char *frame;
+	size_t flen = (size_t) len;
+
+	if ((frame = gps_frame(pkt, &flen)) == NULL)
+		errx(1, "no memory");
+	line(u, (long) flen);
+	if (faults && chance(u, u->loss)) {
+		gps_free(frame);
+		return;
+	}
+	if (faults && chance(u, u->corrupt) && frame[3] != dle &&
+	    (frame[3] ^ 0x55) != dle)
+		frame[3] ^= 0x55;
+	if (write(u->fd, frame, flen) != (ssize_t) flen)
+		warn("unit write");
+	gps_free(frame);
+}
+
+static void
+unit_ack(struct unit *u, u_char type, int ok)
+{
+	u_char pkt[3];
+
+	pause_for(u->ack_delay);
+	pkt[0] = ok ? ack : nak;
+	pkt[1] = type;
+	pkt[2] = 0;
+	unit_send(u, pkt, 3, 0);
+}
+
+/*
+ * Send a packet and wait for its ack, sending it again on a nak or
+ * when the ack does not come.  Returns 0 or -1 if the host gave up.
+ */
+static int
+unit_send_wait(struct unit *u, const u_char *pkt, int len)
+{
+	u_char resp[GPS_FRAME_MAX + 2];
+	int rlen;
+	int try;
+
+	for (try = 0; try < UNIT_TRIES && ! u->stop; try++) {
+		if (try) {
+			pthread_mutex_lock(&u->lock);
+			u->resent += 1;
+			pthread_mutex_unlock(&u->lock);
+		}
+		unit_send(u, pkt, len, 1);
+		if (unit_recv(u, resp, &rlen, UNIT_TO) == 1 &&
+		    resp[0] == ack)
+			return 0;
+	}
+	return -1;
+}
+
+static int
+put16(u_char *p, int val)
+{
+	p[0] = (u_char) val;
+	p[1] = (u_char) (val >> 8);
+	return 2;
+}
+
+/*
+ * Product data followed by a capability array naming D310/D301 tracks
+ */
+static void
+unit_product(struct unit *u)
+{
+	static const struct {
+		char	tag;
+		int	num;
+	} caps[] = {
+		{ 'P', 0 }, { 'L', 1 }, { 'A', 10 }, { 'A', 100 },
+		{ 'D', 108 }, { 'A', 201 }, { 'D', 202 }, { 'D', 108 },
+		{ 'D', 210 }, { 'A', 301 }, { 'D', 310 }, { 'D', 301 }
+	};
+	u_char pkt[GPS_FRAME_MAX];
+	size_t ix;
+	int len;
+
+	pkt[0] = p_prod_resp;
+	len = 1 + put16(pkt + 1, UNIT_PRODUCT);
+	len += put16(pkt + len, 100);
+	memcpy(pkt + len, "xferbench", 10);
+	if (unit_send_wait(u, pkt, len + 10) == -1)
+		return;
+	pkt[0] = p_cap;
+	len = 1;
+	for (ix = 0; ix < sizeof caps / sizeof caps[0]; ix++) {
+		pkt[len++] = (u_char) caps[ix].tag;
+		len += put16(pkt + len, caps[ix].num);
+	}
+	unit_send_wait(u, pkt, len);
+}
+
+/*
+ * A track log: one D310 header and D301 points that wander
+ */
+static int
+track_packet(long ix, u_char *pkt)
+{
+	struct gps_trk trk;
+
+	memset(&trk, 0, sizeof trk);
+	if (ix == 0) {
+		pkt[0] = p_trk_hdr;
+		trk.ident.str = "XFERBENCH";
+		trk.ident.len = 9;
+		return gps_trk_codec(D310)->encode(&trk, pkt);
+	}
+	pkt[0] = p_trk_data;
+	trk.lat = 37.5 + ((ix * 7919) % 2001 - 1000) * 1e-6;
+	trk.lon = -122.25 + ((ix * 104729) % 2001 - 1000) * 1e-6;
+	trk.time = 500000000 + ix;
+	trk.alt = 100 + (ix % 500) / 10.0;
+	trk.depth = no_val.f;
+	trk.new_trk = ix == 1;
+	return gps_trk_codec(D301)->encode(&trk, pkt);
+}
+
+static void
+unit_track(struct unit *u)
+{
+	u_char pkt[GPS_FRAME_MAX];
+	long ix;
+
+	pkt[0] = p_xfr_begin;
+	if (unit_send_wait(u, pkt, 1 + put16(pkt + 1, (int) u->points)) == -1)
+		return;
+	for (ix = 0; ix < u->points; ix++)
+		if (unit_send_wait(u, pkt, track_packet(ix, pkt)) == -1)
+			return;
+	pkt[0] = p_xfr_end;
+	unit_send_wait(u, pkt, 1 + put16(pkt + 1, CMD_TRK));
+}
+
+/*
+ * Thread: the unit.  Every good frame from the host is acked, bad
+ * frames are nak'd.
+ */
+static void *
+unit_run(void *arg)
+{
+	struct unit *u = arg;
+	u_char pkt[GPS_FRAME_MAX + 2];
+	int stat;
+	int len;
+
+	while (! u->stop) {
+		if ((stat = unit_recv(u, pkt, &len, 0.1)) == 0 ||
+		    pkt[0] == ack || pkt[0] == nak)
+			continue;
+		if (stat == -1 || chance(u, u->corrupt)) {
+			/* the host sends it again */
+			pthread_mutex_lock(&u->lock);
+			u->resent += 1;
+			pthread_mutex_unlock(&u->lock);
+			unit_ack(u, pkt[0], 0);
+			continue;
+		}
+		unit_ack(u, pkt[0], 1);
+		switch (pkt[0]) {
+		case p_prod_rqst:
+			unit_product(u);
+			break;
+		case p_cmd_type:
+			if (len > 1 && pkt[1] == CMD_TRK)
+				unit_track(u);
+			break;
+		case p_trk_hdr:
+		case p_trk_data:
+			pthread_mutex_lock(&u->lock);
+			u->received += 1;
+			pthread_mutex_unlock(&u->lock);
+			break;
+		default:
+			break;
+		}
+	}
+	return NULL;
+}
+
+static int
+count_packet(gps_handle gps, enum gps_cmd_id cmd, const u_char *packet,
+	     int len, void *arg)
+{
+	if (*packet == p_trk_hdr || *packet == p_trk_data)
+		*(long *) arg += 1;
+	return 0;
+}
+
+/*
+ * The track log the unit sends, as a list to upload
+ */
+static struct gps_lists *
+track_lists(long points)
+{
+	struct gps_lists *lists;
+	u_char pkt[GPS_FRAME_MAX];
+	long ix;
+
+	if ((lists = gps_malloc(sizeof *lists)) == NULL)
+		err(1, "malloc");
+	lists->next = NULL;
+	lists->list = gps_list_new(CMD_TRK);
+	for (ix = 0; ix < points; ix++)
+		gps_list_append(lists->list, pkt, track_packet(ix, pkt));
+	return lists;
+}
+
+static void
+report(struct unit *u, const char *name, long recs, double secs,
+       double cpu, int ok)
+{
+	double busy;
+
+	pthread_mutex_lock(&u->lock);
+	busy = u->wire * BIT_TIMES / u->baud;
+	printf("%6.0f %-6s %6ld %8.1f %6.1f%% %8.3f %8.3f %6.1f%% %6ld%s\n",
+	       u->baud, name, recs, recs / secs, busy * 100 / secs, cpu,
+	       secs - cpu, cpu * 100 / secs, u->resent,
+	       ok ? "" : "  failed");
+	u->wire = 0;
+	u->resent = 0;
+	pthread_mutex_unlock(&u->lock);
+	fflush(stdout);
+}
+
+/*
+ * Download and upload a track log at one baud rate
+ */
+static void
+run(struct unit *u)
+{
+	struct gps_lists *lists;
+	pthread_t tid;
+	gps_handle gps;
+	double start;
+	double cpu;
+	long recs;
+	int ok;
+
+	if ((u->fd = posix_openpt(O_RDWR | O_NOCTTY)) == -1 ||
+	    grantpt(u->fd) == -1 || unlockpt(u->fd) == -1)
+		err(1, "pty");
+	u->stop = 0;
+	u->bufix = u->bufcnt = 0;
+	gps = gps_open(ptsname(u->fd), 0);
+	if (pthread_create(&tid, NULL, unit_run, u) != 0)
+		errx(1, "can't start unit thread");
+
+	/* gardump -t */
+	start = wall();
+	cpu = host_cpu();
+	recs = 0;
+	ok = gps_version(gps, 0) == 1 &&
+		gps_cmd_xfer(gps, CMD_TRK, count_packet, &recs) == 1 &&
+		recs == u->points;
+	report(u, "dump", recs, wall() - start, host_cpu() - cpu, ok);
+
+	/* garload */
+	lists = track_lists(u->points);
+	u->received = 0;
+	start = wall();
+	cpu = host_cpu();
+	ok = gps_version(gps, 0) == 1 && gps_load(gps, lists) == 1;
+	report(u, "load", lists->list->count, wall() - start,
+	       host_cpu() - cpu, ok && u->received == u->points);
+	gps_lists_free(lists);
+
+	u->stop = 1;
+	pthread_join(tid, NULL);
+	gps_close(gps);
+	close(u->fd);
+}
+
+int
+main(int argc, char * argv[])
+{
+	static const double bauds[] = { 9600, 115200 };
+	struct unit u;
+	double baud = 0;
+	char *rem;
+	size_t ix;
+	int ch;
+
+	memset(&u, 0, sizeof u);
+	u.points = POINTS;
+	u.seed = 1;
+	while ((ch = getopt(argc, argv, "a:b:c:l:n:s:")) != -1) {
+		switch (ch) {
+		case 'a':
+			u.ack_delay = strtod(optarg, &rem) / 1000;
+			if (*rem || u.ack_delay < 0)
+				usage(argv[0], "`%s' is a bad ack delay\n",
+				      optarg);
+			break;
+		case 'b':
+			baud = strtod(optarg, &rem);
+			if (*rem || baud <= 0)
+				usage(argv[0], "`%s' is a bad baud rate\n",
+				      optarg);
+			break;
+		case 'c':
+			u.corrupt = strtod(optarg, &rem);
+			if (*rem || u.corrupt < 0 || u.corrupt >= 1)
+				usage(argv[0], "`%s' is a bad share of "
+				      "corrupt frames\n", optarg);
+			break;
+		case 'l':
+			u.loss = strtod(optarg, &rem);
+			if (*rem || u.loss < 0 || u.loss >= 1)
+				usage(argv[0], "`%s' is a bad share of lost "
+				      "frames\n", optarg);
+			break;
+		case 'n':
+			u.points = strtol(optarg, &rem, 0);
+			if (*rem || u.points < 2 || u.points > 65535)
+				usage(argv[0], "`%s' is a bad point count\n",
+				      optarg);
+			break;
+		case 's':
+			u.seed = (u_int32_t) strtoul(optarg, &rem, 0);
+			if (*rem)
+				usage(argv[0], "`%s' is a bad seed\n", optarg);
+			break;
+		default:
+			usage(argv[0], 0);
+		}
+	}
+	if (argc != optind)
+		usage(argv[0], "unknown command line argument: %s ...\n",
+		      argv[optind]);
+
+	/* every run talks to the same made up unit, don't cache it */
+	setenv("GARMIN_CAP_CACHE", "", 1);
+	pthread_mutex_init(&u.lock, NULL);
+	printf("  baud session  recs    rec/s   wire  host cpu     wait  "
+	       "   cpu resent\n");
+	if (baud) {
+		u.baud = baud;
+		run(&u);
+	} else
+		for (ix = 0; ix < sizeof bauds / sizeof bauds[0]; ix++) {
+			u.baud = bauds[ix];
+			run(&u);
+		}
+	pthread_mutex_destroy(&u.lock);
+	return 0;
+}
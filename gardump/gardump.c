@@ -3,16 +3,37 @@
  */
 
 #include <sys/types.h>
+#include <sys/time.h>
 
 #include <err.h>
+#include <glob.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "gpslib.h"
 
+#define PROBE_TO	2		/* default seconds to wait in -P */
+
+/*
+ * Ports probed by -P when none are named
+ */
+static const char *probe_ports[] = {
+#ifdef LINUX
+	"/dev/ttyUSB*", "/dev/ttyACM*", "/dev/ttyS*",
+#else
+	"/dev/tty0[0-9]", "/dev/ttyU*",
+#endif
+	NULL
+};
+
+static volatile sig_atomic_t stop;
+
 static void
 usage(const char* prog, const char* err, ...)
 {
@@ -22,11 +43,263 @@ usage(const char* prog, const char* err, ...)
 		vfprintf(stderr, err, ap);
 		va_end(ap);
 	}
-	fprintf(stderr, "usage: %s [-vwrtus] [-d debug-level] [-p port]\n",
-		prog);
+	fprintf(stderr, "usage: %s [-cvwrtusSmlM] [-d debug-level] [-p port] "
+		"[-T seconds]\n"
+		"       %s -P [-M] [-d debug-level] [-T seconds] [port ...]\n",
+		prog, prog);
 	exit(1);
 }
 
+/*
+ * -M: report the library memory use at exit
+ */
+static void
+mem_report(void)
+{
+	gps_mem_report(stderr);
+}
+
+/*
+ * A signal cancels the port so that a wait on the unit returns at
+ * once; the transfer is then aborted when the port is closed.
+ */
+static void
+catch_stop(int sig)
+{
+	stop = 1;
+	gps_cancel(NULL);
+}
+
+static void
+catch_signals(void)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = catch_stop;
+	sigemptyset(&sa.sa_mask);
+	/* no SA_RESTART, the signal must end a wait on the port */
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGHUP, &sa, NULL);
+}
+
+/*
+ * Packet handler for screen mirroring: feed the screenshot decoder and
+ * end the transfer as soon as the image is complete.
+ */
+static int
+mirror_packet(gps_handle gps, enum gps_cmd_id cmd, const u_char *packet,
+	      int len, void *arg)
+{
+	if (*packet != p_scr_shot)
+		return 0;
+	return gps_screen_packet(arg, packet, len) == 1;
+}
+
+/*
+ * Request screens back to back until interrupted writing each one to
+ * stdout as a delta frame holding only the rows that changed.  The
+ * frame rate is reported on stderr.
+ */
+static void
+mirror(gps_handle gps)
+{
+	struct gps_screen *scr = gps_get_screen(gps);
+	struct timeval start;
+	struct timeval now;
+	double secs = 0;
+	int frames = 0;
+	int rows;
+
+	if (scr == NULL)
+		errx(1, "no memory for screenshot");
+	gettimeofday(&start, NULL);
+	while (! stop) {
+		gps_screen_reset(scr);
+		if (gps_cmd_xfer(gps, CMD_SCREEN, mirror_packet, scr) != 1) {
+			if (stop)
+				break;
+			errx(1, "screenshot command failed");
+		}
+		rows = gps_screen_delta(scr, stdout);
+		if (rows == -1) {
+			if (! stop)
+				warnx("incomplete screenshot");
+			continue;
+		}
+		fflush(stdout);
+		frames += 1;
+		gettimeofday(&now, NULL);
+		secs = (double) (now.tv_sec - start.tv_sec) +
+			(now.tv_usec - start.tv_usec) / 1e6;
+		fprintf(stderr, "[frame %d, %d rows changed, %.2f fps]\n",
+			frames, rows, frames / secs);
+	}
+	fprintf(stderr, "[%d frames in %.1f seconds]\n", frames, secs);
+}
+
+/*
+ * Fix handler for live mode: write one line per fix.  The end of the
+ * stream is checked here as fixes arrive about once a second.
+ */
+static int
+pvt_line(gps_handle gps, const struct gps_pvt *pvt, void *arg)
+{
+	static const char *fixes[] = {
+		"none", "none", "2D", "3D", "2D-diff", "3D-diff"
+	};
+	char buf[24];
+	time_t tim;
+
+	tim = (time_t) pvt->utc;
+	strftime(buf, sizeof buf, "%Y-%m-%d %T", gmtime(&tim));
+	printf("%s.%03d %12.8f %13.8f %f %s %.1f %.2f %.2f %.2f\n", buf,
+	       (int) ((pvt->utc - tim) * 1000), pvt->lat, pvt->lon, pvt->alt,
+	       pvt->fix >= 0 && pvt->fix <= GPS_FIX_3D_DIFF ?
+	       fixes[pvt->fix] : "?", pvt->epe, pvt->east, pvt->north,
+	       pvt->up);
+	fflush(stdout);
+	return stop;
+}
+
+/*
+ * Stream fixes from the unit until interrupted
+ */
+static void
+live(gps_handle gps)
+{
+	printf("# yyyy-mm-dd hh:mm:ss.sss lat long alt fix epe "
+	       "east north up\n");
+	if (gps_pvt(gps, pvt_line, NULL) == -1 && ! stop)
+		errx(1, "position stream failed");
+}
+
+/*
+ * Write the protocol capability table of the unit and the packet types
+ * chosen from it as comments.
+ */
+static void
+print_protocols(gps_handle gps)
+{
+	const struct gps_protocols *tab = gps_get_protocols(gps);
+	int ix;
+	int jx;
+
+	printf("# protocol capabilities%s:\n",
+	       tab->sent ? "" : " (not sent by the unit, from known types)");
+	for (ix = 0; ix < tab->count; ix++) {
+		printf("#   %c%03d", tab->proto[ix].tag, tab->proto[ix].num);
+		for (jx = 0; jx < tab->proto[ix].ndata; jx++)
+			printf(" D%03d", tab->proto[ix].data[jx]);
+		printf("\n");
+	}
+	printf("# transfer types: waypoint D%d, route D%d D%d D%d, "
+	       "track D%d D%d\n", gps_get_wpt_type(gps),
+	       gps_get_rte_hdr_type(gps), gps_get_rte_wpt_type(gps),
+	       gps_get_rte_lnk_type(gps), gps_get_trk_hdr_type(gps),
+	       gps_get_trk_type(gps));
+}
+
+/*
+ * Add port to the probes unless it names a device already there
+ */
+static void
+add_probe(struct gps_probe *probes, char **paths, int *count,
+	  const char *port)
+{
+	char path[PATH_MAX];
+	int ix;
+
+	if (realpath(port, path) == NULL)
+		strlcpy(path, port, sizeof path);
+	for (ix = 0; ix < *count; ix++)
+		if (strcmp(paths[ix], path) == 0)
+			return;
+	if ((paths[*count] = strdup(path)) == NULL)
+		err(1, "strdup");
+	probes[*count].port = port;
+	*count += 1;
+}
+
+/*
+ * Probe the named ports, or the default port and every port matching
+ * probe_ports, for units at the same time.  Units found are listed on
+ * stdout.  Ports without a unit are reported on stderr if named or
+ * when debugging.  Returns the number of units found.
+ */
+static int
+probe(char **ports, int nports, double timeout, int debug)
+{
+	struct gps_probe *probes;
+	char **paths;
+	glob_t gl;
+	int flags = 0;
+	int count = 0;
+	int found;
+	int max;
+	int ix;
+
+	memset(&gl, 0, sizeof gl);
+	if (nports == 0)
+		for (ix = 0; probe_ports[ix]; ix++) {
+			switch (glob(probe_ports[ix], flags, NULL, &gl)) {
+			case 0:
+			case GLOB_NOMATCH:
+				flags = GLOB_APPEND;
+				break;
+			default:
+				break;
+			}
+		}
+	max = nports + 1 + (int) gl.gl_pathc;
+	probes = calloc(max, sizeof *probes);
+	paths = calloc(max, sizeof *paths);
+	if (probes == NULL || paths == NULL)
+		err(1, "calloc");
+	for (ix = 0; ix < nports; ix++)
+		add_probe(probes, paths, &count, ports[ix]);
+	if (nports == 0) {
+		if (access(DEFAULT_PORT, F_OK) == 0)
+			add_probe(probes, paths, &count, DEFAULT_PORT);
+		for (ix = 0; ix < (int) gl.gl_pathc; ix++)
+			add_probe(probes, paths, &count, gl.gl_pathv[ix]);
+	}
+
+	found = gps_probe(probes, count, timeout, debug);
+	if (found == -1)
+		err(1, "probe");
+	for (ix = 0; ix < count; ix++)
+		switch (probes[ix].state) {
+		case GPS_PROBE_FOUND:
+			printf("%s: product %d, version %d: %s\n",
+			       probes[ix].port, probes[ix].product_id,
+			       probes[ix].software_version,
+			       probes[ix].description ?
+			       probes[ix].description : "");
+			break;
+		case GPS_PROBE_NONE:
+			if (nports || debug)
+				warnx("%s: no answer", probes[ix].port);
+			break;
+		default:
+			if (nports || debug)
+				warnx("%s: %s", probes[ix].port,
+				      strerror(probes[ix].error));
+			break;
+		}
+	fflush(stdout);
+
+	gps_probe_free(probes, count);
+	for (ix = 0; ix < count; ix++)
+		free(paths[ix]);
+	free(paths);
+	free(probes);
+	if (flags)
+		globfree(&gl);
+	return found;
+}
+
 int
 main(int argc, char * argv[])
 {
@@ -34,16 +307,27 @@ main(int argc, char * argv[])
 	int routes = 0;
 	int tracks = 0;
 	int utc = 0;
+	int caps = 0;
 	int screen = 0;
+	int mirroring = 0;
+	int streaming = 0;
+	int probing = 0;
+	int memory = 0;
+	int format = GPS_SCREEN_PPM;
 	int debug = 0;
+	double limit = 0;
+	struct timeval tv;
 	const char* port = DEFAULT_PORT;
 
 	int opt;
 	char* rem;
 	gps_handle gps;
 
-	while ((opt = getopt(argc, argv, "d:vwrtusp:")) != -1) {
+	while ((opt = getopt(argc, argv, "cd:vwrtusSmlMp:PT:")) != -1) {
 		switch (opt) {
+		case 'c':
+			caps = 1;
+			break;
 		case 'd':
 			debug = strtol(optarg, &rem, 0);
 			if (*rem)
@@ -70,9 +354,32 @@ main(int argc, char * argv[])
 		case 's':
 			screen = 1;
 			break;
+		case 'S':
+			screen = 1;
+			format = GPS_SCREEN_PNG;
+			break;
+		case 'm':
+			screen = 1;
+			mirroring = 1;
+			break;
+		case 'l':
+			streaming = 1;
+			break;
+		case 'M':
+			memory = 1;
+			break;
 		case 'p':
 			port = strdup(optarg);
 			break;
+		case 'P':
+			probing = 1;
+			break;
+		case 'T':
+			limit = strtod(optarg, &rem);
+			if (*rem || limit <= 0)
+				usage(argv[ 0 ], "`%s' is a bad time limit\n",
+				      optarg);
+			break;
 		case '?':
 		default:
 			usage(argv[ 0 ], 0);
@@ -80,16 +387,46 @@ main(int argc, char * argv[])
 		}
 	}
 
+	/* registered first so it runs after gps_close_all */
+	if (memory) {
+		gps_mem_account(1);
+		atexit(mem_report);
+	}
+
+	if (probing) {
+		if (waypoints || routes || tracks || utc || screen || caps ||
+		    streaming)
+			errx(1, "-P may not be used with -cwrtusSml");
+		catch_signals();
+		if (probe(argv + optind, argc - optind,
+			  limit ? limit : PROBE_TO, debug) > 0)
+			return 0;
+		if (stop)
+			errx(1, "interrupted");
+		errx(1, "no GPS unit found");
+	}
+
 	if (argc != optind)
 		errx(1, "unknown command line argument: %s ...", argv[optind]);
 	
-	if (!waypoints && !routes && !tracks && !utc && !screen)
+	if (streaming && (waypoints || routes || tracks || utc || screen))
+		errx(1, "-l may not be used with -wrtusSm");
+
+	if (!waypoints && !routes && !tracks && !utc && !screen && !caps &&
+	    !streaming)
 		waypoints = routes = tracks = utc = 1;
 
-	if (screen && (waypoints || routes || tracks || utc))
-		errx(1, "-s may not be used with -wrtu");
+	if (screen && (waypoints || routes || tracks || utc || caps))
+		errx(1, "-s, -S, and -m may not be used with -cwrtu");
 
+	catch_signals();
 	gps = gps_open(port, debug);
+	atexit(gps_close_all);
+	if (limit) {
+		gettimeofday(&tv, NULL);
+		gps_set_deadline(gps, tv.tv_sec + tv.tv_usec / 1e6 + limit);
+	}
+	gps_set_screen_format(gps, format);
 
 	if (!screen)
 		printf("[gardump version %s]\n", VERSION);
@@ -97,6 +434,8 @@ main(int argc, char * argv[])
 	if (gps_version(gps, !screen) != 1)
 		errx(1, "can't communicate with GPS unit");
 
+	if (caps)
+		print_protocols(gps);
 	if (utc) {
 		gps_cmd(gps, CMD_UTC);
 		fflush(stdout);
@@ -113,11 +452,20 @@ main(int argc, char * argv[])
 		gps_cmd(gps, CMD_TRK);
 		fflush(stdout);
 	}
-	if (screen) {
+	if (streaming)
+		live(gps);
+	if (mirroring)
+		mirror(gps);
+	else if (screen) {
 	        gps_cmd(gps, CMD_SCREEN);
 		fflush(stdout);
 	}
-		
+
+	/* a signal ends -m and -l, anything else cut short is an error */
+	if (gps_cancelled(gps) && ! (stop && (mirroring || streaming))) {
+		gps_close(gps);
+		errx(1, stop ? "interrupted" : "time limit reached");
+	}
 	gps_close(gps);
 
 	return 0;
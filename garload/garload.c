@@ -3,8 +3,13 @@
  */
 
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 
 #include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -22,23 +27,583 @@ usage(const char* prog, const char* err, ...)
 		vfprintf(stderr, err, ap);
 		va_end(ap);
 	}
-	fprintf(stderr, "usage: %s [-v] [-d debug-level] [-p port]\n", prog);
+	fprintf(stderr, "usage: %s [-svM] [-d debug-level] [-e error] [-j jobs] "
+		"[-l limit] [-o image] [-p port]\n"
+		"          [-T seconds] [file ...]\n"
+		"       %s [-vM] [-d debug-level] [-p port] [-T seconds] "
+		"-i image\n"
+		"       %s [-vM] [-d debug-level] [-e error] [-j jobs] "
+		"[-l limit] [-r retries]\n"
+		"          [-T seconds] -p port -p port ... "
+		"[-i image | file ...]\n"
+		"       %s [-vM] [-b baud] [-d debug-level] [-e error] [-j jobs] "
+		"[-l limit]\n"
+		"          [-o image] -n profile [file ...]\n",
+		prog, prog, prog, prog);
 	exit(1);
 }
 
+/*
+ * Time limit for every port, UNIX seconds.  0 if none.
+ */
+static double deadline;
+
+/*
+ * -M: report the library memory use at exit
+ */
+static void
+mem_report(void)
+{
+	gps_mem_report(stderr);
+}
+
+/*
+ * A signal cancels every port so that waits on the units return at
+ * once; transfers are aborted when the ports are closed.
+ */
+static void
+catch_stop(int sig)
+{
+	gps_cancel(NULL);
+}
+
+static void
+catch_signals(void)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = catch_stop;
+	sigemptyset(&sa.sa_mask);
+	/* no SA_RESTART, the signal must end a wait on the port */
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGHUP, &sa, NULL);
+}
+
+/*
+ * Load a previously compiled image after checking that it was made
+ * for the packet types of the attached unit.
+ */
+static void
+load_image(const char *port, int debug, const char *name)
+{
+	struct gps_image img;
+	gps_handle gps;
+	FILE *fp;
+
+	if ((fp = fopen(name, "r")) == NULL)
+		err(1, "%s", name);
+	gps = gps_open(port, debug);
+	gps_set_deadline(gps, deadline);
+	if (gps_image_open(gps, &img, fp) == -1)
+		errx(1, "%s: not a valid upload image", name);
+	fclose(fp);
+	if (gps_version(gps, 1) != 1)
+		errx(1, "can't communicate with GPS unit");
+	if (gps_image_check(gps, &img) == -1)
+		errx(1, "%s: image was made for other packet types", name);
+	if (gps_load_image(gps, &img) < 0)
+		errx(1, "failure uploading GPS unit");
+	gps_image_close(&img);
+	gps_close(gps);
+}
+
+/*
+ * Fleet loading.
+ *
+ * Given more than one port the same data is loaded into every unit at
+ * once, one thread per unit.  The units are first asked for their
+ * packet types.  The input is then converted once for each distinct
+ * set of types and every unit is loaded from the records converted
+ * for its kind.  A unit that fails is retried on its own without
+ * holding up the others.
+ */
+struct profile {
+	struct profile *next;
+	int	types[6];		/* packet types of the units */
+	struct gps_lists *lists;	/* input converted for the types */
+	int	units;			/* units using the profile */
+};
+
+struct unit {
+	const char *port;
+	int	debug;
+	int	retries;		/* times to retry a failure */
+	gps_handle gps;
+	int	types[6];		/* negotiated packet types */
+	struct profile *prof;		/* records to load ... */
+	const struct gps_image *img;	/* ... or the image to load */
+	int	done;			/* sections loaded */
+	int	state;			/* 0 busy, 1 loaded, -1 failed */
+};
+
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Progress of a unit, one line on stderr
+ */
+static void
+report(const struct unit *u, const char *fmt, ...)
+{
+	va_list ap;
+
+	pthread_mutex_lock(&report_lock);
+	fprintf(stderr, "%s: ", u->port);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+	pthread_mutex_unlock(&report_lock);
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void
+unit_types(struct unit *u)
+{
+	u->types[0] = gps_get_wpt_type(u->gps);
+	u->types[1] = gps_get_rte_hdr_type(u->gps);
+	u->types[2] = gps_get_rte_wpt_type(u->gps);
+	u->types[3] = gps_get_rte_lnk_type(u->gps);
+	u->types[4] = gps_get_trk_hdr_type(u->gps);
+	u->types[5] = gps_get_trk_type(u->gps);
+}
+
+/*
+ * Thread: open the port of a unit and learn its packet types
+ */
+static void *
+unit_open(void *arg)
+{
+	struct unit *u = arg;
+	int try;
+
+	if ((u->gps = gps_try_open(u->port, u->debug)) == NULL) {
+		report(u, "can't open: %s", strerror(errno));
+		u->state = -1;
+		return NULL;
+	}
+	gps_set_deadline(u->gps, deadline);
+	for (try = 0; gps_version(u->gps, 0) != 1; try++) {
+		if (try == u->retries || gps_cancelled(u->gps)) {
+			report(u, "can't communicate with GPS unit");
+			u->state = -1;
+			return NULL;
+		}
+		report(u, "no answer, retry %d of %d", try + 1, u->retries);
+	}
+	unit_types(u);
+	report(u, "types D%d D%d D%d D%d D%d D%d", u->types[0], u->types[1],
+	       u->types[2], u->types[3], u->types[4], u->types[5]);
+	return NULL;
+}
+
+/*
+ * Load the sections of the unit's profile or image one at a time,
+ * starting with the first section not yet loaded.
+ */
+static int
+load_sections(struct unit *u)
+{
+	struct gps_image one_img;
+	struct gps_lists one;
+	struct gps_lists *cur;
+	int sections = 0;
+	int ix = 0;
+	int rc;
+
+	if (u->img)
+		sections = u->img->nsections;
+	else
+		for (cur = u->prof->lists; cur; cur = cur->next)
+			if (cur->list->count > 0)
+				sections += 1;
+	cur = u->img ? NULL : u->prof->lists;
+	for (;;) {
+		if (cur) {
+			if (cur->list->count == 0) {
+				cur = cur->next;
+				continue;
+			}
+		} else if (u->img == NULL || ix == sections)
+			break;
+		if (ix >= u->done) {
+			if (u->img) {
+				one_img = *u->img;
+				one_img.sections = &u->img->sections[ix];
+				one_img.nsections = 1;
+				rc = gps_load_image(u->gps, &one_img);
+			} else {
+				one.next = NULL;
+				one.list = cur->list;
+				rc = gps_load(u->gps, &one);
+			}
+			if (rc != 1)
+				return -1;
+			u->done = ix + 1;
+			report(u, "section %d of %d loaded", u->done,
+			       sections);
+		}
+		ix += 1;
+		if (cur)
+			cur = cur->next;
+	}
+	return 1;
+}
+
+/*
+ * Thread: load a unit, retrying on failure
+ */
+static void *
+unit_load(void *arg)
+{
+	struct unit *u = arg;
+	double start = now();
+	int try;
+
+	if (u->img && gps_image_check(u->gps, u->img) == -1) {
+		report(u, "image was made for other packet types");
+		u->state = -1;
+		return NULL;
+	}
+	for (try = 0; load_sections(u) != 1; try++) {
+		if (try == u->retries || gps_cancelled(u->gps)) {
+			report(u, "failed");
+			u->state = -1;
+			return NULL;
+		}
+		/* the failed transfer was aborted, the unit is idle */
+		report(u, "failed, retry %d of %d", try + 1, u->retries);
+		gps_version(u->gps, 0);
+	}
+	report(u, "loaded in %.1f s", now() - start);
+	u->state = 1;
+	return NULL;
+}
+
+/*
+ * Run fn in a thread for every unit still busy and wait for them all
+ */
+static void
+run_units(struct unit *units, int nunits, void *(*fn)(void *))
+{
+	pthread_t *tids;
+	int *started;
+	int ix;
+
+	tids = calloc(nunits, sizeof *tids);
+	started = calloc(nunits, sizeof *started);
+	if (tids == NULL || started == NULL)
+		err(1, "calloc");
+	for (ix = 0; ix < nunits; ix++)
+		if (units[ix].state == 0)
+			started[ix] = pthread_create(&tids[ix], NULL, fn,
+						     &units[ix]) == 0;
+	for (ix = 0; ix < nunits; ix++)
+		if (started[ix])
+			pthread_join(tids[ix], NULL);
+		else if (units[ix].state == 0) {
+			report(&units[ix], "can't start thread");
+			units[ix].state = -1;
+		}
+	free(tids);
+	free(started);
+}
+
+/*
+ * Input is converted once per profile.  Input that can't be re-read
+ * from the start is copied to a temporary file first.
+ */
+static FILE *
+rereadable(FILE *fp)
+{
+	char buf[65536];
+	FILE *tmp;
+	size_t len;
+
+	if (ftello(fp) != -1)
+		return fp;
+	if ((tmp = tmpfile()) == NULL)
+		err(1, "tmpfile");
+	while ((len = fread(buf, 1, sizeof buf, fp)) > 0)
+		if (fwrite(buf, 1, len, tmp) != len)
+			err(1, "tmpfile");
+	if (ferror(fp) || fflush(tmp) == EOF)
+		err(1, "can't copy input");
+	rewind(tmp);
+	return tmp;
+}
+
+/*
+ * Load the files, or the image if img is not NULL, into the units on
+ * all the given ports.  Returns the number of units that failed.
+ */
+static int
+fleet(struct unit *units, int nunits, FILE **files, int nfiles, int jobs,
+      double trk_error, int trk_limit, const struct gps_image *img)
+{
+	struct profile *profiles = NULL;
+	struct profile *prof;
+	struct unit *u;
+	off_t *pos;
+	int failed = 0;
+	int ix;
+	int jx;
+
+	run_units(units, nunits, unit_open);
+
+	pos = calloc(nfiles, sizeof *pos);
+	if (pos == NULL)
+		err(1, "calloc");
+	for (ix = 0; ix < nfiles && ! img; ix++) {
+		files[ix] = rereadable(files[ix]);
+		pos[ix] = ftello(files[ix]);
+	}
+	for (ix = 0; ix < nunits; ix++) {
+		u = &units[ix];
+		if (u->state != 0)
+			continue;
+		u->img = img;
+		if (img)
+			continue;
+		for (prof = profiles; prof; prof = prof->next)
+			if (memcmp(prof->types, u->types,
+				   sizeof prof->types) == 0)
+				break;
+		if (prof == NULL) {
+			if ((prof = calloc(1, sizeof *prof)) == NULL)
+				err(1, "calloc");
+			memcpy(prof->types, u->types, sizeof prof->types);
+			for (jx = 0; jx < nfiles; jx++)
+				fseeko(files[jx], pos[jx], SEEK_SET);
+			gps_set_trk_error(u->gps, trk_error);
+			gps_set_trk_limit(u->gps, trk_limit);
+			prof->lists = gps_format_files(u->gps, files, nfiles,
+						       jobs);
+			if (prof->lists == NULL)
+				errx(1, "no valid GPS data found");
+			prof->next = profiles;
+			profiles = prof;
+		}
+		prof->units += 1;
+		u->prof = prof;
+	}
+	for (prof = profiles; prof; prof = prof->next)
+		fprintf(stderr, "converted for D%d D%d D%d D%d D%d D%d: "
+			"%d units\n", prof->types[0], prof->types[1],
+			prof->types[2], prof->types[3], prof->types[4],
+			prof->types[5], prof->units);
+
+	run_units(units, nunits, unit_load);
+
+	for (ix = 0; ix < nunits; ix++) {
+		if (units[ix].state != 1) {
+			fprintf(stderr, "%s: not loaded\n", units[ix].port);
+			failed += 1;
+		}
+		if (units[ix].gps)
+			gps_close(units[ix].gps);
+	}
+	fprintf(stderr, "%d of %d units loaded\n", nunits - failed, nunits);
+	while ((prof = profiles) != NULL) {
+		profiles = prof->next;
+		gps_lists_free(prof->lists);
+		free(prof);
+	}
+	free(pos);
+	return failed;
+}
+
+/*
+ * Dry run.
+ *
+ * Convert and frame the input for the packet types of a profile
+ * instead of a unit and report what would be sent: the records and
+ * bytes of each section, the framed bytes including the transfer
+ * begin and end packets, the DLE escapes among them, and the time the
+ * transfer would take at the given baud rate.  Every frame sent is
+ * answered by an ack frame and nothing else is on the line, so the
+ * time is the bytes both ways at 10 bits a byte; the turn around time
+ * of the unit is not included.  The time taken to convert and to frame
+ * the input on this host is reported, too.
+ */
+
+#define ACK_FRAME	8		/* dle ack 2 pid 0 cksum dle etx */
+#define FRAME_ADD	5		/* dle, length, cksum, dle etx */
+
+static const char *
+section_name(int type)
+{
+	switch (type) {
+	case CMD_WPT:
+		return "waypoints";
+	case CMD_RTE:
+		return "routes";
+	case CMD_TRK:
+		return "tracks";
+	}
+	return "unknown";
+}
+
+/*
+ * Length of the packet once framed
+ */
+static size_t
+framed_len(const u_char *pkt, size_t len)
+{
+	u_char *f;
+
+	if ((f = gps_frame(pkt, &len)) == NULL)
+		errx(1, "no memory");
+	gps_free(f);
+	return len;
+}
+
+/*
+ * Write the lists as an upload image for the packet types of gps
+ */
+static void
+write_image(gps_handle gps, struct gps_lists *lists, const char *name)
+{
+	FILE *fp;
+
+	if ((fp = fopen(name, "w")) == NULL)
+		err(1, "%s", name);
+	if (gps_image_write(gps, lists, fp) < 0 || fclose(fp) == EOF)
+		errx(1, "%s: can't write image", name);
+}
+
+static void
+dry_run(gps_handle gps, FILE **files, int nfiles, int jobs, long baud)
+{
+	struct gps_lists *lists;
+	struct gps_lists *cur;
+	struct stat st;
+	u_char xfr[3];
+	double input = 0;
+	double convert;
+	double frame = 0;
+	double start;
+	long frames;
+	long bytes;
+	long framed;
+	long escapes;
+	long t_records = 0;
+	long t_bytes = 0;
+	long t_framed = 0;
+	long t_escapes = 0;
+	long t_frames = 0;
+	int ix;
+
+	for (ix = 0; ix < nfiles; ix++) {
+		files[ix] = rereadable(files[ix]);
+		if (fstat(fileno(files[ix]), &st) == 0)
+			input += st.st_size - ftello(files[ix]);
+	}
+	start = now();
+	lists = gps_format_files(gps, files, nfiles, jobs);
+	convert = now() - start;
+	if (lists == NULL)
+		errx(1, "no valid GPS data found");
+
+	printf("%-10s %8s %10s %10s %8s %9s\n", "section", "records",
+	       "bytes", "framed", "escapes", "seconds");
+	for (cur = lists; cur; cur = cur->next) {
+		if (cur->list->count == 0)
+			continue;
+		bytes = framed = 0;
+		start = now();
+		for (ix = 0; ix < cur->list->count; ix++) {
+			bytes += GPS_LIST_LEN(cur->list, ix);
+			framed += framed_len(GPS_LIST_REC(cur->list, ix),
+					     GPS_LIST_LEN(cur->list, ix));
+		}
+		frame += now() - start;
+		escapes = framed - bytes - cur->list->count * FRAME_ADD;
+
+		/* transfer begin and end */
+		xfr[0] = p_xfr_begin;
+		xfr[1] = (u_char) cur->list->count;
+		xfr[2] = (u_char) (cur->list->count >> 8);
+		framed += framed_len(xfr, 3);
+		xfr[0] = p_xfr_end;
+		xfr[1] = (u_char) cur->list->type;
+		xfr[2] = 0;
+		framed += framed_len(xfr, 3);
+		frames = cur->list->count + 2;
+
+		printf("%-10s %8d %10ld %10ld %8ld %9.1f\n",
+		       section_name(cur->list->type), cur->list->count, bytes,
+		       framed, escapes,
+		       (framed + frames * ACK_FRAME) * 10.0 / baud);
+		if (cur->list->count > GPS_XFER_MAX)
+			warnx("%s: %d records, at most %d per section",
+			      section_name(cur->list->type), cur->list->count,
+			      GPS_XFER_MAX);
+		t_records += cur->list->count;
+		t_bytes += bytes;
+		t_framed += framed;
+		t_escapes += escapes;
+		t_frames += frames;
+	}
+	printf("%-10s %8ld %10ld %10ld %8ld %9.1f\n", "total", t_records,
+	       t_bytes, t_framed, t_escapes,
+	       (t_framed + t_frames * ACK_FRAME) * 10.0 / baud);
+	printf("%ld bytes to the unit, %ld from it at %ld baud; escapes add "
+	       "%.2f%%\n", t_framed, t_frames * ACK_FRAME, baud,
+	       t_bytes ? 100.0 * t_escapes / t_bytes : 0.0);
+	printf("convert %.3f s, %.1f MB/s; frame %.3f s, %.0f records/s\n",
+	       convert, convert > 0 ? input / convert / 1e6 : 0.0, frame,
+	       frame > 0 ? t_records / frame : 0.0);
+	gps_lists_free(lists);
+}
+
 int
 main(int argc, char * argv[])
 {
 	int debug = 0;
+	double limit = 0;
+	double trk_error = 0;
+	int trk_limit = 0;
+	int sync = 0;
+	int memory = 0;
+	int jobs = 1;
+	int retries = 2;
+	long baud = 9600;
+	const char* profile = NULL;
+	struct unit *units = NULL;
+	int nunits = 0;
+	struct gps_image img;
 	const char* port = DEFAULT_PORT;
+	const char* image_in = NULL;
+	const char* image_out = NULL;
 
 	int opt;
 	char* rem;
 	gps_handle gps;
 	struct gps_lists *lists;
+	FILE *fp;
+	FILE **files;
+	int nfiles;
+	int loaded;
+	int ix;
 
-	while ((opt = getopt(argc, argv, "d:vp:")) != -1) {
+	while ((opt = getopt(argc, argv, "b:d:e:i:j:l:Mn:o:r:svp:T:")) != -1) {
 		switch (opt) {
+		case 'b':
+			baud = strtol(optarg, &rem, 0);
+			if (*rem || baud <= 0)
+				usage(argv[0], "`%s' is a bad baud rate\n",
+				      optarg);
+			break;
 		case 'd':
 			debug = strtol(optarg, &rem, 0);
 			if (*rem)
@@ -47,8 +612,58 @@ main(int argc, char * argv[])
 				usage(argv[0], "`%s' is a bad debug value\n",
 				      optarg);
 			break;
+		case 'e':
+			trk_error = strtod(optarg, &rem);
+			if (*rem || trk_error < 0)
+				usage(argv[0], "`%s' is a bad track error\n",
+				      optarg);
+			break;
+		case 'i':
+			image_in = optarg;
+			break;
+		case 'j':
+			jobs = strtol(optarg, &rem, 0);
+			if (*rem || jobs < 1)
+				usage(argv[0], "`%s' is a bad job count\n",
+				      optarg);
+			break;
+		case 'l':
+			trk_limit = strtol(optarg, &rem, 0);
+			if (*rem || trk_limit < 0)
+				usage(argv[0], "`%s' is a bad track limit\n",
+				      optarg);
+			break;
+		case 'M':
+			memory = 1;
+			break;
+		case 'n':
+			profile = optarg;
+			break;
+		case 'o':
+			image_out = optarg;
+			break;
+		case 'r':
+			retries = strtol(optarg, &rem, 0);
+			if (*rem || retries < 0)
+				usage(argv[0], "`%s' is a bad retry count\n",
+				      optarg);
+			break;
+		case 's':
+			sync = 1;
+			break;
 		case 'p':
 			port = strdup(optarg);
+			units = realloc(units, (nunits + 1) * sizeof *units);
+			if (units == NULL)
+				err(1, "realloc");
+			memset(&units[nunits], 0, sizeof *units);
+			units[nunits++].port = port;
+			break;
+		case 'T':
+			limit = strtod(optarg, &rem);
+			if (*rem || limit <= 0)
+				usage(argv[0], "`%s' is a bad time limit\n",
+				      optarg);
 			break;
 		case 'v':
 			errx(1, "software version %s", VERSION);
@@ -60,19 +675,130 @@ main(int argc, char * argv[])
 		}
 	}
 
-	if (argc != optind)
-		errx(1, "unknown command line argument: %s ...", argv[optind]);
+	if (nunits > 1 && (sync || image_out))
+		usage(argv[0], "-s and -o can't be used with more than one "
+		      "port\n");
+	for (ix = 0; ix < nunits; ix++) {
+		units[ix].debug = debug;
+		units[ix].retries = retries;
+	}
+
+	if (profile && (nunits || sync || image_in))
+		usage(argv[0], "-n can't be used with -i, -p, or -s\n");
+
+	if (limit)
+		deadline = now() + limit;
+	catch_signals();
+	/* registered first so it runs after gps_close_all */
+	if (memory) {
+		gps_mem_account(1);
+		atexit(mem_report);
+	}
+	atexit(gps_close_all);
+
+	if (image_in && nunits > 1) {
+		if (argc != optind)
+			usage(argv[0], "-i can't be used with input files\n");
+		if ((fp = fopen(image_in, "r")) == NULL)
+			err(1, "%s", image_in);
+		if (gps_image_open(NULL, &img, fp) == -1)
+			errx(1, "%s: not a valid upload image", image_in);
+		fclose(fp);
+		ix = fleet(units, nunits, NULL, 0, 1, 0, 0, &img);
+		gps_image_close(&img);
+		return ix ? 1 : 0;
+	}
+	if (image_in) {
+		if (argc != optind || sync || image_out || trk_error != 0 ||
+		    trk_limit != 0 || jobs != 1)
+			usage(argv[0], "-i can't be used with input files or "
+			      "other load options\n");
+		load_image(port, debug, image_in);
+		return 0;
+	}
+	if (image_out && sync)
+		usage(argv[0], "-s can't be used with -o\n");
+
+	/* files are opened up front so a bad name fails before the upload */
+	nfiles = argc - optind;
+	if (nfiles == 0) {
+		files = &stdin;
+		nfiles = 1;
+	} else {
+		files = calloc(nfiles, sizeof *files);
+		if (files == NULL)
+			err(1, "calloc");
+		for (ix = 0; ix < nfiles; ix++)
+			if ((files[ix] = fopen(argv[optind + ix], "r")) == NULL)
+				err(1, "%s", argv[optind + ix]);
+	}
+
+	if (profile) {
+		if ((gps = gps_open_profile(profile, debug)) == NULL)
+			usage(argv[0], "`%s' is a bad profile\n", profile);
+		gps_set_trk_error(gps, trk_error);
+		gps_set_trk_limit(gps, trk_limit);
+		if (image_out) {
+			/* an image for the profile, made without a unit */
+			lists = gps_format_files(gps, files, nfiles, jobs);
+			if (!lists)
+				errx(1, "no valid GPS data found");
+			write_image(gps, lists, image_out);
+			gps_lists_free(lists);
+		} else
+			dry_run(gps, files, nfiles, jobs, baud);
+		gps_close(gps);
+		return 0;
+	}
+	if (nunits > 1)
+		return fleet(units, nunits, files, nfiles, jobs, trk_error,
+			     trk_limit, NULL) ? 1 : 0;
 
 	gps = gps_open(port, debug);
+	gps_set_deadline(gps, deadline);
 	if (gps_version(gps, 1) != 1)
 		errx(1, "can't communicate with GPS unit");
 
-	lists = gps_format(gps, stdin);
+	/* simplification, sync, and parallel conversion need whole lists,
+	   otherwise stream */
+	if (! sync && trk_error == 0 && trk_limit == 0 && jobs == 1 &&
+	    ! image_out) {
+		loaded = 0;
+		for (ix = 0; ix < nfiles; ix++) {
+			switch (gps_load_stream(gps, files[ix])) {
+			case 0:
+				break;
+			case -1:
+				errx(1, "failure uploading GPS unit");
+			default:
+				loaded = 1;
+			}
+		}
+		if (! loaded)
+			errx(1, "no valid GPS data found");
+		gps_close(gps);
+		return 0;
+	}
+
+	gps_set_trk_error(gps, trk_error);
+	gps_set_trk_limit(gps, trk_limit);
+	lists = gps_format_files(gps, files, nfiles, jobs);
 	if (!lists)
 		errx(1, "no valid GPS data found");
 
+	if (image_out) {
+		write_image(gps, lists, image_out);
+		gps_lists_free(lists);
+		gps_close(gps);
+		return 0;
+	}
+
+	if (sync && gps_sync(gps, lists) < 0)
+		warnx("can't read GPS unit contents, loading all records");
+
 	if (gps_load(gps, lists) < 0)
 		errx(1, "failure uploading GPS unit");
+	gps_lists_free(lists);
 
 	gps_close(gps);
 
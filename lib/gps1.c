@@ -10,6 +10,8 @@
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -26,13 +28,15 @@
 
 
 /*
- * This program is designed to talk to a single gps unit.  Thus,
- * all state for a connection to the unit is kept in a single
- * static structure.  The address of this structure is the "handle".
+ * All state for a connection to a unit is kept in a static structure,
+ * one per open port.  The address of the structure is the "handle".
+ * Different handles may be used by different threads at once.
  */
 struct gps_state {
+	int		in_use;		/* state belongs to an open port */
 	int		debug;		/* debugging level (set at open) */
 	int		fd;		/* fd of the open file */
+	int		tty;		/* fd is a terminal, termios saved */
 	char*		name;		/* name of the device */
 #if SIO_TYPE == BSD
 	struct termios	termios;	/* initial term settings */
@@ -50,23 +54,77 @@ struct gps_state {
 	int		rte_lnk_type;	/* route link type */
 	int		trk_hdr_type;	/* track header type */
 	int		trk_type;	/* track entry type */
+	/* codecs for the above types, resolved when the type is set */
+	const struct gps_wpt_codec *wpt_codec;
+	const struct gps_rte_codec *rte_hdr_codec;
+	const struct gps_wpt_codec *rte_wpt_codec;
+	const struct gps_rte_codec *rte_lnk_codec;
+	const struct gps_trk_codec *trk_hdr_codec;
+	const struct gps_trk_codec *trk_codec;
+	double		trk_error;	/* max track simplify error (m) */
+	int		trk_limit;	/* track point budget, 0 == none */
+	struct gps_screen *screen;	/* screenshot decoder */
+	int		screen_format;	/* GPS_SCREEN_PPM or _PNG */
+	struct gps_protocols protocols;	/* capability table */
+	struct gps_queue *queue;	/* frames held for their consumer */
+	volatile sig_atomic_t cancel;	/* gps_cancel was called */
+	double		deadline;	/* give up after, 0 if none */
+	int		xfer;		/* GPS_XFER_ in progress */
 };
 
-static struct gps_state	gps_state = { 0, -1 };
+#define GPS_UNITS	64		/* ports that can be open at once */
 
+static struct gps_state	gps_states[GPS_UNITS];
+static pthread_mutex_t	gps_states_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /*
- * Open the named port and return a handle used for subsequent I/O calls
- * on this port.  If the open fails the program is aborted with an
- * error message and the function does not return.  debug is the debug
- * level from the -d command line option. 
+ * Return the state of an open handle or NULL if the handle is not open
+ */
+static struct gps_state *
+handle_state(gps_handle gps)
+{
+	struct gps_state *s = gps;
+
+	if (s >= gps_states && s < gps_states + GPS_UNITS &&
+	    s == &gps_states[s - gps_states] && s->in_use)
+		return s;
+	return NULL;
+}
+
 
- * If we can open the requested port set params for communications
- * and return our `handle'.  The port is opened using O_NONBLOCK
- * as the garmin cable doesn't seem to supply modem control signals.
+/*
+ * Current time in seconds
  */
-gps_handle
-gps_open(const char * port, int debug)
+static double
+wall(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*
+ * Returns 1 if the handle was cancelled or is past its deadline.  I/O
+ * on such a handle fails except while gps_abort ends the transfer.
+ */
+static int
+stopped(const struct gps_state *s)
+{
+	if (s->xfer == GPS_XFER_ABORT)
+		return 0;
+	return s->cancel || (s->deadline != 0 && wall() >= s->deadline);
+}
+
+/*
+ * Open the named port and set params for communications.  The port is
+ * opened using O_NONBLOCK as the garmin cable doesn't seem to supply
+ * modem control signals.  A port that is not a terminal, e.g. a file
+ * of recorded frames, is used as is.  Returns 0 or -1 with errno set
+ * and *what naming the step that failed.
+ */
+static int
+port_setup(struct gps_state *s, const char *port, const char **what)
 {
 #if SIO_TYPE == BSD
 	struct termios  termios;
@@ -75,20 +133,23 @@ gps_open(const char * port, int debug)
 #else
 #error Unknown SIO_TYPE value
 #endif
-	gps_state.debug = debug;
-	gps_state.name = strdup(port);
-	if (!gps_state.name)
-		err(1, "serial port name too large");
-	gps_state.fd = open(gps_state.name, O_RDWR | O_NONBLOCK);
-	if (gps_state.fd == -1)
-		errx(1, "can't open gps device `%s': %s", gps_state.name,
-		      strerror(errno));
+	*what = "open";
+	s->name = gps_strdup(port);
+	if (!s->name)
+		return -1;
+	s->fd = open(s->name, O_RDWR | O_NONBLOCK);
+	if (s->fd == -1)
+		return -1;
+	if (! isatty(s->fd))
+		return 0;
+	s->tty = 1;
 
 #if SIO_TYPE == BSD
-	if (ioctl(gps_state.fd, TIOCGETA, &termios) < 0)
-		err(1, "TIOCGETA");
+	*what = "TIOCGETA";
+	if (ioctl(s->fd, TIOCGETA, &termios) < 0)
+		return -1;
 	/* save current terminal settings */
-	memcpy(&gps_state.termios, &termios, sizeof gps_state.termios);
+	memcpy(&s->termios, &termios, sizeof s->termios);
 	termios.c_ispeed = termios.c_ospeed = 9600;
 	termios.c_iflag = 0;
 	termios.c_oflag = 0;	/* (ONLRET) */
@@ -97,61 +158,286 @@ gps_open(const char * port, int debug)
 	memset(termios.c_cc, -1, NCCS);
 	termios.c_cc[VMIN] = 1;
 	termios.c_cc[VTIME] = 0;
-	if (ioctl(gps_state.fd, TIOCSETAF, &termios) < 0)
-		err(1, "TIOCSETAF");
+	*what = "TIOCSETAF";
+	if (ioctl(s->fd, TIOCSETAF, &termios) < 0)
+		return -1;
 
 #elif SIO_TYPE == Linux
-	if (ioctl(gps_state.fd, TCGETA, &termios) < 0)
-		err(1, "TCGETA");
+	*what = "TCGETA";
+	if (ioctl(s->fd, TCGETA, &termios) < 0)
+		return -1;
 	/* save current terminal settings */
-	memcpy(&gps_state.termios, &termios, sizeof gps_state.termios);
+	memcpy(&s->termios, &termios, sizeof s->termios);
 	termios.c_cflag  = (CSIZE & CS8) | CREAD | (CBAUD & B9600) | CLOCAL;
 	termios.c_iflag  = termios.c_oflag = termios.c_lflag = (ushort)0;
 	termios.c_oflag  = (ONLRET);
-	if (ioctl(gps_state.fd, TCSETAF, &termios) < 0)
-		err(1, "TCSETAF");
+	*what = "TCSETAF";
+	if (ioctl(s->fd, TCSETAF, &termios) < 0)
+		return -1;
 
 #else
 #error Unknown SIO_TYPE value
 #endif
-	return &gps_state;
+	return 0;
 }
 
 /*
- * Close the port indicated by the given handle.
+ * port_setup, timed as the open phase
+ */
+static int
+port_open(struct gps_state *s, const char *port, const char **what)
+{
+	int stat;
+	GPS_PROF_BEGIN(prof, GPS_PROF_OPEN);
+
+	stat = port_setup(s, port, what);
+	GPS_PROF_END(prof);
+	return stat;
+}
+
+/*
+ * Take a free state for a port, NULL if all are in use
+ */
+static struct gps_state *
+state_alloc(int debug)
+{
+	struct gps_state *s = NULL;
+	int ix;
+
+	pthread_mutex_lock(&gps_states_lock);
+	for (ix = 0; ix < GPS_UNITS; ix++)
+		if (! gps_states[ix].in_use) {
+			s = &gps_states[ix];
+			memset(s, 0, sizeof *s);
+			s->in_use = 1;
+			s->debug = debug;
+			s->fd = -1;
+			break;
+		}
+	pthread_mutex_unlock(&gps_states_lock);
+	return s;
+}
+
+/*
+ * Give back the state of a closed port
+ */
+static void
+state_free(struct gps_state *s)
+{
+	gps_free(s->name);
+	gps_screen_free(s->screen);
+	gps_queue_free(s->queue);
+	pthread_mutex_lock(&gps_states_lock);
+	memset(s, 0, sizeof *s);
+	s->fd = -1;
+	pthread_mutex_unlock(&gps_states_lock);
+}
+
+/*
+ * Open the named port and return a handle used for subsequent I/O calls
+ * on this port.  If the open fails the program is aborted with an
+ * error message and the function does not return.  debug is the debug
+ * level from the -d command line option. 
+ */
+gps_handle
+gps_open(const char * port, int debug)
+{
+	struct gps_state *s;
+	const char *what;
+
+	if ((s = state_alloc(debug)) == NULL)
+		errx(1, "can't open gps device `%s': too many open ports",
+		     port);
+	if (port_open(s, port, &what) == -1) {
+		if (strcmp(what, "open") == 0)
+			errx(1, "can't open gps device `%s': %s", port,
+			     strerror(errno));
+		err(1, "%s", what);
+	}
+	return s;
+}
+
+/*
+ * As gps_open but return NULL with errno set if the port can't be
+ * opened.  Used to open many ports where one bad port should not end
+ * the program.
+ */
+gps_handle
+gps_try_open(const char * port, int debug)
+{
+	struct gps_state *s;
+	const char *what;
+	int save;
+
+	if ((s = state_alloc(debug)) == NULL) {
+		errno = EMFILE;
+		return NULL;
+	}
+	if (port_open(s, port, &what) == -1) {
+		save = errno;
+		if (debug)
+			warn("%s: %s", port, what);
+		if (s->fd != -1)
+			close(s->fd);
+		state_free(s);
+		errno = save;
+		return NULL;
+	}
+	return s;
+}
+
+/*
+ * Return a handle that is not connected to a port, for converting data
+ * without a unit.  The packet types are set from profile, a protocol
+ * capability array as described at gps_cap_profile.  NULL is returned
+ * if the profile can't be parsed.  Reads and writes on the handle fail.
+ */
+gps_handle
+gps_open_profile(const char *profile, int debug)
+{
+	struct gps_state *s;
+
+	if ((s = state_alloc(debug)) == NULL)
+		return NULL;
+	if (gps_cap_profile(s, profile) == -1) {
+		state_free(s);
+		return NULL;
+	}
+	return s;
+}
+
+/*
+ * Close the port indicated by the given handle.  The handle may not be
+ * used after it is closed.
  */
 void
 gps_close(gps_handle gps)
 {
-	if (gps == &gps_state) {
-		if (gps_state.fd != -1) {
+	struct gps_state *s = handle_state(gps);
+
+	if (s) {
+		if (s->fd != -1) {
+			/* leave the unit idle for the next session.  This
+			   may run inside exit so a port that can't be
+			   restored is only warned about. */
+			gps_abort(gps);
 #if SIO_TYPE == BSD
-			if (ioctl(gps_state.fd, TIOCSETAF,
-				  &gps_state.termios) < 0)
-				err(1, "TIOCSETAF");
+			if (s->tty && ioctl(s->fd, TIOCSETAF, &s->termios) < 0)
+				warn("TIOCSETAF");
 
 #elif SIO_TYPE == Linux
-			if (ioctl(gps_state.fd, TCSETAF,
-				  &gps_state.termios) < 0)
-				err(1, "TCSETAF");
+			if (s->tty && ioctl(s->fd, TCSETAF, &s->termios) < 0)
+				warn("TCSETAF");
 
 #else
 #error Unknown SIO_TYPE value
 #endif
-			close(gps_state.fd);
-			gps_state.fd = -1;
-			gps_state.debug = 0;
-			gps_state.bufix = 0;
-			gps_state.bufcnt = 0;
-			free(gps_state.name);
-			return;
+			close(s->fd);
 		}
-		if (gps_state.debug)
-			warnx("gps_close called when no file opened");
+		state_free(s);
+		return;
+	}
+	warnx("gps_close called with invalid handle");
+}
+
+/*
+ * Close every open handle.  Meant for atexit so that a program leaving
+ * through err or errx still ends any transfer and restores the port.
+ */
+void
+gps_close_all(void)
+{
+	int ix;
+
+	for (ix = 0; ix < GPS_UNITS; ix++)
+		if (gps_states[ix].in_use)
+			gps_close(&gps_states[ix]);
+}
+
+/*
+ * Cancel the handle, or every open handle if gps is NULL.  A wait on
+ * the port returns at once and further I/O fails until the handle is
+ * closed; gps_close then ends the transfer that was cut off.  Only a
+ * flag is set so this may be called from a signal handler.
+ */
+void
+gps_cancel(gps_handle gps)
+{
+	struct gps_state *s = gps;
+	int ix;
+
+	if (gps == NULL) {
+		for (ix = 0; ix < GPS_UNITS; ix++)
+			if (gps_states[ix].in_use)
+				gps_states[ix].cancel = 1;
+	} else if (s >= gps_states && s < gps_states + GPS_UNITS)
+		s->cancel = 1;
+}
+
+/*
+ * Returns 1 if the handle was cancelled or its deadline has passed
+ */
+int
+gps_cancelled(gps_handle gps)
+{
+	struct gps_state *s = handle_state(gps);
+
+	if (s)
+		return s->cancel ||
+			(s->deadline != 0 && wall() >= s->deadline);
+	return 0;
+}
+
+/*
+ * Set the time, in UNIX seconds, after which the handle acts as if
+ * cancelled.  0 for none.
+ */
+void
+gps_set_deadline(gps_handle gps, double when)
+{
+	struct gps_state *s = handle_state(gps);
+
+	if (s)
+		s->deadline = when;
+}
+
+/*
+ * Read and drop whatever the unit sends until the line has been quiet
+ * for DRAIN_QUIET seconds, but no longer than DRAIN_MAX seconds.
+ */
+#define DRAIN_QUIET	0.25
+#define DRAIN_MAX	2.0
+
+void
+gps_drain(gps_handle gps)
+{
+	struct gps_state *s = handle_state(gps);
+	u_char buf[GPS_BUF_LEN];
+	struct timeval tv;
+	fd_set readfds;
+	double end;
+	double left;
+	ssize_t cnt;
+	long drained = 0;
+
+	if (s == NULL || s->fd == -1)
 		return;
+	s->bufix = s->bufcnt = 0;
+	end = wall() + DRAIN_MAX;
+	while ((left = end - wall()) > 0) {
+		if (left > DRAIN_QUIET)
+			left = DRAIN_QUIET;
+		tv.tv_sec = 0;
+		tv.tv_usec = (long) (left * 1e6);
+		FD_ZERO(&readfds);
+		FD_SET(s->fd, &readfds);
+		if (select(s->fd + 1, &readfds, 0, 0, &tv) != 1)
+			break;
+		if ((cnt = read(s->fd, buf, sizeof buf)) <= 0)
+			break;
+		drained += cnt;
 	}
-	if (gps_state.debug)
-		warnx("gps_close called with invalid handle");
+	gps_printf(gps, 2, "%s: %ld bytes dropped\n", __func__, drained);
 }
 
 /*
@@ -160,8 +446,10 @@ gps_close(gps_handle gps)
 int
 gps_debug(gps_handle gps)
 {
-	if (gps == &gps_state)
-		return gps_state.debug;
+	struct gps_state *s = handle_state(gps);
+
+	if (s)
+		return s->debug;
 	return 0;
 }
 
@@ -183,9 +471,14 @@ gps_debug(gps_handle gps)
 int
 gps_read(gps_handle gps, u_char * val, int timeout)
 {
-	if (gps == &gps_state) {
-		if (gps_state.bufix >= gps_state.bufcnt) {
+	struct gps_state *s = handle_state(gps);
+
+	if (s && s->fd != -1) {
+		if (s->bufix >= s->bufcnt) {
 			int stat;
+			int block = timeout == -1;
+			double left = timeout;
+			double rest;
 			struct timeval  tv;
 #if SIO_TYPE == BSD
 			struct fd_set   readfds;
@@ -194,39 +487,55 @@ gps_read(gps_handle gps, u_char * val, int timeout)
 #else
 #error Unknown SIO_TYPE value
 #endif
-			memset(&tv, 0, sizeof tv);
-			tv.tv_sec = timeout;
-			FD_ZERO(&readfds);
-			FD_SET(gps_state.fd, &readfds);
+			if (stopped(s))
+				return -1;
+			/* wait no longer than the deadline */
+			rest = s->deadline - wall();
+			if (s->deadline != 0 && (block || rest < left)) {
+				left = rest > 0 ? rest : 0;
+				block = 0;
+			}
+			GPS_PROF_BEGIN(select_prof, GPS_PROF_SELECT);
 			do {
-				stat = select(gps_state.fd + 1, &readfds, 0, 0,
-					      timeout == -1 ? 0 : &tv);
-			} while ((stat < 0) && (errno == EINTR));
+				memset(&tv, 0, sizeof tv);
+				tv.tv_sec = (long) left;
+				tv.tv_usec = (long) ((left - tv.tv_sec) * 1e6);
+				FD_ZERO(&readfds);
+				FD_SET(s->fd, &readfds);
+				stat = select(s->fd + 1, &readfds, 0, 0,
+					      block ? 0 : &tv);
+			} while ((stat < 0) && (errno == EINTR) &&
+				 ! stopped(s));
+			GPS_PROF_END(select_prof);
+			if (stopped(s))
+				return -1;
 			switch (stat) {
 			case -1:
-				if (gps_state.debug)
-					warn("%s", gps_state.name);
+				if (s->debug)
+					warn("%s", s->name);
 				return -1;
 			case 0:
 				return 0;
 			case 1:
-				gps_state.bufix = 0;
-				gps_state.bufcnt =
-					(int) read(gps_state.fd, gps_state.buf,
+				s->bufix = 0;
+				GPS_PROF_BEGIN(read_prof, GPS_PROF_READ);
+				s->bufcnt =
+					(int) read(s->fd, s->buf,
 						   GPS_BUF_LEN); 
-				if (gps_state.bufcnt <= 0) {
-					if (gps_state.debug)
-						warn("%s", gps_state.name);
+				GPS_PROF_END(read_prof);
+				if (s->bufcnt <= 0) {
+					if (s->debug)
+						warn("%s", s->name);
 					return -1;
 				}
-				if (gps_state.debug > 4) {
-					gps_display('<', gps_state.buf,
-						    gps_state.bufcnt);
+				if (s->debug > 4) {
+					gps_display('<', s->buf,
+						    s->bufcnt);
 				}
 			}
 		}
-		if (gps_state.bufix < gps_state.bufcnt) {
-			*val = gps_state.buf[gps_state.bufix++];
+		if (s->bufix < s->bufcnt) {
+			*val = s->buf[s->bufix++];
 			return 1;
 		}
 	}
@@ -240,19 +549,22 @@ gps_read(gps_handle gps, u_char * val, int timeout)
 int
 gps_write(gps_handle gps, const u_char * buf, size_t cnt)
 {
+	struct gps_state *s = handle_state(gps);
 	ssize_t written;
 
-	if (gps == &gps_state) {
+	if (s && s->fd != -1 && ! stopped(s)) {
 		while (cnt > 0) {
-			written = write(gps_state.fd, buf, cnt);
+			GPS_PROF_BEGIN(prof, GPS_PROF_WRITE);
+			written = write(s->fd, buf, cnt);
+			GPS_PROF_END(prof);
 			if (written > 0) {
-				if (gps_state.debug > 4)
+				if (s->debug > 4)
 					gps_display('>', buf, (int) written);
 				cnt -= (size_t) written;
 				buf += written;
 			} else {
-				if (gps_state.debug)
-					warn("%s", gps_state.name);
+				if (s->debug)
+					warn("%s", s->name);
 				return -1;
 			}
 		}
@@ -261,94 +573,319 @@ gps_write(gps_handle gps, const u_char * buf, size_t cnt)
 	return -1;
 }
 
+/*
+ * Packet type accessors.  Setting a type also looks up the codec used
+ * to encode and decode packets of that type so that the per packet code
+ * need not search for it.  The codec is NULL for unknown types.
+ */
 void
 gps_set_wpt_type(gps_handle gps, int wpt_type)
 {
-	if (gps == &gps_state)
-		gps_state.wpt_type = wpt_type;
+	struct gps_state *s = handle_state(gps);
+
+	if (s) {
+		s->wpt_type = wpt_type;
+		s->wpt_codec = gps_wpt_codec(wpt_type);
+	}
 }
 
 int
 gps_get_wpt_type(gps_handle gps)
 {
-	if (gps == &gps_state)
-		return gps_state.wpt_type;
+	struct gps_state *s = handle_state(gps);
+
+	if (s)
+		return s->wpt_type;
 	return -1;
 }
 
+const struct gps_wpt_codec *
+gps_get_wpt_codec(gps_handle gps)
+{
+	struct gps_state *s = handle_state(gps);
+
+	if (s)
+		return s->wpt_codec;
+	return NULL;
+}
+
 void
 gps_set_rte_hdr_type(gps_handle gps, int type)
 {
-	if (gps == &gps_state)
-		gps_state.rte_hdr_type = type;
+	struct gps_state *s = handle_state(gps);
+
+	if (s) {
+		s->rte_hdr_type = type;
+		s->rte_hdr_codec = gps_rte_codec(type);
+	}
 }
 
 int
 gps_get_rte_hdr_type(gps_handle gps)
 {
-	if (gps == &gps_state)
-		return gps_state.rte_hdr_type;
+	struct gps_state *s = handle_state(gps);
+
+	if (s)
+		return s->rte_hdr_type;
 	return -1;
 }
 
+const struct gps_rte_codec *
+gps_get_rte_hdr_codec(gps_handle gps)
+{
+	struct gps_state *s = handle_state(gps);
+
+	if (s)
+		return s->rte_hdr_codec;
+	return NULL;
+}
+
 void
 gps_set_rte_wpt_type(gps_handle gps, int type)
 {
-	if (gps == &gps_state)
-		gps_state.rte_wpt_type = type;
+	struct gps_state *s = handle_state(gps);
+
+	if (s) {
+		s->rte_wpt_type = type;
+		s->rte_wpt_codec = gps_wpt_codec(type);
+	}
 }
 
 int
 gps_get_rte_wpt_type(gps_handle gps)
 {
-	if (gps == &gps_state)
-		return gps_state.rte_wpt_type;
+	struct gps_state *s = handle_state(gps);
+
+	if (s)
+		return s->rte_wpt_type;
 	return -1;
 }
 
+const struct gps_wpt_codec *
+gps_get_rte_wpt_codec(gps_handle gps)
+{
+	struct gps_state *s = handle_state(gps);
+
+	if (s)
+		return s->rte_wpt_codec;
+	return NULL;
+}
+
 void
 gps_set_rte_lnk_type(gps_handle gps, int type)
 {
-	if (gps == &gps_state)
-		gps_state.rte_lnk_type = type;
+	struct gps_state *s = handle_state(gps);
+
+	if (s) {
+		s->rte_lnk_type = type;
+		s->rte_lnk_codec = gps_rte_codec(type);
+	}
 }
 
 int
 gps_get_rte_lnk_type(gps_handle gps)
 {
-	if (gps == &gps_state)
-		return gps_state.rte_lnk_type;
+	struct gps_state *s = handle_state(gps);
+
+	if (s)
+		return s->rte_lnk_type;
 	return -1;
 }
 
+const struct gps_rte_codec *
+gps_get_rte_lnk_codec(gps_handle gps)
+{
+	struct gps_state *s = handle_state(gps);
+
+	if (s)
+		return s->rte_lnk_codec;
+	return NULL;
+}
+
 void
 gps_set_trk_hdr_type(gps_handle gps, int type)
 {
-	if (gps == &gps_state)
-		gps_state.trk_hdr_type = type;
+	struct gps_state *s = handle_state(gps);
+
+	if (s) {
+		s->trk_hdr_type = type;
+		s->trk_hdr_codec = gps_trk_codec(type);
+	}
 }
 
 int
 gps_get_trk_hdr_type(gps_handle gps)
 {
-	if (gps == &gps_state)
-		return gps_state.trk_hdr_type;
+	struct gps_state *s = handle_state(gps);
+
+	if (s)
+		return s->trk_hdr_type;
 	return -1;
 }
 
+const struct gps_trk_codec *
+gps_get_trk_hdr_codec(gps_handle gps)
+{
+	struct gps_state *s = handle_state(gps);
+
+	if (s)
+		return s->trk_hdr_codec;
+	return NULL;
+}
+
 void
 gps_set_trk_type(gps_handle gps, int type)
 {
-	if (gps == &gps_state)
-		gps_state.trk_type = type;
+	struct gps_state *s = handle_state(gps);
+
+	if (s) {
+		s->trk_type = type;
+		s->trk_codec = gps_trk_codec(type);
+	}
 }
 
 int
 gps_get_trk_type(gps_handle gps)
 {
-	if (gps == &gps_state)
-		return gps_state.trk_type;
+	struct gps_state *s = handle_state(gps);
+
+	if (s)
+		return s->trk_type;
 	return -1;
 }
 
+const struct gps_trk_codec *
+gps_get_trk_codec(gps_handle gps)
+{
+	struct gps_state *s = handle_state(gps);
+
+	if (s)
+		return s->trk_codec;
+	return NULL;
+}
+
+void
+gps_set_trk_error(gps_handle gps, double meters)
+{
+	struct gps_state *s = handle_state(gps);
+
+	if (s)
+		s->trk_error = meters;
+}
+
+double
+gps_get_trk_error(gps_handle gps)
+{
+	struct gps_state *s = handle_state(gps);
+
+	if (s)
+		return s->trk_error;
+	return 0;
+}
+
+void
+gps_set_trk_limit(gps_handle gps, int points)
+{
+	struct gps_state *s = handle_state(gps);
+
+	if (s)
+		s->trk_limit = points;
+}
+
+int
+gps_get_trk_limit(gps_handle gps)
+{
+	struct gps_state *s = handle_state(gps);
+
+	if (s)
+		return s->trk_limit;
+	return 0;
+}
+
+/*
+ * Return the screenshot decoder of the handle, allocating it on first
+ * use.  NULL if out of memory.
+ */
+struct gps_screen *
+gps_get_screen(gps_handle gps)
+{
+	struct gps_state *s = handle_state(gps);
+
+	if (s) {
+		if (s->screen == NULL)
+			s->screen = gps_screen_new();
+		return s->screen;
+	}
+	return NULL;
+}
+
+/*
+ * Return the receive queue of the handle, allocating it on first use.
+ * NULL if out of memory.
+ */
+struct gps_queue *
+gps_get_queue(gps_handle gps)
+{
+	struct gps_state *s = handle_state(gps);
+
+	if (s) {
+		if (s->queue == NULL)
+			s->queue = gps_queue_new();
+		return s->queue;
+	}
+	return NULL;
+}
+
+void
+gps_set_screen_format(gps_handle gps, int format)
+{
+	struct gps_state *s = handle_state(gps);
+
+	if (s)
+		s->screen_format = format;
+}
+
+int
+gps_get_screen_format(gps_handle gps)
+{
+	struct gps_state *s = handle_state(gps);
+
+	if (s)
+		return s->screen_format;
+	return GPS_SCREEN_PPM;
+}
+
+/*
+ * Return the protocol capability table of the handle
+ */
+struct gps_protocols *
+gps_get_protocols(gps_handle gps)
+{
+	struct gps_state *s = handle_state(gps);
 
+	if (s)
+		return &s->protocols;
+	return NULL;
+}
+
+/*
+ * The transfer in progress on the handle, one of GPS_XFER_
+ */
+void
+gps_set_xfer(gps_handle gps, int xfer)
+{
+	struct gps_state *s = handle_state(gps);
+
+	if (s)
+		s->xfer = xfer;
+}
+
+int
+gps_get_xfer(gps_handle gps)
+{
+	struct gps_state *s = handle_state(gps);
+
+	if (s)
+		return s->xfer;
+	return GPS_XFER_NONE;
+}
@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <err.h>
+#include <time.h>
 
 #include "gpslib.h"
 
@@ -14,7 +15,7 @@
  * Put application data into layer two frame format and return
  * a buffer with the formatted frame.  The size of the formated
  * frame is returned in the cnt parameter. Note: the buffer must be
- * freed.  Frame format is:
+ * freed with gps_free.  Frame format is:
  *
  *	DLE
  *	record type, add to checksum
@@ -24,12 +25,12 @@
  *	DLE
  *	ETX
  */
-static u_char *
+u_char *
 gps_frame(const u_char * buf, size_t *cnt)
 {
 	int sum = 0;
 	int ix = 0;
-	u_char *work = malloc(2 * *cnt + 10);
+	u_char *work = gps_malloc(2 * *cnt + 10);
 
 	if (! work) {
 		warn( "%s: no memory", __func__);
@@ -89,24 +90,37 @@ gps_send(gps_handle gps, const u_char *buf, int cnt)
 		if (gps_debug(gps) >= 4)
 			gps_display('}', buf, cnt);
 		ok = gps_write(gps, data, len);
-		free(data);
+		gps_free(data);
 	}
 	return ok;
 }
 
-/*
- * Send an ack for the given packet type.  Return 1 if the packet
- * sent OK, othewise -1.
- */
-int
-gps_send_ack(gps_handle gps, u_char type)
+static int
+send_ack(gps_handle gps, u_char type)
 {
 	u_char buf[4];
+	int stat;
+	GPS_PROF_BEGIN(prof, GPS_PROF_ACK);
 
 	buf[0] = ack;
 	buf[1] = type;
 	buf[2] = 0;
-	return gps_send(gps, buf, 3);
+	stat = gps_send(gps, buf, 3);
+	GPS_PROF_END(prof);
+	return stat;
+}
+
+/*
+ * Send an ack for the given packet type.  Return 1 if the packet
+ * sent OK, othewise -1.  A frame taken from the receive queue was
+ * acked when it was queued and is not acked again.
+ */
+int
+gps_send_ack(gps_handle gps, u_char type)
+{
+	if (gps_queue_acked(gps_get_queue(gps), type))
+		return 1;
+	return send_ack(gps, type);
 }
 
 /*
@@ -118,6 +132,7 @@ gps_send_nak(gps_handle gps, u_char type)
 {
 	u_char buf[4];
 
+	gps_queue_acked(gps_get_queue(gps), type);
 	buf[0] = nak;
 	buf[1] = type;
 	buf[2] = 0;
@@ -138,8 +153,8 @@ gps_send_nak(gps_handle gps, u_char type)
  */
 #define READ_TO	10
 
-int
-gps_recv(gps_handle gps, int to, u_char *buf, int * cnt)
+static int
+frame_recv(gps_handle gps, int to, u_char *buf, int * cnt)
 {
 	int dle_seen;
 	int etx_seen;
@@ -245,44 +260,170 @@ gps_recv(gps_handle gps, int to, u_char *buf, int * cnt)
 	}
 }
 
+/*
+ * frame_recv, timed as the frame phase
+ */
+static int
+link_recv(gps_handle gps, int to, u_char *buf, int * cnt)
+{
+	int stat;
+	GPS_PROF_BEGIN(prof, GPS_PROF_FRAME);
+
+	stat = frame_recv(gps, to, buf, cnt);
+	GPS_PROF_END(prof);
+	return stat;
+}
+
+/*
+ * Route a frame read while waiting for something else.  Acks and naks
+ * are dropped, their sender has given up.  A late capability array
+ * updates the handle.  Other frames are queued for their consumer.
+ * All but acks and naks are acked.
+ */
+static void
+dispatch(gps_handle gps, const u_char *buf, int len)
+{
+	struct gps_queue *q;
+
+	switch (*buf) {
+	case ack:
+	case nak:
+		gps_printf(gps, 2, "%s: stray %s\n", __func__,
+			   *buf == ack ? "ack" : "nak");
+		return;
+	case p_cap:
+		gps_printf(gps, 2, "%s: late capability array\n", __func__);
+		gps_cap_parse(gps, buf, len);
+		break;
+	default:
+		if ((q = gps_get_queue(gps)) == NULL) {
+			gps_printf(gps, 0, "%s: no memory\n", __func__);
+			return;
+		}
+		if (gps_queue_put(q, buf, len))
+			gps_printf(gps, 1, "%s: queue full, packet %d "
+				   "dropped\n", __func__, *buf);
+		gps_printf(gps, 3, "%s: queued packet %d\n", __func__, *buf);
+		break;
+	}
+	send_ack(gps, *buf);
+}
+
+/*
+ * The work of gps_recv_type
+ */
+static int
+recv_type(gps_handle gps, int type, int to, u_char *buf, int *cnt)
+{
+	struct gps_queue *q = gps_get_queue(gps);
+	time_t end = time(NULL) + to;
+	int size = *cnt;
+	int left = to;
+	int stat;
+
+	if (gps_queue_get(q, type, buf, cnt))
+		return 1;
+	for (;;) {
+		*cnt = size;
+		stat = link_recv(gps, left, buf, cnt);
+		if (stat != 1)
+			return stat;
+		if (*buf == type ||
+		    (type == -1 && ! gps_queue_streamed(*buf))) {
+			/* a fresh frame, its ack must be sent */
+			gps_queue_acked(q, *buf);
+			return 1;
+		}
+		dispatch(gps, buf, *cnt);
+		if (to != -1 && (left = (int) (end - time(NULL))) <= 0)
+			return 0;
+	}
+}
+
+/*
+ * Receive a frame of the given packet type, -1 for any type but
+ * those a unit streams on its own.  A frame of the type held in the
+ * receive queue is returned first.  Other frames read while waiting
+ * are dispatched.  to is the time to wait in seconds, -1 to block.
+ * Return values are those of link_recv.
+ */
+int
+gps_recv_type(gps_handle gps, int type, int to, u_char *buf, int *cnt)
+{
+	int stat;
+	GPS_PROF_BEGIN(prof, GPS_PROF_RECV);
+
+	stat = recv_type(gps, type, to, buf, cnt);
+	GPS_PROF_END(prof);
+	return stat;
+}
+
+/*
+ * Receive the next frame of a transfer.  See link_recv for the
+ * arguments and return values.
+ */
+int
+gps_recv(gps_handle gps, int to, u_char *buf, int * cnt)
+{
+	return gps_recv_type(gps, -1, to, buf, cnt);
+}
+
 /*
  * Wait for a response for a particular packet type, return
  *	1 = ack
  *	0 = nak
  *	-1 = other
+ * Other frames that arrive first are dispatched, not lost.
  */
 int
 gps_wait(gps_handle gps, u_char typ, int timeout)
 {
-	u_char *response = malloc(GPS_FRAME_MAX);
+	u_char *response = gps_malloc(GPS_FRAME_MAX);
+	time_t end = time(NULL) + timeout;
+	int left = timeout;
 	int result = -1;
-	int retries = 3;
 	int resplen;
 
 	if (response)
-		do {
+		for (;;) {
 			resplen = GPS_FRAME_MAX;
-			if (gps_recv(gps, timeout, response, &resplen) != 1)
+			if (link_recv(gps, left, response, &resplen) != 1)
 				break;
-			if (resplen > 2)
-				switch (response[0]) {
-				case ack:
-					if (response[1] == typ)
-					        result = 1;
-					break;
-				case nak:
-					if (response[1] == typ)
-						result = 0;
-					break;
-				}
-		} while (result == -1 && retries--);
+			if (resplen > 2 && response[1] == typ &&
+			    (response[0] == ack || response[0] == nak)) {
+				result = response[0] == ack;
+				break;
+			}
+			dispatch(gps, response, resplen);
+			if (timeout != -1 &&
+			    (left = (int) (end - time(NULL))) <= 0)
+				break;
+		}
 
 	if (response)
-		free(response);
+		gps_free(response);
 
 	return result;
 }
 
+/*
+ * send a frame already in layer two format, as made by gps_frame, and
+ * wait for an ack/nak.  If nak'd re-send the frame.  Return values are
+ * those of gps_send_wait.
+ */
+int
+gps_send_framed(gps_handle gps, const u_char *frame, size_t len, int timeout)
+{
+	int retries = 3;
+	int ok = -1;
+
+	do {
+		if (gps_write(gps, frame, len) == 1)
+			ok = gps_wait(gps, frame[1], timeout);
+	} while (ok == 0 && retries--);
+	return ok;
+}
+
 /*
  * send a frame and wait for an ack/nak.  If nak'd re-send the frame.
  * Return 1 if all ok, -1 if frame can not be sent/is not acknowledged,
@@ -291,7 +432,6 @@ gps_wait(gps_handle gps, u_char typ, int timeout)
 int
 gps_send_wait(gps_handle gps, const u_char *buf, int cnt, int timeout)
 {
-	int retries = 3;
 	int ok = -1;
 	size_t len = (size_t) cnt;
 	u_char *data = gps_frame(buf, &len);
@@ -299,13 +439,47 @@ gps_send_wait(gps_handle gps, const u_char *buf, int cnt, int timeout)
 	if (data) {
 		if (gps_debug(gps) >= 4)
 			gps_display('}', buf, cnt);
-		do {
-			if (gps_write(gps, data, len) == 1)
-				ok = gps_wait(gps, *buf, timeout);
-		} while (ok == 0 && retries--);
+		ok = gps_send_framed(gps, data, len, timeout);
+		gps_free(data);
 	}
-	if (data)
-		free(data);
 
 	return ok;
 }
+
+/*
+ * End the transfer in progress on the handle, if any.  An upload is
+ * ended with an abort transfer end packet, a download with the abort
+ * transfer command, and a position stream with the stop command.  The
+ * ack is not waited for; whatever the unit still sends is read and
+ * dropped so the link is idle on return.  Works on a cancelled handle.
+ */
+void
+gps_abort(gps_handle gps)
+{
+	int xfer = gps_get_xfer(gps);
+	u_char buf[4];
+
+	if (xfer == GPS_XFER_NONE || xfer == GPS_XFER_ABORT)
+		return;
+	gps_set_xfer(gps, GPS_XFER_ABORT);
+	switch (xfer) {
+	case GPS_XFER_UP:
+		buf[0] = p_xfr_end;
+		buf[1] = (u_char) CMD_ABORT_XFR;
+		break;
+	case GPS_XFER_PVT:
+		buf[0] = p_cmd_type;
+		buf[1] = (u_char) CMD_STOP_PVT;
+		break;
+	default:
+		buf[0] = p_cmd_type;
+		buf[1] = (u_char) CMD_ABORT_XFR;
+		break;
+	}
+	buf[2] = 0;
+	gps_printf(gps, 2, "%s: transfer aborted\n", __func__);
+	gps_send(gps, buf, 3);
+	gps_drain(gps);
+	gps_queue_clear(gps_get_queue(gps));
+	gps_set_xfer(gps, GPS_XFER_NONE);
+}
@@ -4,8 +4,11 @@
 
 #include <sys/types.h>
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "gpslib.h"
 
@@ -14,77 +17,114 @@
  *
  * gps -> host:	protocol array
  *
- * The array contains tag/value pairs.   The only tag/values this program
- * cares about is A{protocol indicator} and D{data type indicator}.  The
- * D{data type indicator} relate to the immediately preceeding A{protocol
- * indicator}.   The protocols A100, A200, A201, A300, and A301 are
- * processed.  All others are ignored.
+ * The array contains tag/value pairs.  P{physical}, L{link}, and
+ * A{application protocol} tags name protocols; the D{data type} tags
+ * that follow a protocol are the packet types it uses.  The whole array
+ * is kept on the handle as a table of protocols, see
+ * gps_get_protocols.  The packet types used to transfer waypoints,
+ * routes, and tracks are then chosen from the table.
+ */
+
+/*
+ * Return the table entry of the given protocol, NULL if the unit does
+ * not support it.  tag is 'P', 'L', or 'A'.
+ */
+const struct gps_protocol *
+gps_find_protocol(gps_handle gps, int tag, int num)
+{
+	struct gps_protocols *tab = gps_get_protocols(gps);
+	int ix;
+
+	if (tab != NULL)
+		for (ix = 0; ix < tab->count; ix++)
+			if (tab->proto[ix].tag == tag &&
+			    tab->proto[ix].num == num)
+				return &tab->proto[ix];
+	return NULL;
+}
+
+/*
+ * Pick the transfer protocols from the table: A201 (route links) over
+ * A200, and A301 (track headers) over A300 when the unit supports
+ * both.  The packet types of the chosen protocols are used as given;
+ * a type the library has no codec for is reported when it is used.
+ * Kinds with no protocol in the table keep their types.
  */
 static void
+cap_choose(gps_handle gps)
+{
+	const struct gps_protocol *p;
+
+	p = gps_find_protocol(gps, 'A', 100);
+	if (p && p->ndata >= 1)
+		gps_set_wpt_type(gps, p->data[0]);
+
+	p = gps_find_protocol(gps, 'A', 201);
+	if (p && p->ndata >= 3) {
+		gps_set_rte_hdr_type(gps, p->data[0]);
+		gps_set_rte_wpt_type(gps, p->data[1]);
+		gps_set_rte_lnk_type(gps, p->data[2]);
+	} else if ((p = gps_find_protocol(gps, 'A', 200)) && p->ndata >= 2) {
+		gps_set_rte_hdr_type(gps, p->data[0]);
+		gps_set_rte_wpt_type(gps, p->data[1]);
+		gps_set_rte_lnk_type(gps, 0);
+	}
+
+	p = gps_find_protocol(gps, 'A', 301);
+	if (p && p->ndata >= 2) {
+		gps_set_trk_hdr_type(gps, p->data[0]);
+		gps_set_trk_type(gps, p->data[1]);
+	} else if ((p = gps_find_protocol(gps, 'A', 300)) && p->ndata >= 1) {
+		gps_set_trk_hdr_type(gps, 0);
+		gps_set_trk_type(gps, p->data[0]);
+	}
+}
+
+/*
+ * Fill the protocol table of the handle from a capability array packet
+ * and choose the packet types from it.
+ */
+void
 gps_cap_parse(gps_handle gps, const u_char *data, int datalen)
 {
+	struct gps_protocols *tab = gps_get_protocols(gps);
+	struct gps_protocol *proto = NULL;
 	int ix;
 	int tag;
 	int val;
-	int proto = 0;
-	int dix = 0;
 
 	gps_printf(gps, 3, "%s:\n", __func__);
-	if (data[0] == p_cap) {
+	if (data[0] == p_cap && tab != NULL) {
+		tab->count = 0;
+		tab->sent = 1;
 		for (ix = 1; ix + 2 < datalen; ix += 3) {
 			tag = data[ix];
 			val = data[ix + 1] + (data[ix + 2] << 8);
 			gps_printf(gps, 3, "%s %c%03d", tag == 'A' ? "\n" : "",
 				   tag, val);
 			switch (tag) {
+			case 'P':
+			case 'L':
 			case 'A':
-				proto = val;
-				dix = 0;
-				break;
-			case 'D':
-				switch (proto) {
-				default:
-					break;
-				case 100:
-					gps_set_wpt_type(gps, val);
-					break;
-				case 200:
-					if (dix == 0)
-						gps_set_rte_hdr_type(gps, val);
-					else
-						gps_set_rte_wpt_type(gps, val);
-					break;
-				case 201:
-					switch (dix) {
-					case 0:
-						gps_set_rte_hdr_type(gps, val);
-						break;
-					case 1:
-						gps_set_rte_wpt_type(gps, val);
-						break;
-					case 2:
-						gps_set_rte_lnk_type(gps, val);
-						break;
-					}
-					break;
-				case 300:
-					if (dix == 0)
-						gps_set_trk_type(gps, val);
-					break;
-				case 301:
-					if (dix == 0)
-						gps_set_trk_hdr_type(gps, val);
-					else
-						gps_set_trk_type(gps, val);
+				if (tab->count == GPS_PROTO_MAX) {
+					proto = NULL;
 					break;
 				}
-				dix++;
+				proto = &tab->proto[tab->count++];
+				proto->tag = (char) tag;
+				proto->num = val;
+				proto->ndata = 0;
+				break;
+			case 'D':
+				if (proto && proto->ndata < GPS_PROTO_DATA)
+					proto->data[proto->ndata++] = val;
 				break;
 			default:
 				break;
 			}
 		}
 		gps_printf(gps, 3, "\n");
+		cap_choose(gps);
 	} else
 		gps_printf(gps, 2, "%s: unknown packet type %d\n",
 			   __func__, data[0]);
@@ -97,16 +137,17 @@ gps_cap_parse(gps_handle gps, const u_char *data, int datalen)
  * 5 seconds for the data.  If it is not found assume it is
  * not supported.
  *
- * procedure returns -1 on error, otherwise 0.
+ * procedure returns -1 on error, 1 if the array was not sent,
+ * otherwise 0.
  */
 
 #define RCV_TO	5
 
-int
-gps_protocol_cap(gps_handle gps)
+static int
+cap_recv(gps_handle gps)
 {
 	int retries = 5;
-	u_char *data = malloc(GPS_FRAME_MAX);
+	u_char *data = gps_malloc(GPS_FRAME_MAX);
 	int datalen;
 
 	/* Start with a set of default capabilities.   These will be
@@ -124,23 +165,338 @@ gps_protocol_cap(gps_handle gps)
 	gps_printf(gps, 3, "%s: recv\n", __func__);
 	while (retries--) {
 		datalen = GPS_FRAME_MAX;
-		switch (gps_recv(gps, RCV_TO, data, &datalen)) {
+		switch (gps_recv_type(gps, p_cap, RCV_TO, data, &datalen)) {
 		case -1:
 			gps_send_nak(gps, *data);
 			gps_printf(gps, 3, "%s: retry\n", __func__);
 			break;
 		case 0:
-			goto done;
+			gps_free(data);
+			return 1;
 		case 1:
 			gps_cap_parse(gps, data, datalen);
 			gps_send_ack(gps, *data);
-			free(data);
+			gps_free(data);
 			gps_printf(gps, 3, "%s: rcvd\n", __func__);
 			return 0;
 		}
 	}
-done:
-	free(data);
+	gps_free(data);
 	return -1;
 }
 
+/*
+ * Set the packet types of the handle from a protocol capability array
+ * given as text, for use without a unit.  The array is a list of
+ * A{protocol} and D{data type} tags separated by blanks or commas in
+ * the order a unit sends them, e.g.
+ *
+ *	A100 D108 A201 D202 D108 D210 A301 D310 D301
+ *
+ * Types not given are the defaults used when a unit sends no array.
+ * procedure returns -1 if the text is not a list of tags, otherwise 0.
+ */
+int
+gps_cap_profile(gps_handle gps, const char *profile)
+{
+	u_char data[GPS_FRAME_MAX];
+	const char *p = profile;
+	char *end;
+	long val;
+	int len = 0;
+
+	data[len++] = p_cap;
+	for (;;) {
+		while (*p == ' ' || *p == '\t' || *p == ',')
+			p++;
+		if (*p == 0)
+			break;
+		if ((*p != 'A' && *p != 'a' && *p != 'D' && *p != 'd') ||
+		    len + 3 > (int) sizeof data)
+			return -1;
+		val = strtol(p + 1, &end, 10);
+		if (end == p + 1 || val < 0 || val > 0xffff ||
+		    (*end != 0 && *end != ' ' && *end != '\t' && *end != ','))
+			return -1;
+		data[len++] = (u_char) (*p == 'a' || *p == 'A' ? 'A' : 'D');
+		data[len++] = (u_char) val;
+		data[len++] = (u_char) (val >> 8);
+		p = end;
+	}
+	gps_set_wpt_type(gps, D100);
+	gps_set_rte_hdr_type(gps, D200);
+	gps_set_rte_wpt_type(gps, D100);
+	gps_set_trk_type(gps, D300);
+	gps_cap_parse(gps, data, len);
+	return 0;
+}
+
+/*
+ * procedure returns -1 if the protocol array was not received,
+ * otherwise 0.
+ */
+int
+gps_protocol_cap(gps_handle gps)
+{
+	return cap_recv(gps) == 0 ? 0 : -1;
+}
+
+/*
+ * Capability cache.
+ *
+ * Units that do not send a protocol capability array cost RCV_TO
+ * seconds per session waiting for one.  The negotiated packet types
+ * are remembered per product id and software version, first in a
+ * built-in table of units that predate the capability protocol and
+ * then in a cache file written after each probe.  A unit known not to
+ * send the array is not waited for.  A unit known to send it is still
+ * read as the array arrives right away and must be consumed.
+ *
+ * The cache file is $GARMIN_CAP_CACHE, or ~/.garmincap if that is not
+ * set.  An empty GARMIN_CAP_CACHE disables the file.  Each line is
+ *
+ *	product version cap wpt rte_hdr rte_wpt rte_lnk trk_hdr trk
+ *
+ * where cap is 1 if the unit sends the capability array and the types
+ * are Dxxx numbers, 0 if not used.
+ */
+
+struct cap_entry {
+	int	product;		/* product id */
+	int	lo;			/* software version range */
+	int	hi;
+	int	cap;			/* unit sends capability array */
+	int	wpt;
+	int	rte_hdr;
+	int	rte_wpt;
+	int	rte_lnk;
+	int	trk_hdr;
+	int	trk;
+};
+
+#define CAP_CACHE	".garmincap"
+#define CAP_LINE	128
+
+/*
+ * Units without the capability protocol, from the product id table of
+ * the Garmin interface specification.  Only units whose packet types
+ * are supported here are listed.
+ */
+static const struct cap_entry known_units[] = {
+	{  13, 0, 9999, 0, D100, D200, D100, 0, 0, D300 },
+	{  18, 0, 9999, 0, D100, D200, D100, 0, 0, D300 },
+	{  25, 0, 9999, 0, D100, D200, D100, 0, 0, D300 },
+	{  29, 0,  399, 0, D101, D201, D101, 0, 0, D300 },
+	{  29, 400, 9999, 0, D102, D201, D102, 0, 0, D300 },
+	{  31, 0, 9999, 0, D100, D201, D100, 0, 0, D300 },
+	{  41, 0, 9999, 0, D100, D201, D100, 0, 0, D300 },
+	{  44, 0, 9999, 0, D101, D201, D101, 0, 0, D300 },
+	{  47, 0, 9999, 0, D100, D201, D100, 0, 0, D300 },
+	{  49, 0, 9999, 0, D102, D201, D102, 0, 0, D300 },
+	{  55, 0, 9999, 0, D100, D201, D100, 0, 0, D300 },
+	{  56, 0, 9999, 0, D100, D201, D100, 0, 0, D300 },
+	{  59, 0, 9999, 0, D100, D201, D100, 0, 0, D300 },
+	{  61, 0, 9999, 0, D100, D201, D100, 0, 0, D300 },
+	{  62, 0, 9999, 0, D100, D201, D100, 0, 0, D300 },
+	{  72, 0, 9999, 0, D104, D201, D104, 0, 0, D300 },
+	{  73, 0, 9999, 0, D103, D201, D103, 0, 0, D300 },
+	{  74, 0, 9999, 0, D100, D201, D100, 0, 0, D300 },
+	{  76, 0, 9999, 0, D102, D201, D102, 0, 0, D300 },
+	{  77, 0,  300, 0, D100, D201, D100, 0, 0, D300 },
+	{  77, 301, 9999, 0, D103, D201, D103, 0, 0, D300 },
+	{  87, 0, 9999, 0, D103, D201, D103, 0, 0, D300 },
+	{  88, 0, 9999, 0, D102, D201, D102, 0, 0, D300 },
+	{  95, 0, 9999, 0, D103, D201, D103, 0, 0, D300 },
+	{  96, 0, 9999, 0, D103, D201, D103, 0, 0, D300 },
+	{  97, 0, 9999, 0, D103, D201, D103, 0, 0, D300 },
+	{  98, 0, 9999, 0, D103, D201, D103, 0, 0, D300 },
+	{ 100, 0, 9999, 0, D103, D201, D103, 0, 0, D300 },
+	{ 105, 0, 9999, 0, D103, D201, D103, 0, 0, D300 },
+	{ 106, 0, 9999, 0, D103, D201, D103, 0, 0, D300 }
+};
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Fill in path with the name of the cache file.  Returns -1 if there
+ * is no cache file.
+ */
+static int
+cache_path(char *path, size_t size)
+{
+	const char *env = getenv("GARMIN_CAP_CACHE");
+	const char *home;
+
+	if (env != NULL) {
+		if (*env == 0)
+			return -1;
+		return strlcpy(path, env, size) < size ? 0 : -1;
+	}
+	home = getenv("HOME");
+	if (home == NULL || *home == 0)
+		return -1;
+	return snprintf(path, size, "%s/%s", home, CAP_CACHE) <
+		(int) size ? 0 : -1;
+}
+
+static int
+cache_parse(const char *line, struct cap_entry *e)
+{
+	if (sscanf(line, "%d %d %d %d %d %d %d %d %d", &e->product, &e->lo,
+		   &e->cap, &e->wpt, &e->rte_hdr, &e->rte_wpt, &e->rte_lnk,
+		   &e->trk_hdr, &e->trk) != 9)
+		return -1;
+	e->hi = e->lo;
+	return 0;
+}
+
+/*
+ * Look for the unit in the cache file and then the built-in table.
+ * Returns 0 and fills in *e if found, otherwise -1.
+ */
+static int
+cap_lookup(gps_handle gps, int product, int version, struct cap_entry *e)
+{
+	char path[FILENAME_MAX];
+	char line[CAP_LINE];
+	FILE *fp;
+	size_t ix;
+
+	if (cache_path(path, sizeof path) == 0 &&
+	    (fp = fopen(path, "r")) != NULL) {
+		while (fgets(line, sizeof line, fp) != NULL) {
+			if (cache_parse(line, e) == 0 &&
+			    e->product == product && e->lo == version) {
+				fclose(fp);
+				gps_printf(gps, 3, "%s: found in %s\n",
+					   __func__, path);
+				return 0;
+			}
+		}
+		fclose(fp);
+	}
+	for (ix = 0; ix < sizeof known_units / sizeof known_units[0]; ix++) {
+		if (known_units[ix].product == product &&
+		    known_units[ix].lo <= version &&
+		    version <= known_units[ix].hi) {
+			*e = known_units[ix];
+			gps_printf(gps, 3, "%s: known unit\n", __func__);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Record the types set on the handle for the unit in the cache file.
+ * The file is rewritten through a temporary file so that concurrent
+ * readers see either the old or the new contents.
+ */
+static void
+cap_store(gps_handle gps, int product, int version, int cap)
+{
+	char path[FILENAME_MAX];
+	char tmp[FILENAME_MAX];
+	char line[CAP_LINE];
+	struct cap_entry e;
+	FILE *in;
+	FILE *out;
+	int fd;
+
+	if (cache_path(path, sizeof path) ||
+	    snprintf(tmp, sizeof tmp, "%s.XXXXXX", path) >= (int) sizeof tmp)
+		return;
+	if ((fd = mkstemp(tmp)) == -1 || (out = fdopen(fd, "w")) == NULL) {
+		if (fd != -1) {
+			close(fd);
+			unlink(tmp);
+		}
+		gps_printf(gps, 2, "%s: can't write %s\n", __func__, path);
+		return;
+	}
+	if ((in = fopen(path, "r")) != NULL) {
+		while (fgets(line, sizeof line, in) != NULL)
+			if (cache_parse(line, &e) == -1 ||
+			    e.product != product || e.lo != version)
+				fputs(line, out);
+		fclose(in);
+	}
+	fprintf(out, "%d %d %d %d %d %d %d %d %d\n", product, version, cap,
+		gps_get_wpt_type(gps), gps_get_rte_hdr_type(gps),
+		gps_get_rte_wpt_type(gps), gps_get_rte_lnk_type(gps),
+		gps_get_trk_hdr_type(gps), gps_get_trk_type(gps));
+	if (fclose(out) != 0 || rename(tmp, path) == -1) {
+		unlink(tmp);
+		gps_printf(gps, 2, "%s: can't write %s\n", __func__, path);
+	}
+}
+
+static void
+cap_add(struct gps_protocols *tab, int num, int d0, int d1, int d2)
+{
+	struct gps_protocol *p = &tab->proto[tab->count++];
+
+	p->tag = 'A';
+	p->num = num;
+	p->ndata = 0;
+	if (d0)
+		p->data[p->ndata++] = d0;
+	if (d1)
+		p->data[p->ndata++] = d1;
+	if (d2)
+		p->data[p->ndata++] = d2;
+}
+
+/*
+ * Set the types of a cached or known unit.  No array was read so the
+ * protocol table is made up from the types.
+ */
+static void
+cap_apply(gps_handle gps, const struct cap_entry *e)
+{
+	struct gps_protocols *tab = gps_get_protocols(gps);
+
+	gps_set_wpt_type(gps, e->wpt);
+	gps_set_rte_hdr_type(gps, e->rte_hdr);
+	gps_set_rte_wpt_type(gps, e->rte_wpt);
+	gps_set_rte_lnk_type(gps, e->rte_lnk);
+	gps_set_trk_hdr_type(gps, e->trk_hdr);
+	gps_set_trk_type(gps, e->trk);
+	if (tab == NULL)
+		return;
+	tab->count = 0;
+	tab->sent = 0;
+	cap_add(tab, 100, e->wpt, 0, 0);
+	cap_add(tab, e->rte_lnk ? 201 : 200, e->rte_hdr, e->rte_wpt,
+		e->rte_lnk);
+	cap_add(tab, e->trk_hdr ? 301 : 300, e->trk_hdr, e->trk, 0);
+}
+
+/*
+ * Determine the packet types of the unit with the given product id and
+ * software version as returned by gps_product, waiting for the protocol
+ * capability array only if the unit is not known to skip it.
+ *
+ * procedure returns -1 if the default types are used, otherwise 0.
+ */
+int
+gps_capabilities(gps_handle gps, int product, int version)
+{
+	struct cap_entry e;
+	int rc;
+
+	if (cap_lookup(gps, product, version, &e) == 0) {
+		/* a sent array is on its way and supersedes the cache */
+		if (! e.cap || cap_recv(gps) != 0)
+			cap_apply(gps, &e);
+		return 0;
+	}
+	rc = cap_recv(gps);
+	if (rc != -1) {
+		/* one writer at a time so no unit is lost from the cache */
+		pthread_mutex_lock(&cache_lock);
+		cap_store(gps, product, version, rc == 0);
+		pthread_mutex_unlock(&cache_lock);
+	}
+	return rc == 0 ? 0 : -1;
+}
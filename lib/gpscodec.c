@@ -0,0 +1,760 @@
+/*
+ * Public Domain, 2026, Marco S Hyman <marc@snafu.org>
+ */
+
+#include <sys/types.h>
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gpslib.h"
+
+/*
+ * Packet codecs.
+ *
+ * Each Garmin data type (Dxxx) is described once by a schema: the list
+ * of its fields in packet order.  The schema is expanded twice, once
+ * into a decoder that fills in a gps_wpt, gps_rte, or gps_trk structure
+ * from a packet and once into an encoder that builds a packet from the
+ * same structure.  Field offsets follow from the field order so the two
+ * directions can not disagree.
+ *
+ * A schema entry is F(kind, arg).  Every kind has a decode and an
+ * encode function for the structure it applies to, named
+ * <struct>_dec_<kind> and <struct>_enc_<kind>.  Decode functions are
+ * given the packet length and do not read past it; fields beyond the
+ * end of a packet decode as absent.  Encode functions assume a buffer of
+ * GPS_FRAME_MAX bytes.  Both return the offset of the next field.
+ *
+ * Offset 0 of every packet is the packet id which is not part of the
+ * schema.  Encoders leave it for the caller.
+ */
+
+/*
+ * Decode a string from the packet.  A max greater than zero is a fixed
+ * length field of max characters, otherwise the string is null
+ * terminated with at most GPS_STRING_MAX - 1 characters.  Either ends
+ * at the first null.  The string is left pointing into the packet, its
+ * pointer is NULL if off is past the end of the packet.  Returns the
+ * offset of the next field.
+ */
+static int
+dec_string(const u_char *p, int len, int off, int max, struct gps_str *s)
+{
+	int slen;
+	int size;
+
+	size = max > 0 ? max : GPS_STRING_MAX - 1;
+	for (slen = 0; slen < size && off + slen < len && p[off + slen];
+	     slen++)
+		continue;
+	s->str = off < len ? (const char *) &p[off] : NULL;
+	s->len = slen;
+	if (max > 0)
+		return off + max;
+	return off + slen + (off + slen < len);
+}
+
+/*
+ * Encode a fixed length string field.  The string is null terminated
+ * if shorter than the field and the rest of the field padded with
+ * spaces.
+ */
+static int
+enc_fixed(u_char *p, int off, const struct gps_str *s, int len)
+{
+	int ix = 0;
+
+	if (s->str != NULL)
+		for (; ix < len && ix < s->len && s->str[ix]; ix++)
+			p[off + ix] = (u_char) s->str[ix];
+	if (ix < len) {
+		p[off + ix++] = 0;
+		memset(&p[off + ix], ' ', (size_t) (len - ix));
+	}
+	return off + len;
+}
+
+/*
+ * Encode a null terminated string of at most GPS_STRING_MAX - 1
+ * characters.
+ */
+static int
+enc_string(u_char *p, int off, const struct gps_str *s)
+{
+	int ix = 0;
+
+	if (s->str != NULL)
+		for (; ix < GPS_STRING_MAX - 1 && ix < s->len && s->str[ix];
+		     ix++)
+			p[off + ix] = (u_char) s->str[ix];
+	p[off + ix] = 0;
+	return off + ix + 1;
+}
+
+static long
+dec_int(const u_char *p, int len, int off, int size)
+{
+	long val = 0;
+
+	if (off + size > len)
+		return -1;
+	while (size--)
+		val = (val << 8) + p[off + size];
+	return val;
+}
+
+static int
+enc_int(u_char *p, int off, long val, int size)
+{
+	while (size--) {
+		p[off++] = (u_char) val;
+		val >>= 8;
+	}
+	return off;
+}
+
+/*
+ * convert the given double to a garmin `semicircle' and stuff
+ * it in to b (assumed to be at least 4 characters wide) in
+ * the garmin (little endian) order.  Round to the nearest semicircle
+ * so that positions survive a download/upload round trip unchanged.
+ */
+static void
+double2semicircle(double f, u_char *b)
+{
+	long work = lround(f * 0x80000000U / 180.0);
+	b[0] = (u_char) work;
+	b[1] = (u_char) (work >> 8);
+	b[2] = (u_char) (work >> 16);
+	b[3] = (u_char) (work >> 24);
+}
+
+/*
+ * Field kinds common to all structures: constant data that is written
+ * on encode and skipped on decode.
+ */
+#define CONST_FIELD(s)							\
+static inline int							\
+s##_dec_CONST8(const u_char *p, int len, int off, long arg,		\
+	       struct gps_##s *x)					\
+{									\
+	return off + 1;							\
+}									\
+static inline int							\
+s##_enc_CONST8(u_char *p, int off, long arg, const struct gps_##s *x)	\
+{									\
+	p[off] = (u_char) arg;						\
+	return off + 1;							\
+}									\
+static inline int							\
+s##_dec_CONST32(const u_char *p, int len, int off, long arg,		\
+		struct gps_##s *x)					\
+{									\
+	return off + 4;							\
+}									\
+static inline int							\
+s##_enc_CONST32(u_char *p, int off, long arg, const struct gps_##s *x)	\
+{									\
+	return enc_int(p, off, arg, 4);					\
+}									\
+static inline int							\
+s##_dec_NOVAL(const u_char *p, int len, int off, long arg,		\
+	      struct gps_##s *x)					\
+{									\
+	return off + 4;							\
+}									\
+static inline int							\
+s##_enc_NOVAL(u_char *p, int off, long arg, const struct gps_##s *x)	\
+{									\
+	return off + gps_put_float(&p[off], no_val.f);			\
+}									\
+static inline int							\
+s##_dec_BLANKS(const u_char *p, int len, int off, long arg,		\
+	       struct gps_##s *x)					\
+{									\
+	return off + (int) arg;						\
+}									\
+static inline int							\
+s##_enc_BLANKS(u_char *p, int off, long arg, const struct gps_##s *x)	\
+{									\
+	memset(&p[off], ' ', (size_t) arg);				\
+	return off + (int) arg;						\
+}									\
+static inline int							\
+s##_dec_EMPTY(const u_char *p, int len, int off, long arg,		\
+	      struct gps_##s *x)					\
+{									\
+	while (off < len && p[off])					\
+		off++;							\
+	return off + 1;							\
+}									\
+static inline int							\
+s##_enc_EMPTY(u_char *p, int off, long arg, const struct gps_##s *x)	\
+{									\
+	p[off] = 0;							\
+	return off + 1;							\
+}
+
+CONST_FIELD(wpt)
+CONST_FIELD(rte)
+CONST_FIELD(trk)
+
+/*
+ * Waypoint fields
+ */
+static inline int
+wpt_dec_POSN(const u_char *p, int len, int off, long arg, struct gps_wpt *w)
+{
+	if (off + 8 <= len) {
+		w->posn = &p[off];
+		w->lat = gps_semicircle2double(&p[off]);
+		w->lon = gps_semicircle2double(&p[off + 4]);
+	}
+	return off + 8;
+}
+
+static inline int
+wpt_enc_POSN(u_char *p, int off, long arg, const struct gps_wpt *w)
+{
+	double2semicircle(w->lat, &p[off]);
+	double2semicircle(w->lon, &p[off + 4]);
+	return off + 8;
+}
+
+/* fixed length upper case ident */
+static inline int
+wpt_dec_IDENT(const u_char *p, int len, int off, long arg, struct gps_wpt *w)
+{
+	return dec_string(p, len, off, (int) arg, &w->ident);
+}
+
+static inline int
+wpt_enc_IDENT(u_char *p, int off, long arg, const struct gps_wpt *w)
+{
+	int ix;
+	int end = 0;
+
+	for (ix = 0; ix < arg; ix++) {
+		if (!end && (ix >= w->ident.len || w->ident.str[ix] == 0))
+			end = 1;
+		p[off + ix] = end ? ' ' :
+			(u_char) toupper((unsigned char) w->ident.str[ix]);
+	}
+	return off + (int) arg;
+}
+
+/* variable length ident */
+static inline int
+wpt_dec_VIDENT(const u_char *p, int len, int off, long arg, struct gps_wpt *w)
+{
+	return dec_string(p, len, off, 0, &w->ident);
+}
+
+static inline int
+wpt_enc_VIDENT(u_char *p, int off, long arg, const struct gps_wpt *w)
+{
+	return enc_string(p, off, &w->ident);
+}
+
+/* fixed length comment */
+static inline int
+wpt_dec_CMNT(const u_char *p, int len, int off, long arg, struct gps_wpt *w)
+{
+	return dec_string(p, len, off, (int) arg, &w->cmnt);
+}
+
+static inline int
+wpt_enc_CMNT(u_char *p, int off, long arg, const struct gps_wpt *w)
+{
+	return enc_fixed(p, off, &w->cmnt, (int) arg);
+}
+
+/* variable length comment */
+static inline int
+wpt_dec_VCMNT(const u_char *p, int len, int off, long arg, struct gps_wpt *w)
+{
+	return dec_string(p, len, off, 0, &w->cmnt);
+}
+
+static inline int
+wpt_enc_VCMNT(u_char *p, int off, long arg, const struct gps_wpt *w)
+{
+	return enc_string(p, off, &w->cmnt);
+}
+
+/*
+ * A string some units send after the ident of a D105 waypoint.  It
+ * is decoded as the comment but never sent.
+ */
+static inline int
+wpt_dec_XCMNT(const u_char *p, int len, int off, long arg, struct gps_wpt *w)
+{
+	return dec_string(p, len, off, 0, &w->cmnt);
+}
+
+static inline int
+wpt_enc_XCMNT(u_char *p, int off, long arg, const struct gps_wpt *w)
+{
+	return off;
+}
+
+/* symbol, arg is the field size */
+static inline int
+wpt_dec_SYM(const u_char *p, int len, int off, long arg, struct gps_wpt *w)
+{
+	w->sym = dec_int(p, len, off, (int) arg);
+	return off + (int) arg;
+}
+
+static inline int
+wpt_enc_SYM(u_char *p, int off, long arg, const struct gps_wpt *w)
+{
+	return enc_int(p, off, w->sym == -1 ? 0 : w->sym, (int) arg);
+}
+
+static inline int
+wpt_dec_DSPL(const u_char *p, int len, int off, long arg, struct gps_wpt *w)
+{
+	w->dsp = dec_int(p, len, off, 1);
+	return off + 1;
+}
+
+static inline int
+wpt_enc_DSPL(u_char *p, int off, long arg, const struct gps_wpt *w)
+{
+	p[off] = (u_char) (w->dsp == -1 ? 0 : w->dsp);
+	return off + 1;
+}
+
+/* D109 display (bits 5-6) and color (bits 0-4, default 0x1f) */
+static inline int
+wpt_dec_DSPLCOLOR(const u_char *p, int len, int off, long arg,
+		  struct gps_wpt *w)
+{
+	w->dsp = dec_int(p, len, off, 1);
+	if (w->dsp != -1)
+		w->dsp = (w->dsp >> 5) & 3;
+	return off + 1;
+}
+
+static inline int
+wpt_enc_DSPLCOLOR(u_char *p, int off, long arg, const struct gps_wpt *w)
+{
+	p[off] = (u_char) ((((w->dsp == -1 ? 0 : w->dsp) << 5) & 0x60) | 0x1f);
+	return off + 1;
+}
+
+static inline int
+wpt_dec_ALT(const u_char *p, int len, int off, long arg, struct gps_wpt *w)
+{
+	if (off + 4 <= len)
+		w->alt = gps_get_float(&p[off]);
+	return off + 4;
+}
+
+static inline int
+wpt_enc_ALT(u_char *p, int off, long arg, const struct gps_wpt *w)
+{
+	return off + gps_put_float(&p[off], w->alt);
+}
+
+static inline int
+wpt_dec_CLASS(const u_char *p, int len, int off, long arg, struct gps_wpt *w)
+{
+	w->class = dec_int(p, len, off, 1);
+	return off + 1;
+}
+
+static inline int
+wpt_enc_CLASS(u_char *p, int off, long arg, const struct gps_wpt *w)
+{
+	p[off] = (u_char) (w->class == -1 ? 0 : w->class);
+	return off + 1;
+}
+
+/*
+ * Subclass of arg bytes.  User waypoints (class 0) get the default
+ * subclass: all zero for short subclass fields, six zero bytes and
+ * twelve 0xff bytes for the 18 byte field of D108/D109 waypoints.
+ */
+static inline int
+wpt_dec_SUBCLASS(const u_char *p, int len, int off, long arg,
+		 struct gps_wpt *w)
+{
+	if (off + arg <= len) {
+		w->subclass = &p[off];
+		w->subclass_len = (int) arg;
+	}
+	return off + (int) arg;
+}
+
+static inline int
+wpt_enc_SUBCLASS(u_char *p, int off, long arg, const struct gps_wpt *w)
+{
+	if (w->class > 0 && w->subclass_len >= arg)
+		memcpy(&p[off], w->subclass, (size_t) arg);
+	else if (arg == 18) {
+		memset(&p[off], 0, 6);
+		memset(&p[off + 6], 0xff, 12);
+	} else
+		memset(&p[off], 0, (size_t) arg);
+	return off + (int) arg;
+}
+
+/*
+ * Waypoint schemas.  The D106 link ident is kept as the comment.
+ */
+#define D100_FIELDS(F)							\
+	F(IDENT, 6) F(POSN, 0) F(CONST32, 0) F(CMNT, 40)
+#define D101_FIELDS(F)							\
+	D100_FIELDS(F) F(CONST32, 0) F(SYM, 1)
+#define D102_FIELDS(F)							\
+	D100_FIELDS(F) F(CONST32, 0) F(SYM, 2)
+#define D103_FIELDS(F)							\
+	D100_FIELDS(F) F(SYM, 1) F(DSPL, 0)
+#define D104_FIELDS(F)							\
+	D100_FIELDS(F) F(CONST32, 0) F(SYM, 2) F(DSPL, 0)
+#define D105_FIELDS(F)							\
+	F(POSN, 0) F(SYM, 2) F(VIDENT, 0) F(XCMNT, 0)
+#define D106_FIELDS(F)							\
+	F(CLASS, 0) F(SUBCLASS, 13) F(POSN, 0) F(SYM, 2) F(VIDENT, 0)	\
+	F(VCMNT, 0)
+#define D107_FIELDS(F)							\
+	D100_FIELDS(F) F(SYM, 1) F(DSPL, 0) F(CONST32, 0) F(CONST8, 0)
+#define D108_FIELDS(F)							\
+	F(CLASS, 0) F(CONST8, 0xff) F(DSPL, 0) F(CONST8, 0x60) F(SYM, 2) \
+	F(SUBCLASS, 18) F(POSN, 0) F(ALT, 0) F(NOVAL, 0) F(NOVAL, 0)	\
+	F(BLANKS, 4) F(VIDENT, 0) F(VCMNT, 0) F(EMPTY, 0) F(EMPTY, 0)	\
+	F(EMPTY, 0) F(EMPTY, 0)
+#define D109_FIELDS(F)							\
+	F(CONST8, 1) F(CLASS, 0) F(DSPLCOLOR, 0) F(CONST8, 0x70)	\
+	F(SYM, 2) F(SUBCLASS, 18) F(POSN, 0) F(ALT, 0) F(NOVAL, 0)	\
+	F(NOVAL, 0) F(BLANKS, 4) F(CONST32, 0xffffffff) F(VIDENT, 0)	\
+	F(VCMNT, 0) F(EMPTY, 0) F(EMPTY, 0) F(EMPTY, 0) F(EMPTY, 0)
+
+#define WPT_DEC(kind, arg)	off = wpt_dec_##kind(p, len, off, arg, w);
+#define WPT_ENC(kind, arg)	off = wpt_enc_##kind(p, off, arg, w);
+
+#define WPT_CODEC(type)							\
+static int								\
+type##_wpt_decode(const u_char *p, int len, struct gps_wpt *w)		\
+{									\
+	int off = 1;							\
+									\
+	memset(w, 0, sizeof *w);					\
+	w->alt = no_val.f;						\
+	w->sym = w->dsp = w->class = -1;				\
+	type##_FIELDS(WPT_DEC)						\
+	return w->posn ? 0 : -1;					\
+}									\
+static int								\
+type##_wpt_encode(const struct gps_wpt *w, u_char *p)			\
+{									\
+	int off = 1;							\
+									\
+	type##_FIELDS(WPT_ENC)						\
+	return off;							\
+}
+
+WPT_CODEC(D100)
+WPT_CODEC(D101)
+WPT_CODEC(D102)
+WPT_CODEC(D103)
+WPT_CODEC(D104)
+WPT_CODEC(D105)
+WPT_CODEC(D106)
+WPT_CODEC(D107)
+WPT_CODEC(D108)
+WPT_CODEC(D109)
+
+static const struct gps_wpt_codec wpt_codecs[] = {
+	{ D100, D100_wpt_decode, D100_wpt_encode },
+	{ D101, D101_wpt_decode, D101_wpt_encode },
+	{ D102, D102_wpt_decode, D102_wpt_encode },
+	{ D103, D103_wpt_decode, D103_wpt_encode },
+	{ D104, D104_wpt_decode, D104_wpt_encode },
+	{ D105, D105_wpt_decode, D105_wpt_encode },
+	{ D106, D106_wpt_decode, D106_wpt_encode },
+	{ D107, D107_wpt_decode, D107_wpt_encode },
+	{ D108, D108_wpt_decode, D108_wpt_encode },
+	{ D109, D109_wpt_decode, D109_wpt_encode }
+};
+
+/*
+ * Route header and link fields
+ */
+static inline int
+rte_dec_NUM(const u_char *p, int len, int off, long arg, struct gps_rte *r)
+{
+	r->num = dec_int(p, len, off, 1);
+	return off + 1;
+}
+
+static inline int
+rte_enc_NUM(u_char *p, int off, long arg, const struct gps_rte *r)
+{
+	p[off] = (u_char) (r->num == -1 ? 0 : r->num);
+	return off + 1;
+}
+
+/* fixed length comment */
+static inline int
+rte_dec_CMNT(const u_char *p, int len, int off, long arg, struct gps_rte *r)
+{
+	return dec_string(p, len, off, (int) arg, &r->ident);
+}
+
+static inline int
+rte_enc_CMNT(u_char *p, int off, long arg, const struct gps_rte *r)
+{
+	return enc_fixed(p, off, &r->ident, (int) arg);
+}
+
+/* variable length ident */
+static inline int
+rte_dec_VIDENT(const u_char *p, int len, int off, long arg, struct gps_rte *r)
+{
+	return dec_string(p, len, off, 0, &r->ident);
+}
+
+static inline int
+rte_enc_VIDENT(u_char *p, int off, long arg, const struct gps_rte *r)
+{
+	return enc_string(p, off, &r->ident);
+}
+
+static inline int
+rte_dec_CLASS(const u_char *p, int len, int off, long arg, struct gps_rte *r)
+{
+	r->class = dec_int(p, len, off, 2);
+	return off + 2;
+}
+
+static inline int
+rte_enc_CLASS(u_char *p, int off, long arg, const struct gps_rte *r)
+{
+	return enc_int(p, off, r->class == -1 ? 0 : r->class, 2);
+}
+
+/* link subclass, always the default value */
+static inline int
+rte_dec_SUBCLASS(const u_char *p, int len, int off, long arg,
+		 struct gps_rte *r)
+{
+	return off + 18;
+}
+
+static inline int
+rte_enc_SUBCLASS(u_char *p, int off, long arg, const struct gps_rte *r)
+{
+	memset(&p[off], 0, 6);
+	memset(&p[off + 6], 0xff, 12);
+	return off + 18;
+}
+
+/*
+ * Route schemas
+ */
+#define D200_FIELDS(F)	F(NUM, 0)
+#define D201_FIELDS(F)	F(NUM, 0) F(CMNT, 20)
+#define D202_FIELDS(F)	F(VIDENT, 0)
+#define D210_FIELDS(F)	F(CLASS, 0) F(SUBCLASS, 0) F(EMPTY, 0)
+
+#define RTE_DEC(kind, arg)	off = rte_dec_##kind(p, len, off, arg, r);
+#define RTE_ENC(kind, arg)	off = rte_enc_##kind(p, off, arg, r);
+
+#define RTE_CODEC(type)							\
+static int								\
+type##_rte_decode(const u_char *p, int len, struct gps_rte *r)		\
+{									\
+	int off = 1;							\
+									\
+	memset(r, 0, sizeof *r);					\
+	r->num = r->class = -1;						\
+	type##_FIELDS(RTE_DEC)						\
+	return 0;							\
+}									\
+static int								\
+type##_rte_encode(const struct gps_rte *r, u_char *p)			\
+{									\
+	int off = 1;							\
+									\
+	type##_FIELDS(RTE_ENC)						\
+	return off;							\
+}
+
+RTE_CODEC(D200)
+RTE_CODEC(D201)
+RTE_CODEC(D202)
+RTE_CODEC(D210)
+
+static const struct gps_rte_codec rte_codecs[] = {
+	{ D200, D200_rte_decode, D200_rte_encode },
+	{ D201, D201_rte_decode, D201_rte_encode },
+	{ D202, D202_rte_decode, D202_rte_encode },
+	{ D210, D210_rte_decode, D210_rte_encode }
+};
+
+/*
+ * Track fields
+ */
+static inline int
+trk_dec_POSN(const u_char *p, int len, int off, long arg, struct gps_trk *t)
+{
+	if (off + 8 <= len) {
+		t->posn = &p[off];
+		t->lat = gps_semicircle2double(&p[off]);
+		t->lon = gps_semicircle2double(&p[off + 4]);
+	}
+	return off + 8;
+}
+
+static inline int
+trk_enc_POSN(u_char *p, int off, long arg, const struct gps_trk *t)
+{
+	double2semicircle(t->lat, &p[off]);
+	double2semicircle(t->lon, &p[off + 4]);
+	return off + 8;
+}
+
+/*
+ * 0xffffffff is the unit's "no time" value, kept as -1
+ */
+static inline int
+trk_dec_TIME(const u_char *p, int len, int off, long arg, struct gps_trk *t)
+{
+	t->time = dec_int(p, len, off, 4);
+	if (t->time == 0xffffffffL)
+		t->time = -1;
+	return off + 4;
+}
+
+static inline int
+trk_enc_TIME(u_char *p, int off, long arg, const struct gps_trk *t)
+{
+	return enc_int(p, off, t->time == -1 ? 0xffffffffL : t->time, 4);
+}
+
+/* altitude or depth, arg selects */
+static inline int
+trk_dec_FLOAT(const u_char *p, int len, int off, long arg, struct gps_trk *t)
+{
+	if (off + 4 <= len)
+		*(arg ? &t->depth : &t->alt) = gps_get_float(&p[off]);
+	return off + 4;
+}
+
+static inline int
+trk_enc_FLOAT(u_char *p, int off, long arg, const struct gps_trk *t)
+{
+	return off + gps_put_float(&p[off], arg ? t->depth : t->alt);
+}
+
+static inline int
+trk_dec_NEW(const u_char *p, int len, int off, long arg, struct gps_trk *t)
+{
+	t->new_trk = (int) dec_int(p, len, off, 1);
+	return off + 1;
+}
+
+static inline int
+trk_enc_NEW(u_char *p, int off, long arg, const struct gps_trk *t)
+{
+	p[off] = (u_char) (t->new_trk > 0);
+	return off + 1;
+}
+
+static inline int
+trk_dec_VIDENT(const u_char *p, int len, int off, long arg, struct gps_trk *t)
+{
+	return dec_string(p, len, off, 0, &t->ident);
+}
+
+static inline int
+trk_enc_VIDENT(u_char *p, int off, long arg, const struct gps_trk *t)
+{
+	return enc_string(p, off, &t->ident);
+}
+
+/*
+ * Track schemas
+ */
+#define D300_FIELDS(F)	F(POSN, 0) F(TIME, 0) F(NEW, 0)
+#define D301_FIELDS(F)							\
+	F(POSN, 0) F(TIME, 0) F(FLOAT, 0) F(FLOAT, 1) F(NEW, 0)
+#define D310_FIELDS(F)	F(CONST8, 1) F(CONST8, 0xff) F(VIDENT, 0)
+
+#define TRK_DEC(kind, arg)	off = trk_dec_##kind(p, len, off, arg, t);
+#define TRK_ENC(kind, arg)	off = trk_enc_##kind(p, off, arg, t);
+
+#define TRK_CODEC(type)							\
+static int								\
+type##_trk_decode(const u_char *p, int len, struct gps_trk *t)		\
+{									\
+	int off = 1;							\
+									\
+	memset(t, 0, sizeof *t);					\
+	t->alt = t->depth = no_val.f;					\
+	t->time = -1;							\
+	type##_FIELDS(TRK_DEC)						\
+	return t->posn || t->ident.str ? 0 : -1;			\
+}									\
+static int								\
+type##_trk_encode(const struct gps_trk *t, u_char *p)			\
+{									\
+	int off = 1;							\
+									\
+	type##_FIELDS(TRK_ENC)						\
+	return off;							\
+}
+
+TRK_CODEC(D300)
+TRK_CODEC(D301)
+TRK_CODEC(D310)
+
+static const struct gps_trk_codec trk_codecs[] = {
+	{ D300, D300_trk_decode, D300_trk_encode },
+	{ D301, D301_trk_decode, D301_trk_encode },
+	{ D310, D310_trk_decode, D310_trk_encode }
+};
+
+/*
+ * Codec lookup by type, called when a packet type is set on a handle.
+ * Returns NULL for unknown types.
+ */
+const struct gps_wpt_codec *
+gps_wpt_codec(int type)
+{
+	size_t ix;
+
+	for (ix = 0; ix < sizeof wpt_codecs / sizeof wpt_codecs[0]; ix++)
+		if (wpt_codecs[ix].type == type)
+			return &wpt_codecs[ix];
+	return NULL;
+}
+
+const struct gps_rte_codec *
+gps_rte_codec(int type)
+{
+	size_t ix;
+
+	for (ix = 0; ix < sizeof rte_codecs / sizeof rte_codecs[0]; ix++)
+		if (rte_codecs[ix].type == type)
+			return &rte_codecs[ix];
+	return NULL;
+}
+
+const struct gps_trk_codec *
+gps_trk_codec(int type)
+{
+	size_t ix;
+
+	for (ix = 0; ix < sizeof trk_codecs / sizeof trk_codecs[0]; ix++)
+		if (trk_codecs[ix].type == type)
+			return &trk_codecs[ix];
+	return NULL;
+}
+
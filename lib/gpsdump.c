@@ -6,6 +6,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "gpslib.h"
 
@@ -18,6 +19,122 @@
  * dev2 -> dev1:	transfer end
  */
 
+/*
+ * A frame with a bad checksum is nak'd and the unit sends it again.
+ * Give up after this many bad frames in a row.
+ */
+#define XFR_NAKS	5
+
+/*
+ * Transfer progress.  A frame the unit sends again because it missed
+ * our ack is the same as the last frame taken.  So is the next of two
+ * identical records, such as points logged without a fix.  A frame
+ * that repeats the one before is held, along with every frame after
+ * it, until the end of the transfer when the record count given by
+ * transfer begin tells how many repeats were resent.  Those are
+ * dropped and the rest of the held frames passed on.
+ */
+struct xfr_state {
+	int	expected;		/* count from transfer begin */
+	int	records;		/* records passed on */
+	int	repeats;		/* held frames repeating the last */
+	int	dups;			/* records dropped as resent */
+	struct gps_list_head *held;	/* held frames, each after a
+					   repeat flag */
+	int	lastlen;		/* length of the last frame */
+	u_char	last[GPS_FRAME_MAX];	/* the last frame taken */
+};
+
+#define XFR_PASS	0		/* pass the frame on */
+#define XFR_HOLD	1		/* frame held */
+#define XFR_DROP	2		/* frame dropped */
+
+/*
+ * Take a frame of a counted transfer.  nakd is set when the previous
+ * frame was nak'd; what follows is then the frame the unit was asked
+ * to send again, never a resend of the one before.  Returns XFR_HOLD
+ * if the frame is held, XFR_DROP if it is a record past the count given
+ * by transfer begin, otherwise XFR_PASS.
+ */
+static int
+xfr_take(struct xfr_state *xs, const u_char *data, int len, int nakd)
+{
+	u_char rec[GPS_FRAME_MAX + 1];
+	int repeat;
+
+	if (*data == p_xfr_begin) {
+		xs->expected = len >= 3 ? data[1] + (data[2] << 8) : -1;
+		xs->records = 0;
+		xs->dups = 0;
+	} else if (xs->expected != -1 && *data != p_xfr_end) {
+		repeat = ! nakd && len == xs->lastlen &&
+			memcmp(data, xs->last, len) == 0;
+		if (repeat || xs->held->count) {
+			rec[0] = (u_char) repeat;
+			memcpy(&rec[1], data, len);
+			gps_list_append(xs->held, rec, len + 1);
+			xs->repeats += repeat;
+			xs->lastlen = len;
+			memcpy(xs->last, data, len);
+			return XFR_HOLD;
+		}
+		if (xs->records == xs->expected) {
+			xs->dups += 1;
+			return XFR_DROP;
+		}
+		xs->records += 1;
+	}
+	xs->lastlen = len;
+	memcpy(xs->last, data, len);
+	return XFR_PASS;
+}
+
+/*
+ * Pass on the held frames less the repeats that take the transfer past
+ * its count and any records still past the count.  Returns the value of
+ * the packet handler if it asked to stop, otherwise 0.
+ */
+static int
+xfr_release(gps_handle gps, enum gps_cmd_id cmd, struct xfr_state *xs,
+	    gps_packet_fn fn, void *arg)
+{
+	int excess = xs->records + xs->held->count - xs->expected;
+	int stat = 0;
+	const u_char *rec;
+	int ix;
+
+	if (excess > xs->repeats)
+		excess = xs->repeats;
+	for (ix = 0; ix < xs->held->count && stat <= 0; ix++) {
+		rec = GPS_LIST_REC(xs->held, ix);
+		if (rec[0] && excess > 0) {
+			excess -= 1;
+			xs->dups += 1;
+			continue;
+		}
+		if (xs->records == xs->expected) {
+			xs->dups += 1;
+			continue;
+		}
+		xs->records += 1;
+		stat = fn(gps, cmd, rec + 1, GPS_LIST_LEN(xs->held, ix) - 1,
+			  arg);
+	}
+	xs->held->count = 0;
+	xs->repeats = 0;
+	return stat > 0 ? stat : 0;
+}
+
+/*
+ * Packet handler used when gps_cmd is called: print the packet.
+ */
+static int
+print_packet(gps_handle gps, enum gps_cmd_id cmd, const u_char *packet,
+	     int len, void *arg)
+{
+	return gps_print(gps, cmd, packet, len);
+}
+
 /*
  * Issue a device command and wait for an ack.  Returns
  *	-1:	command failed
@@ -27,14 +144,33 @@
 int
 gps_cmd(gps_handle gps, enum gps_cmd_id cmd)
 {
+	/* drop any partial image left by an earlier screenshot */
+	if (cmd == CMD_SCREEN && gps_get_screen(gps) != NULL)
+		gps_screen_reset(gps_get_screen(gps));
+	return gps_cmd_xfer(gps, cmd, print_packet, NULL);
+}
+
+/*
+ * The work of gps_cmd_xfer
+ */
+static int
+cmd_xfer(gps_handle gps, enum gps_cmd_id cmd, gps_packet_fn fn, void *arg)
+{
+	struct xfr_state *xs = gps_malloc(sizeof *xs);
 	u_char cmd_frame[4];
 	int retries = 5;
-	u_char *data = malloc(GPS_FRAME_MAX);
+	int naks = 0;
+	int stat;
+	int take;
+	u_char *data = gps_malloc(GPS_FRAME_MAX);
 
-	if (data == NULL) {
+	if (data == NULL || xs == NULL) {
+		gps_free(xs);
+		gps_free(data);
 		gps_printf(gps, 0, "%s: no memory\n", __func__);
 		return -1;
 	}
+	xs->held = gps_list_new(0);
 
 	cmd_frame[0] = p_cmd_type;
 	cmd_frame[1] = (u_char) cmd;
@@ -50,24 +186,101 @@ gps_cmd(gps_handle gps, enum gps_cmd_id cmd)
 
 			int datalen = GPS_FRAME_MAX;
 			retries = 0;
+			gps_set_xfer(gps, GPS_XFER_DOWN);
+			xs->expected = -1;
+			xs->records = 0;
+			xs->repeats = 0;
+			xs->dups = 0;
+			xs->lastlen = 0;
 
-			/* read until failure or end of transfer packet */
+			/* read until timeout, end of transfer packet, or
+			   too many bad frames */
 
-			while (gps_recv(gps, 2, data, &datalen) == 1) {
+			while ((stat = gps_recv(gps, 2, data, &datalen)) != 0) {
+				if (stat == -1) {
+					if (++naks > XFR_NAKS ||
+					    gps_cancelled(gps))
+						break;
+					gps_printf(gps, 2, "%s: bad frame, "
+						   "nak\n", __func__);
+					gps_send_nak(gps, *data);
+					datalen = GPS_FRAME_MAX;
+					continue;
+				}
 				gps_send_ack(gps, *data);
-				gps_print(gps, cmd, data, datalen);
-				if (*data == p_xfr_end || *data == p_utc_data) {
+				take = xfr_take(xs, data, datalen, naks != 0);
+				naks = 0;
+				if (take != XFR_PASS) {
+					gps_printf(gps, 2, "%s: record %d %s\n",
+						   __func__, xs->records +
+						   xs->held->count,
+						   take == XFR_HOLD ? "held" :
+						   "past the count, dropped");
+					datalen = GPS_FRAME_MAX;
+					continue;
+				}
+				if (*data == p_xfr_end &&
+				    xfr_release(gps, cmd, xs, fn, arg) > 0)
+					break;
+				if (fn(gps, cmd, data, datalen, arg) > 0 ||
+				    *data == p_xfr_end || *data == p_utc_data) {
 					break;
 				}
 				datalen = GPS_FRAME_MAX;
 			}
+			/* a transfer cut short passes on what it held */
+			if (xs->held->count)
+				xfr_release(gps, cmd, xs, fn, arg);
+			if (xs->expected != -1 &&
+			    xs->records != xs->expected)
+				gps_printf(gps, 1, "%s: %d of %d records "
+					   "received\n", __func__,
+					   xs->records, xs->expected);
+			else if (xs->dups)
+				gps_printf(gps, 2, "%s: %d resent records "
+					   "dropped\n", __func__, xs->dups);
 
-			free(data);
-			return 1;
+			/* a transfer cut off by bad frames or a cancel is
+			   aborted so the unit stops sending */
+			if (stat == -1)
+				gps_abort(gps);
+			else
+				gps_set_xfer(gps, GPS_XFER_NONE);
+			gps_list_free(xs->held);
+			gps_free(xs);
+			gps_free(data);
+			return gps_cancelled(gps) ? -1 : 1;
 		}
+		if (gps_cancelled(gps))
+			break;
 		gps_printf(gps, 3, "%s: retry\n", __func__);
 	}
-	gps_printf(gps, 1, "%s: failed", __func__);
-	free(data);
+	gps_printf(gps, 1, "%s: failed\n", __func__);
+	gps_list_free(xs->held);
+	gps_free(xs);
+	gps_free(data);
 	return -1;
 }
+
+/*
+ * Issue a device command and pass each packet of the resulting transfer
+ * to the given packet handler along with arg.  The transfer ends with
+ * an end of transfer packet, a timeout, or when the handler returns a
+ * value greater than zero.  Bad frames are nak'd and the transfer
+ * continues with the unit's retransmission.  Records the unit sent
+ * again are passed to the handler once; after a repeated record the
+ * rest of the transfer is passed on when it ends.  Return values are
+ * the same as gps_cmd; a cancelled handle returns -1.
+ */
+int
+gps_cmd_xfer(gps_handle gps, enum gps_cmd_id cmd, gps_packet_fn fn, void *arg)
+{
+	int phase = gps_mem_phase(GPS_MEM_DOWNLOAD);
+	int stat;
+	GPS_PROF_BEGIN(prof, GPS_PROF_CMD);
+
+	stat = cmd_xfer(gps, cmd, fn, arg);
+	GPS_PROF_END(prof);
+	gps_mem_phase(phase);
+	return stat;
+}
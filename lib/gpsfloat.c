@@ -113,6 +113,15 @@ gps_put_float(u_char *s, float f)
 	return sizeof f;
 }
 
+double
+gps_get_double(const u_char * s)
+{
+	double d;
+
+	memcpy(&d, s, sizeof(d));
+	return d;
+}
+
 #elif BYTE_ORDER == BIG_ENDIAN
 
 /*
@@ -147,6 +156,19 @@ gps_put_float(u_char *s, float f)
 	return sizeof f;
 }
 
+double
+gps_get_double(const u_char * s)
+{
+	double d;
+	u_char t[sizeof d];
+	int ix;
+
+	for (ix = 0; ix < (int) sizeof d; ix++)
+		t[ix] = s[sizeof d - 1 - ix];
+	memcpy(&d, t, sizeof d);
+	return d;
+}
+
 #else
 # error "unknown float conversion"
 #endif
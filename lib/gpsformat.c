@@ -3,17 +3,20 @@
  */
 
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <assert.h>
 #include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "gpslib.h"
 
-#define GPS_STRING_MAX	51
-
 /*
  * decode states
  */
@@ -25,887 +28,547 @@ enum {
 };
 
 /*
- * Figure out the operating state from the data in the buffer arg.
+ * The input is mapped (or read) into memory and parsed in place.  A
+ * line is the bytes from p up to but not including end.  Lines are not
+ * null terminated and have no length limit.
  */
-static int
-scan_state(u_char *buf)
+
+#define MANT_DIGITS	19		/* decimal digits that fit in 64 bits */
+#define DIGIT(c)	((u_int) ((c) - '0') < 10)
+
+static const double pow10d[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static const float pow10f[] = {
+	1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+};
+
+static const char *
+skip_space(const char *p, const char *end)
 {
-	int state = START;
-	if (*buf == '[') {
-		if (strncmp((char *) buf, RTE_HDR, sizeof RTE_HDR - 1) == 0)
-			state = ROUTES;
-		else if (strncmp((char *) buf, TRK_HDR, sizeof TRK_HDR - 1) == 0)
-			state = TRACKS;
-		else if (strncmp((char *) buf, WPT_HDR, sizeof WPT_HDR - 1) == 0)
-			state = WAYPOINTS;
-	}
-	return state;
+	while (p < end && isspace((u_char) *p))
+		p += 1;
+	return p;
 }
 
-static u_char *
-gps_buffer_new(void)
+/*
+ * Compare the line to a null terminated prefix
+ */
+static int
+prefix(const char *p, const char *end, const char *str)
 {
-	u_char *data;
+	size_t len = strlen(str);
 
-	data = malloc(GPS_FRAME_MAX);
-	assert(data != NULL);
-	return data;
+	return (size_t) (end - p) >= len && memcmp(p, str, len) == 0;
 }
 
 /*
- * convert len bytes of buf in hex representation to binary
+ * Copy at most GPS_STRING_MAX - 1 bytes of a field to a null terminated
+ * buffer of GPS_STRING_MAX + 1 bytes.
  */
 static void
-gps_get_info(u_char *info, char *buf, int len)
+copy_field(u_char *buf, const char *p, const char *end)
 {
-	int ix;
-	int val;
+	size_t len = end > p ? end - p : 0;
 
-	for (ix = 0; ix < len; ix += 2) {
-		sscanf(&buf[ix], "%2x", &val);
-		info[ix / 2] = (u_char) val;
-	}
+	if (len > GPS_STRING_MAX - 1)
+		len = GPS_STRING_MAX - 1;
+	memcpy(buf, p, len);
+	buf[len] = 0;
 }
 
-/*
- * convert the given double to a garmin `semicircle' and stuff
- * it in to b (assumed to be at least 4 characters wide) in
- * the garmin (little endian) order.
- */
-static void
-double2semicircle(double f, u_char *b)
+static const char *
+token_end(const char *p, const char *end)
 {
-	long work = f * 0x80000000U / 180.0;
-	b[0] = (u_char) work;
-	b[1] = (u_char) (work >> 8);
-	b[2] = (u_char) (work >> 16);
-	b[3] = (u_char) (work >> 24);
+	while (p < end && ! isspace((u_char) *p))
+		p += 1;
+	return p;
 }
 
 /*
- * Append data to a buffer. The rules are:
- *	1) newline is converted to null
- *	2) If data len less than buffer len null terminate.
- *	3) pad remainder of buffer with spaces
- * Returns pointer to buffer after data has been added.
+ * Scan a decimal number of the form [sign] digits [. digits] [e exp]
+ * after skipping white space.  The significant digits are returned in
+ * *mant and the power of ten that scales them in *exp.  Returns the
+ * end of the number, *beg if there is no number, or NULL if the
+ * number is not exactly representable this way, e.g. too many digits,
+ * in which case *beg and *tend bound the text to give to libc.
  */
-static u_char *
-add_string(u_char *buf, u_char *data, int len)
-{
-	while ( len-- ) {
-		if (*data == '\n')
-			*data = 0;
-		if (*data)
-			*buf++ = *data++;
-		else {
-			*buf++ = 0;
-			if (len) {
-				memset(buf, ' ', (size_t) len);
-				buf += len;
-				len = 0;
-			}
+static const char *
+scan_number(const char *p, const char *end, int *neg, u_int64_t *mant,
+	    int *exp, const char **beg, const char **tend)
+{
+	const char *q;
+	int digits = 0;
+	int exact = 1;
+	int any = 0;
+	int e;
+	int eneg;
+
+	p = skip_space(p, end);
+	*beg = p;
+	*neg = 0;
+	*mant = 0;
+	*exp = 0;
+	if (p < end && (*p == '-' || *p == '+'))
+		*neg = *p++ == '-';
+	if (end - p > 1 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+		/* hex float */
+		*tend = token_end(p, end);
+		return NULL;
+	}
+	for (; p < end && DIGIT(*p); p++, any = 1) {
+		if (digits < MANT_DIGITS) {
+			*mant = *mant * 10 + (*p - '0');
+			if (*mant != 0)
+				digits += 1;
+		} else if (*p != '0')
+			exact = 0;
+		else
+			*exp += 1;
+	}
+	if (p < end && *p == '.') {
+		for (p++; p < end && DIGIT(*p); p++, any = 1) {
+			if (digits < MANT_DIGITS) {
+				*mant = *mant * 10 + (*p - '0');
+				*exp -= 1;
+				if (*mant != 0)
+					digits += 1;
+			} else if (*p != '0')
+				exact = 0;
 		}
 	}
-	return buf;
+	if (! any) {
+		/* inf, nan and such */
+		*tend = token_end(p, end);
+		return *tend > *beg ? NULL : *beg;
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		q = p + 1;
+		eneg = 0;
+		if (q < end && (*q == '-' || *q == '+'))
+			eneg = *q++ == '-';
+		if (q < end && DIGIT(*q)) {
+			for (e = 0; q < end && DIGIT(*q); q++)
+				if (e < 100000)
+					e = e * 10 + (*q - '0');
+			*exp += eneg ? -e : e;
+			p = q;
+		}
+	}
+	*tend = p;
+	return exact ? p : NULL;
 }
 
-
 /*
- * Build a list entry that contains the given data buffer.
+ * Convert the text from beg to end with strtod (or strtof when f is
+ * not NULL).  Returns the end of the converted text, beg if nothing
+ * was converted.
  */
-static struct gps_list_entry *
-build_list_entry(u_char *data, int data_len)
+static const char *
+libc_number(const char *beg, const char *end, double *d, float *f)
 {
-	struct gps_list_entry *entry = malloc(sizeof(struct gps_list_entry));
-	assert(entry != NULL);
-
-	entry->next = 0;
-	entry->data = data;
-	entry->data_len = data_len;
-	return entry;
+	char tmp[64];
+	char *buf = tmp;
+	char *cend;
+	size_t len = end - beg;
+
+	if (len >= sizeof tmp) {
+		buf = gps_malloc(len + 1);
+		if (buf == NULL)
+			return beg;
+	}
+	memcpy(buf, beg, len);
+	buf[len] = 0;
+	if (f != NULL) {
+		float v = strtof(buf, &cend);
+		if (cend != buf)
+			*f = v;
+	} else {
+		double v = strtod(buf, &cend);
+		if (cend != buf)
+			*d = v;
+	}
+	len = cend - buf;
+	if (buf != tmp)
+		gps_free(buf);
+	return beg + len;
 }
 
 /*
- * build the data common to most waypoints, returning a pointer to
- * the data buffer and an updated lenght
+ * Scan a double as sscanf("%lf") would.  When the digits and the power
+ * of ten are both exact doubles a single multiply or divide gives the
+ * correctly rounded result (Clinger's fast path).  Everything else
+ * goes to strtod.  Returns the end of the number or p if there is none
+ * in which case *val is unchanged.
  */
-static u_char *
-wpt_common(int *datalen, int state, u_char *name, double lat, double lon,
-	   u_char *cmnt)
-{
-	u_char *data;
-	int len;
-	int ix;
-
-	data = gps_buffer_new();
-	len = 0;
-
-	/* byte 0: data_type */
-	data[len++] = state == WAYPOINTS ? p_wpt_data : p_rte_wpt_data;
-
-	/* byte 1-6: waypoint name */
-	for (ix = 0; ix < 6; ix += 1) {
-		data[len++] = toupper((unsigned char)name[ix]);
-	}
-
-	/* byte 7-10: latitude */
-	double2semicircle(lat, &data[len]);
-	len += 4;
-
-	/* byte 11-14: longitute */
-	double2semicircle(lon, &data[len]);
-	len += 4;
-
-	/* byte 15-18: zero */
-	data[len++] = 0;
-	data[len++] = 0;
-	data[len++] = 0;
-	data[len++] = 0;
-
-	/* byte 19-58: comment */
-	add_string(&data[len], cmnt, 40);
-	len += 40;
-
-	*datalen = len;
-	return data;
-}
-
-static struct gps_list_entry *
-d100_wpt(int state, u_char *name, double lat, double lon, u_char *cmnt)
+static const char *
+scan_double(const char *p, const char *end, double *val)
 {
-	u_char *data;
-	int len;
-
-	data = wpt_common(&len, state, name, lat, lon, cmnt);
-	return build_list_entry(data, len);
+	const char *beg;
+	const char *tend;
+	const char *q;
+	u_int64_t mant;
+	double d;
+	int exp;
+	int neg;
+
+	q = scan_number(p, end, &neg, &mant, &exp, &beg, &tend);
+	if (q == beg)
+		return p;
+	if (q != NULL && mant <= ((u_int64_t) 1 << 53) &&
+	    exp >= -22 && exp <= 22) {
+		d = (double) mant;
+		d = exp < 0 ? d / pow10d[-exp] : d * pow10d[exp];
+		*val = neg ? -d : d;
+	} else if ((tend = libc_number(beg, tend, val, NULL)) == beg)
+		return p;
+	return tend;
 }
 
-static struct gps_list_entry *
-d101_wpt(int state, u_char *name, double lat, double lon, u_char *cmnt, int sym)
-{
-	u_char *data;
-	int len;
-
-	data = wpt_common(&len, state, name, lat, lon, cmnt);
-
-	/* byte 59-62: proximity (float) -- set to zero */
-	data[len++] = 0;
-	data[len++] = 0;
-	data[len++] = 0;
-	data[len++] = 0;
-	
-	/* byte 63: symbol */
-	data[len++] = (u_char) sym;
-
-	return build_list_entry(data, len);
-}
-
-static struct gps_list_entry *
-d102_wpt(int state, u_char *name, double lat, double lon, u_char *cmnt, int sym)
-{
-	u_char *data;
-	int len;
-
-	data = wpt_common(&len, state, name, lat, lon, cmnt);
-
-	/* byte 59-62: proximity (float) -- set to zero */
-	data[len++] = 0;
-	data[len++] = 0;
-	data[len++] = 0;
-	data[len++] = 0;
-	
-	/* byte 63-64: symbol */
-	data[len++] = (u_char) sym;
-	data[len++] = (u_char) (sym >> 8);
-
-	return build_list_entry(data, len);
-}
-
-static struct gps_list_entry *
-d103_wpt(int state, u_char *name, double lat, double lon, u_char *cmnt, int sym,
-	 int disp)
-{
-	u_char *data;
-	int len;
-
-	data = wpt_common(&len, state, name, lat, lon, cmnt);
-
-	/* byte 59: symbol */
-	data[len++] = (u_char) sym;
-
-	/* byte 60: display */
-	data[len++] = (u_char) disp;
-
-	return build_list_entry(data, len);
-}
-
-static struct gps_list_entry *
-d104_wpt(int state, u_char *name, double lat, double lon, u_char *cmnt, int sym,
-	 int disp)
+/*
+ * Scan a float as sscanf("%f") would.  Same as above with the limits
+ * of a float.
+ */
+static const char *
+scan_float(const char *p, const char *end, float *val)
 {
-	u_char *data;
-	int len;
-
-	data = wpt_common(&len, state, name, lat, lon, cmnt);
-
-	/* byte 59-60: symbol */
-	data[len++] = (u_char) sym;
-	data[len++] = (u_char) (sym >> 8);
-
-	/* byte 61: display */
-	data[len++] = (u_char) disp;
-
-	return build_list_entry(data, len);
+	const char *beg;
+	const char *tend;
+	const char *q;
+	u_int64_t mant;
+	float f;
+	int exp;
+	int neg;
+
+	q = scan_number(p, end, &neg, &mant, &exp, &beg, &tend);
+	if (q == beg)
+		return p;
+	if (q != NULL && mant <= ((u_int64_t) 1 << 24) &&
+	    exp >= -10 && exp <= 10) {
+		f = (float) mant;
+		f = exp < 0 ? f / pow10f[-exp] : f * pow10f[exp];
+		*val = neg ? -f : f;
+	} else if ((tend = libc_number(beg, tend, NULL, val)) == beg)
+		return p;
+	return tend;
 }
 
-static struct gps_list_entry *
-d105_wpt(int state, double lat, double lon, u_char *cmnt, int sym)
-{
-	u_char *data;
-	int len;
-
-	data = gps_buffer_new();
-	len = 0;
-
-	/* byte 0: data_type */
-	data[len++] = state == WAYPOINTS ? p_wpt_data : p_rte_wpt_data;
-
-	/* byte 1-4: latitude */
-	double2semicircle(lat, &data[len]);
-	len += 4;
-
-	/* byte 5-8: longitude */
-	double2semicircle(lon, &data[len]);
-	len += 4;
-
-	/* byte 9-10: symbol */
-	data[len++] = (u_char) sym;
-	data[len++] = (u_char) (sym >> 8);
-
-	/* byte 11-50: ident (saved as comment by print code) */
-	add_string(&data[len], cmnt, 40);
-	len += 40;
-
-	return build_list_entry(data, len);
-}
-
-static struct gps_list_entry *
-d106_wpt(int state, double lat, double lon, u_char *cmnt, int sym)
+/*
+ * Scan a decimal integer as sscanf("%d") would
+ */
+static const char *
+scan_int(const char *p, const char *end, int *val)
 {
-	u_char *data;
-	int len;
-
-	data = gps_buffer_new();
-	len = 0;
-
-	/* byte 0: data type */
-	data[len++] = state == WAYPOINTS ? p_wpt_data : p_rte_wpt_data;
-
-	/* byte 1-14: class/subclass.  0 == user waypoint */
-	memset(&data[len], 0, 14);
-	len += 14;
-
-	/* byte 15-18: latitude */
-	double2semicircle(lat, &data[len]);
-	len += 4;
-
-	/* byte 19-22: longitude */
-	double2semicircle(lat, &data[len]);
-	len += 4;
-
-	/* byte 23-24: symbol */
-	data[len++] = (u_char) sym;
-	data[len++] = (u_char) (sym >> 8);
-
-	/* byte 25-64: ident (saved as comment by print code) */
-	add_string(&data[len], cmnt, 40);
-	len += 40;
-
-	return build_list_entry(data, len);
+	const char *q;
+	int neg = 0;
+	int v = 0;
+
+	q = skip_space(p, end);
+	if (q < end && (*q == '-' || *q == '+'))
+		neg = *q++ == '-';
+	if (q == end || ! DIGIT(*q))
+		return p;
+	for (; q < end && DIGIT(*q); q++)
+		if (v <= (INT_MAX - 9) / 10)
+			v = v * 10 + (*q - '0');
+	*val = neg ? -v : v;
+	return q;
 }
 
-static struct gps_list_entry *
-d107_wpt(int state, u_char *name, double lat, double lon, u_char *cmnt, int sym,
-	 int disp)
+static int
+hex_digit(int c)
 {
-	u_char *data;
-	int len;
-
-	data = wpt_common(&len, state, name, lat, lon, cmnt);
-
-	/* byte 59: symbol */
-	data[len++] = (u_char) sym;
-
-	/* byte 60: display */
-	data[len++] = (u_char) disp;
-
-	/* byte 61-64: proximity */
-	data[len++] = 0;
-	data[len++] = 0;
-	data[len++] = 0;
-	data[len++] = 0;
-
-	/* byte 65: color (0 == default) */
-	data[len++] = 0;
-
-	return build_list_entry(data, len);
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c = tolower(c);
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
 }
 
-static struct gps_list_entry *
-d108_wpt(int state, u_char *name, double lat, double lon, float alt, 
-		u_char *cmnt, int sym, int disp, u_char *info)
+/*
+ * convert the hex representation from p to end to binary.  Conversion
+ * stops at the first pair that isn't hex or when len bytes are stored.
+ */
+static void
+gps_get_info(u_char *info, int len, const char *p, const char *end)
 {
-	u_char *data;
-	int len;
-	int tlen;
-
-	data = gps_buffer_new();
-	len = 0;
-
-	/* byte 0: data type */
-	data[len++] = state == WAYPOINTS ? p_wpt_data : p_rte_wpt_data;
-
-	/* byte 1: waypoint class (0 == user) */
-	data[len++] = info[0];
-
-	/* byte 2: waypoint color (0xff == default) */
-	data[len++] = (u_char) 0xff;
-
-	/* byte 3: display */
-	data[len++] = (u_char) disp;
+	int hi;
+	int lo;
 
-	/* byte 4: attributes (0x60 per garmin doc) */
-	data[len++] = (u_char) 0x60;
-
-	/* byte 5-6: symbol */
-	data[len++] = (u_char) sym;
-	data[len++] = (u_char) (sym >> 8);
-	
-	/* byte 7-24: subclass (value per garmin doc) */
-	if (info[0] != 0) {
-		memcpy(&data[len], &info[1], 18);
-		len += 18;
-	} else {
-		memset(&data[len], 0, 6);
-		len += 6;
-		memset(&data[len], 0xff, 12);
-		len += 12;
+	for (; len > 0 && end - p >= 2; p += 2, len--) {
+		if ((hi = hex_digit((u_char) p[0])) == -1 ||
+		    (lo = hex_digit((u_char) p[1])) == -1)
+			break;
+		*info++ = (u_char) (hi << 4 | lo);
 	}
-
-	/* byte 25-28: latitude */
-	double2semicircle(lat, &data[len]);
-	len += 4;
-
-	/* byte 29-32: longitude */
-	double2semicircle(lon, &data[len]);
-	len += 4;
-
-	/* byte 33-36: alt */
-	len += gps_put_float(&data[len], alt);
-
-	/* byte 37-40: depth */
-	len += gps_put_float(&data[len], no_val.f);
-
-	/* byte 41-44: proximity */
-	len += gps_put_float(&data[len], no_val.f);
-
-	/* byte 45-48: state and country codes: set to the empty string */
-	data[len++] = ' ';
-	data[len++] = ' ';
-	data[len++] = ' ';
-	data[len++] = ' ';
-
-	/* byte 49-99: ident (max 51 characters) */
-	tlen = strlcpy((char *) &data[len], (char *) name, GPS_STRING_MAX);
-	if (++tlen > GPS_STRING_MAX)
-		tlen = GPS_STRING_MAX;
-	len += tlen;
-
-	/* comment follows name (max 51 characters) */
-	tlen = strlcpy((char *) &data[len], (char *) cmnt, GPS_STRING_MAX);
-	if (++tlen > GPS_STRING_MAX)
-		tlen = GPS_STRING_MAX;
-	len += tlen;
-
-	data[len++] = 0;	/* facility */
-	data[len++] = 0;	/* city */
-	data[len++] = 0;	/* address */
-	data[len++] = 0;	/* cross road */
-
-	return build_list_entry(data, len);
 }
 
-static struct gps_list_entry *
-d109_wpt(int state, u_char *name, double lat, double lon, float alt,
-		u_char *cmnt, int sym, int disp, u_char *info)
+/*
+ * Figure out the operating state from the line
+ */
+static int
+scan_state(const char *p, const char *end)
 {
-	u_char *data;
-	int len;
-	int tlen;
-
-	data = gps_buffer_new();
-	len = 0;
-
-	/* byte 0: data type */
-	data[len++] = state == WAYPOINTS ? p_wpt_data : p_rte_wpt_data;
-
-	/* byte 1: data packet type (1 from the garmin doc) */
-	data[len++] = 1;
-
-	/* byte 2: waypoint class */
-	data[len++] = info[0];
-
-	/* byte 3: display and color (1f == default color */
-	data[len++] = ((disp << 5) & 0x60) | 0x1f;
-
-	/* byte 4: attributes (0x70 per garmin doc) */
-	data[len++] = (u_char) 0x70;
-
-	/* byte 5-6: symbol */
-	data[len++] = (u_char) sym;
-	data[len++] = (u_char) (sym >> 8);
-	
-	/* byte 7-24: subclass (assumes value same as D108) */
-	if (info[0] != 0) {
-		memcpy(&data[len], &info[1], 18);
-		len += 18;
-	} else {
-		memset(&data[len], 0, 6);
-		len += 6;
-		memset(&data[len], 0xff, 12);
-		len += 12;
+	int state = START;
+	if (p < end && *p == '[') {
+		if (prefix(p, end, RTE_HDR))
+			state = ROUTES;
+		else if (prefix(p, end, TRK_HDR))
+			state = TRACKS;
+		else if (prefix(p, end, WPT_HDR))
+			state = WAYPOINTS;
 	}
-
-	/* byte 25-28: latitude */
-	double2semicircle(lat, &data[len]);
-	len += 4;
-
-	/* byte 29-32: longitude */
-	double2semicircle(lon, &data[len]);
-	len += 4;
-
-	/* byte 33-36: alt */
-	len += gps_put_float(&data[len], alt);
-
-	/* byte 37-40: depth */
-	len += gps_put_float(&data[len], no_val.f);
-
-	/* byte 41-44: proximity */
-	len += gps_put_float(&data[len], no_val.f);
-
-	/* byte 45-48: state and country codes: set to the empty string */
-	data[len++] = ' ';
-	data[len++] = ' ';
-	data[len++] = ' ';
-	data[len++] = ' ';
-
-	/* byte 49-52: link ete, default = 0xffffffff */
-	data[len++] = (u_char) 0xff;
-	data[len++] = (u_char) 0xff;
-	data[len++] = (u_char) 0xff;
-	data[len++] = (u_char) 0xff;
-
-	/* byte 53-103: ident (max GPS_STRING_MAX characters) */
-	tlen = strlcpy((char *) &data[len], (char *) name, GPS_STRING_MAX);
-	if (++tlen > GPS_STRING_MAX)
-		tlen = GPS_STRING_MAX;
-	len += tlen;
-
-	/* comment follows name (max 51 characters) */
-	tlen = strlcpy((char *) &data[len], (char *) cmnt, GPS_STRING_MAX);
-	if (++tlen > GPS_STRING_MAX)
-		tlen = GPS_STRING_MAX;
-	len += tlen;
-
-
-	/* Add null bytes for the empty fields comment, facility, city
-	   address, and cross road */
-	data[len++] = 0;	/* facility */
-	data[len++] = 0;	/* city */
-	data[len++] = 0;	/* address */
-	data[len++] = 0;	/* cross road */
-
-	return build_list_entry(data, len);
+	return state;
 }
 
 /*
- * decode the buffer as a waypoint and format according to the required
+ * decode the line as a waypoint and format according to the required
  * waypoint type.   Data is expected to be in this format
  *
  *  lat long [A:altitude] [S:symbol] [D:display] [I:ident] [C:comment] [L:link]
+ *
+ * A value runs up to the blank before the next key.
  */
-static struct gps_list_entry *
-waypoints(gps_handle gps, u_char *buf, int state, int *link)
+static int
+waypoints(gps_handle gps, const char *buf, const char *end, int state,
+	  int *link, u_char *pkt)
 {
-	struct gps_list_entry *entry = 0;
-	double lat;			/* latitude */
-	double lon;			/* longitude */
+	const struct gps_wpt_codec *wc;
+	struct gps_wpt w;
 	int sym;			/* symbol */
 	int disp;			/* symbol display mode */
-	float alt;			/* altitude */
 	u_char name[GPS_STRING_MAX + 1]; /* waypoint name */
 	u_char cmnt[GPS_STRING_MAX + 1]; /* comment */
 	u_char data[GPS_STRING_MAX + 1]; /* waypoint class and subclass */
 
-	char *beg;
-	char *end;
-	int len;
-	int wpt;
+	const char *key;
+	const char *next;
+	const char *val;
+	const char *vend;
 
+	memset(&w, 0, sizeof w);
 	*link = -1;
 	sym = disp = 0;
-	alt = no_val.f;
+	w.alt = no_val.f;
 	name[0] = 0;
 	cmnt[0] = 0;
-	data[0] = 0;
+	memset(data, 0, sizeof data);
 
 	/* Latitude and longitude */
-	sscanf((char *) buf, "%lf %lf", &lat, &lon);
+	val = scan_double(buf, end, &w.lat);
+	if (val != buf)
+		scan_double(val, end, &w.lon);
 
 	/* key:value pairs */
-	for (beg = strchr((char *) buf, ':'); beg; beg = end) {
-		end = strchr(beg + 1, ':');
-		/* len includes space for null */
-		if (end == NULL)
-			len = strlen(beg + 1) + 1;
-		else
-			len = end - beg - 2;
-		if (len > GPS_STRING_MAX)
-			len = GPS_STRING_MAX;
-		switch (toupper((unsigned char)(beg[-1]))) {
+	for (key = memchr(buf, ':', end - buf); key; key = next) {
+		val = key + 1;
+		next = memchr(val, ':', end - val);
+		vend = next ? next - 2 : end;
+		switch (key > buf ? toupper((u_char) key[-1]) : 0) {
 		case 'A':
-			sscanf(&beg[1], "%f", &alt);
+			scan_float(val, end, &w.alt);
 			break;
 		case 'W':
 			/* waypoint data (class and subclass) */
-			gps_get_info(data, &beg[1], len);
+			gps_get_info(data, sizeof data, val, vend);
 			break;
 		case 'S':
 			/* symbol */
-			sscanf(&beg[1], "%d", &sym);
+			scan_int(val, end, &sym);
 			break;
 		case 'D':
 			/* display mode */
-			sscanf(&beg[1], "%d", &disp);
+			scan_int(val, end, &disp);
 			break;
 		case 'I':
-			strlcpy((char *) name, &beg[1], len);
+			copy_field(name, val, vend);
 			break;
 		case 'C':
-			strlcpy((char *) cmnt, &beg[1], len);
+			copy_field(cmnt, val, vend);
 			break;
 		case 'L':
 			/* route link code */
-			sscanf(&beg[1], "%d", link);
+			scan_int(val, end, link);
 			break;
 		default:
-			gps_printf(gps, 1, "%s: unknown field ->%s\n",
-				   __func__, &beg[-1]);
+			val = key > buf ? key - 1 : key;
+			gps_printf(gps, 1, "%s: unknown field ->%.*s\n",
+				   __func__, (int) (end - val), val);
 			continue;
 		}
 	}
 
-	gps_printf(gps, 3, "wpt %f %f %f %d %d %s %s %d\n", lat, lon, alt, sym,
-		   disp, name, cmnt, *link);
-
-	/* Now figure out which waypoint format is being used and
-	   call the appropriate routine */
-	switch (state) {
-	case WAYPOINTS:
-		wpt = gps_get_wpt_type(gps);
-		break;
-	case ROUTES:
-		wpt = gps_get_rte_wpt_type(gps);
-		break;
-	default:
-		wpt = 0;
-	}
-	switch (wpt) {
-	case D100:
-		entry = d100_wpt(state, name, lat, lon, cmnt);
-		break;
-	case D101:
-		entry = d101_wpt(state, name, lat, lon, cmnt, sym);
-		break;
-	case D102:
-		entry = d102_wpt(state, name, lat, lon, cmnt, sym);
-		break;
-	case D103:
-		entry = d103_wpt(state, name, lat, lon, cmnt, sym, disp);
-		break;
-	case D104:
-		entry = d104_wpt(state, name, lat, lon, cmnt, sym, disp);
-		break;
-	case D105:
-		entry = d105_wpt(state, lat, lon, cmnt, sym);
-		break;
-	case D106:
-		entry = d106_wpt(state, lat, lon, cmnt, sym);
-		break;
-	case D107:
-		entry = d107_wpt(state, name, lat, lon, cmnt, sym, disp);
-		break;
-	case D108:
-		entry = d108_wpt(state, name, lat, lon, alt, cmnt, sym, disp, data);
-		break;
-	case D109:
-		entry = d109_wpt(state, name, lat, lon, alt, cmnt, sym, disp, data);
-		break;
-	default:
-		gps_printf(gps, 1, "unknown waypoint type %d\n", wpt);
-		break;
+	gps_printf(gps, 3, "wpt %f %f %f %d %d %s %s %d\n", w.lat, w.lon,
+		   w.alt, sym, disp, name, cmnt, *link);
+
+	w.sym = sym;
+	w.dsp = disp;
+	w.class = data[0];
+	w.subclass = &data[1];
+	w.subclass_len = sizeof data - 1;
+	w.ident.str = (char *) name;
+	w.ident.len = (int) strlen(w.ident.str);
+	w.cmnt.str = (char *) cmnt;
+	w.cmnt.len = (int) strlen(w.cmnt.str);
+
+	/* Now encode using the waypoint format of the unit */
+	if (state == WAYPOINTS)
+		wc = gps_get_wpt_codec(gps);
+	else
+		wc = gps_get_rte_wpt_codec(gps);
+	if (wc == NULL) {
+		gps_printf(gps, 1, "unknown waypoint type %d\n",
+			   state == WAYPOINTS ? gps_get_wpt_type(gps) :
+			   gps_get_rte_wpt_type(gps));
+		return 0;
 	}
-	return entry;
-}
-
-static struct gps_list_entry *
-d200_route(int num)
-{
-	u_char *data;
-	int len;
-
-	data = gps_buffer_new();
-	len = 0;
-
-	data[len++] = p_rte_hdr;
-	data[len++] = num;
-
-	return build_list_entry(data, len);
-}
-
-static struct gps_list_entry *
-d201_route(int num, u_char *cmnt)
-{
-	u_char *data;
-	int len;
-
-	data = gps_buffer_new();
-	len = 0;
-
-	data[len++] = p_rte_hdr;
-	data[len++] = num;
-	add_string(&data[len], cmnt, 20);
-	len += 20;
-
-	return build_list_entry(data, len);
-}
-
-static struct gps_list_entry *
-d202_route(u_char *cmnt)
-{
-	u_char *data;
-	int len;
-	int tlen;
-
-	data = gps_buffer_new();
-	len = 0;
-
-	data[len++] = p_rte_hdr;
-	tlen = strlcpy((char *) &data[len], (char *) cmnt, GPS_STRING_MAX);
-	if (++tlen > GPS_STRING_MAX)
-		tlen = GPS_STRING_MAX;
-	len += tlen;
-
-	return build_list_entry(data, len);
+	pkt[0] = state == WAYPOINTS ? p_wpt_data : p_rte_wpt_data;
+	return wc->encode(&w, pkt);
 }
 
 /*
- * decode the buffer as a route header.  Route waypoints are handled by the
+ * decode the line as a route header.  Route waypoints are handled by the
  * above waypoint code.   Data is expected to be in this format
  *
  *	**number name
  */
-static struct gps_list_entry *
-routes(gps_handle gps, u_char *buf)
+static int
+routes(gps_handle gps, const char *buf, const char *end, u_char *pkt)
 {
-	struct gps_list_entry *entry;
-	char *p;
-	int rte;
-	int num;
+	const struct gps_rte_codec *rc;
+	struct gps_rte r;
+	const char *p;
+	int num = 0;
 	u_char cmnt[GPS_STRING_MAX + 1];
 
-	sscanf((char *) buf, "**%d", &num);
-	p = strchr((char *) buf, ' ');
+	if (prefix(buf, end, "**"))
+		scan_int(buf + 2, end, &num);
+	p = memchr(buf, ' ', end - buf);
 	if (p)
-		strlcpy((char *) cmnt, p + 1, GPS_STRING_MAX);
+		copy_field(cmnt, p + 1, end);
 	else
-		cmnt[GPS_STRING_MAX] = 0;
+		cmnt[0] = 0;
 	gps_printf(gps, 3, "route %d %s\n", num, cmnt);
 
-	rte = gps_get_rte_hdr_type(gps);
-	switch (rte) {
-	case D200:
-		entry = d200_route(num);
-		break;
-	case D201:
-		entry = d201_route(num, cmnt);
-		break;
-	case D202:
-		entry = d202_route(cmnt);
-		break;
-	default:
-		entry = NULL;
-		gps_printf(gps, 1, "unknown route hdr type %d\n", rte);
-		break;
+	rc = gps_get_rte_hdr_codec(gps);
+	if (rc == NULL) {
+		gps_printf(gps, 1, "unknown route hdr type %d\n",
+			   gps_get_rte_hdr_type(gps));
+		return 0;
 	}
-
-	return entry;
+	memset(&r, 0, sizeof r);
+	r.num = num;
+	r.class = -1;
+	r.ident.str = (char *) cmnt;
+	r.ident.len = (int) strlen(r.ident.str);
+	pkt[0] = p_rte_hdr;
+	return rc->encode(&r, pkt);
 }
 
-static struct gps_list_entry *
-route_link(gps_handle gps, int link)
+/*
+ * build a route link packet if the unit uses route links
+ */
+static int
+route_link(gps_handle gps, int link, u_char *pkt)
 {
-	u_char *data;
-	int len;
-
-	data = gps_buffer_new();
-	len = 0;
-
-	data[len++] = p_rte_link;
-
-	/* byte 1-2: class */
-	data[len++] = (u_char) link;
-	data[len++] = (u_char) (link >> 8);
-
-	/* byte 3-20: subclass (value per garmin doc) */
-	memset(&data[len], 0, 6);
-	len += 6;
-	memset(&data[len], 0xff, 12);
-	len += 12;
-
-	/* byte 21-??: ident (empty) */
-
-	data[len++] = 0;
-
-	return build_list_entry(data, len);
+	const struct gps_rte_codec *rc;
+	struct gps_rte r;
+
+	rc = gps_get_rte_lnk_codec(gps);
+	if (rc == NULL)
+		return 0;
+	memset(&r, 0, sizeof r);
+	r.num = -1;
+	r.class = link;
+	pkt[0] = p_rte_link;
+	return rc->encode(&r, pkt);
 }
 
-static struct gps_list_entry *
-track_hdr(gps_handle gps, u_char *buf)
+static int
+track_hdr(gps_handle gps, const char *buf, const char *end, u_char *pkt)
 {
-	u_char *data;
-	int len;
-	int tlen;
+	const struct gps_trk_codec *tc;
+	struct gps_trk t;
 	u_char name[GPS_STRING_MAX + 1];	/* track name */
 
-	/* skip any leading whitespace and extract the name */
-	for (len = 0; buf[len]; len += 1)
-		if (! isspace(buf[len]))
-			break;
-	strlcpy((char *) name, (char *) &buf[len], GPS_STRING_MAX);
-
-	data = gps_buffer_new();
-	len = 0;
-
-	data[len++] = p_trk_hdr;
+	tc = gps_get_trk_hdr_codec(gps);
+	if (tc == NULL)
+		return 0;
 
-	/* byte 1: display */
-	data[len++] = 1;
-
-	/* byte 2: default color */
-	data[len++] = 0xff;
-
-	/* byte 3-n: ident (max GPS_STRING_MAX characters) */
-	tlen = strlcpy((char *) &data[len], (char *) name, GPS_STRING_MAX);
-	if (++tlen > GPS_STRING_MAX)
-		tlen = GPS_STRING_MAX;
-	len += tlen;
+	/* skip any leading whitespace and extract the name */
+	copy_field(name, skip_space(buf, end), end);
 
-	return build_list_entry(data, len);
+	memset(&t, 0, sizeof t);
+	t.ident.str = (char *) name;
+	t.ident.len = (int) strlen(t.ident.str);
+	pkt[0] = p_trk_hdr;
+	return tc->encode(&t, pkt);
 }
 
-static struct gps_list_entry *
-tracks(gps_handle gps, u_char *buf)
+static int
+tracks(gps_handle gps, const char *buf, const char *end, u_char *pkt)
 {
-	char *p;
-	u_char *data;
-	int len;
-	int start;
-	double lat;
-	double lon;
+	const struct gps_trk_codec *tc;
+	struct gps_trk t;
+	const char *p;
+
+	tc = gps_get_trk_codec(gps);
+	if (tc == NULL) {
+		gps_printf(gps, 1, "unknown track type %d\n",
+			   gps_get_trk_type(gps));
+		return 0;
+	}
 
 	/*
-	 * if the buffer starts with a date/time, skip them.
+	 * if the line starts with a date/time, skip them.
 	 * The input should look like yyyy-mm-dd hh:mm:ss ...
 	 */
-	if (buf[4] == '-' && buf[7] == '-' && buf[13] == ':' && buf[16] == ':')
+	if (end - buf >= 19 && buf[4] == '-' && buf[7] == '-' &&
+	    buf[13] == ':' && buf[16] == ':')
 		buf += 19;
 
+	memset(&t, 0, sizeof t);
+
 	/* Latitude and longitude */
-	sscanf((char *) buf, "%lf %lf", &lat, &lon);
+	p = scan_double(buf, end, &t.lat);
+	if (p != buf)
+		scan_double(p, end, &t.lon);
 
 	/* look for start flag */
-	p = strrchr((char *) buf, ' ');
-	if (p != NULL)
-		start = strcmp((char *) p+1, "start") == 0;
-	else
-		start = 0;
-
-	gps_printf(gps, 3, "trk %f %f%s\n", lat, lon, start ? " start" : "");
-
-	data = gps_buffer_new();
-	len = 0;
-
-	data[len++] = p_trk_data;
-
-	/* byte 1-4: latitude */
-	double2semicircle(lat, &data[len]);
-	len += 4;
-
-	/* byte 5-8: longitude */
-	double2semicircle(lon, &data[len]);
-	len += 4;
-
-	/* time (uploaded as zero) */
-	data[len++] = 0;
-	data[len++] = 0;
-	data[len++] = 0;
-	data[len++] = 0;
-
-	/*
-	 * load the magic "unknown" value for altitude and depth if
-	 * supported by this unit.
-	 */
-	if (gps_get_trk_type(gps) == D301) {
-		len += gps_put_float(&data[len], no_val.f);
-		len += gps_put_float(&data[len], no_val.f);
-	}
-
-	/* start indicator */
-	data[len++] = start;
-
-	return build_list_entry(data, len);
+	for (p = end; p > buf && p[-1] != ' '; p--)
+		;
+	if (p > buf)
+		t.new_trk = end - p == 5 && memcmp(p, "start", 5) == 0;
+
+	gps_printf(gps, 3, "trk %f %f%s\n", t.lat, t.lon,
+		   t.new_trk ? " start" : "");
+
+	/* time is uploaded as zero, altitude and depth as the magic
+	   "unknown" value */
+	t.time = 0;
+	t.alt = no_val.f;
+	t.depth = no_val.f;
+
+	pkt[0] = p_trk_data;
+	return tc->encode(&t, pkt);
 }
 
 /*
- * create a new list
+ * create a new list and link it to the end of the lists
  */
 static void
-gps_list_new(struct gps_lists **lists, struct gps_lists **cur, int state)
+add_list(struct gps_lists **lists, struct gps_lists **cur,
+	 enum gps_cmd_id type)
 {
 	struct gps_lists *new;
 
-	new = malloc(sizeof(struct gps_lists));
+	new = gps_malloc(sizeof(struct gps_lists));
 	assert(new != NULL);
 	new->next = 0;
-	new->list = malloc(sizeof(struct gps_list_head));
-	assert( new->list );
-	switch (state) {
-	case WAYPOINTS:
-		new->list->type = CMD_WPT;
-		break;
-	case ROUTES:
-		new->list->type = CMD_RTE;
-		break;
-	case TRACKS:
-		new->list->type = CMD_TRK;
-		break;
-	case START:
-		break;
-	}
-	new->list->head = 0;
-	new->list->tail = 0;
-	new->list->count = 0;
+	new->list = gps_list_new(type);
 	if (*cur) {
 		(*cur)->next = new;
 		(*cur) = new;
@@ -914,106 +577,542 @@ gps_list_new(struct gps_lists **lists, struct gps_lists **cur, int state)
 }
 
 /*
- * Link the entry arg to the end of the list identified by the
- * cur arg.   Bump the list count.
+ * Copy a stream that can not be mapped, e.g. a pipe, to a temporary
+ * file.  Returns the file positioned at its start or NULL.
  */
-static void
-gps_append_list(struct gps_lists *cur, struct gps_list_entry *entry)
+static FILE *
+spool_stream(gps_handle gps, FILE *stream)
 {
-	if (cur->list->head == NULL)
-		cur->list->head = entry;
+	char buf[BUFSIZ];
+	size_t len;
+	FILE *spool;
+
+	spool = tmpfile();
+	if (spool == NULL) {
+		gps_printf(gps, 0, "%s: can't create temporary file\n",
+			   __func__);
+		return NULL;
+	}
+	while ((len = fread(buf, 1, sizeof buf, stream)) > 0)
+		if (fwrite(buf, 1, len, spool) != len)
+			break;
+	if (ferror(stream) || ferror(spool) || fflush(spool) ||
+	    fseeko(spool, 0, SEEK_SET)) {
+		gps_printf(gps, 0, "%s: can't spool input\n", __func__);
+		fclose(spool);
+		return NULL;
+	}
+	return spool;
+}
+
+/*
+ * Read the rest of the stream into memory, used when the file can't
+ * be mapped.
+ */
+static int
+read_stream(struct gps_format_state *fs, FILE *stream)
+{
+	size_t size = 0;
+	size_t alloc = BUFSIZ;
+	size_t len;
+	char *buf;
+	char *nbuf;
+
+	if ((buf = gps_malloc(alloc)) == NULL)
+		return -1;
+	while ((len = fread(buf + size, 1, alloc - size, stream)) > 0) {
+		size += len;
+		if (size == alloc) {
+			alloc *= 2;
+			if ((nbuf = gps_realloc(buf, alloc)) == NULL) {
+				gps_free(buf);
+				return -1;
+			}
+			buf = nbuf;
+		}
+	}
+	if (ferror(stream)) {
+		gps_free(buf);
+		return -1;
+	}
+	fs->buf = buf;
+	fs->size = size;
+	fs->pos = 0;
+	return 0;
+}
+
+/*
+ * Prepare to parse the stream from its current position.  Regular
+ * files are mapped, anything else is first copied to a temporary file.
+ * Returns 0 or -1 if the input could not be read.
+ */
+int
+gps_format_open(gps_handle gps, struct gps_format_state *fs, FILE *stream)
+{
+	struct stat st;
+	off_t pos;
+	void *map;
+
+	memset(fs, 0, sizeof *fs);
+	pos = ftello(stream);
+	if (fstat(fileno(stream), &st) == -1 || ! S_ISREG(st.st_mode) ||
+	    pos == -1) {
+		if ((fs->spool = spool_stream(gps, stream)) == NULL)
+			return -1;
+		stream = fs->spool;
+		pos = 0;
+		if (fstat(fileno(stream), &st) == -1)
+			return -1;
+	}
+	if ((u_int64_t) st.st_size > SIZE_MAX || pos > st.st_size)
+		return -1;
+	if (st.st_size == 0)
+		return 0;
+
+	map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED,
+		   fileno(stream), 0);
+	if (map == MAP_FAILED) {
+		gps_printf(gps, 2, "%s: can't map input, reading\n", __func__);
+		return read_stream(fs, stream);
+	}
+	madvise(map, (size_t) st.st_size, MADV_SEQUENTIAL);
+	fs->buf = map;
+	fs->size = (size_t) st.st_size;
+	fs->pos = (size_t) pos;
+	fs->mapped = 1;
+	return 0;
+}
+
+/*
+ * Release the input of a parse
+ */
+void
+gps_format_close(struct gps_format_state *fs)
+{
+	if (fs->mapped)
+		munmap((void *) fs->buf, fs->size);
 	else
-		cur->list->tail->next = entry;
-	cur->list->tail = entry;
-	cur->list->count += 1;
+		gps_free((void *) fs->buf);
+	if (fs->spool != NULL)
+		fclose(fs->spool);
+	fs->buf = NULL;
+	fs->size = 0;
+	fs->spool = NULL;
 }
 
 /*
- * Convert a given file, assumed to be in the same format output
- * by gpsprint, to lists of gps records ready to upload to a gps
- * unit.
- *
- * The lists and each item from the list come from the heap and
- * should be released.
+ * The work of gps_format_next
  */
-struct gps_lists *
-gps_format(gps_handle gps, FILE *stream)
+static int
+format_next(gps_handle gps, struct gps_format_state *fs)
 {
-	u_char buf[GPS_BUF_LEN];
-	struct gps_lists *lists = 0;
-	struct gps_lists *cur = 0;
-	struct gps_list_entry *entry = 0;
-	int state = START;
-	int ix;
+	const char *line;
+	const char *end;
+	const char *p;
+	u_char *pkt;
 	int link;
-	int rte;
-	char *p;
-
-	while (fgets((char *) buf, sizeof buf, stream)) {
+	int len;
 
-		/* kill any trailing newline */
-		if ((p = strrchr((char *) buf, '\n')) != NULL)
-			*p = 0;
+	fs->npkt = 0;
+	while (fs->pos < fs->size) {
+		line = fs->buf + fs->pos;
+		end = memchr(line, '\n', fs->size - fs->pos);
+		if (end == NULL)
+			end = fs->buf + fs->size;
+		fs->pos = end - fs->buf + 1;
 
 		/* skip any leading whitespace */
-		for (ix = 0; buf[ix]; ix += 1)
-			if (! isspace(buf[ix]))
-				break;
+		p = skip_space(line, end);
 
 		/* Ignore comments and/or empty lines */
-		if (buf[ix] == 0 || buf[ix] == '#')
+		if (p == end || *p == '#')
 			continue;
 
 		/* check for list terminator */
-		if (buf[ix] == '[' && strncmp((char *) &buf[ix], "[end", 4) == 0) {
+		if (prefix(p, end, "[end") && fs->state != START) {
 			gps_printf(gps, 3, "...end\n");
-			state = START;
+			fs->state = START;
+			return GPS_FORMAT_END;
 		}
 
-		/* process the content of the buffer according to
+		/* process the content of the line according to
 		   the current state */
-		switch (state) {
+		pkt = fs->pkt[0];
+		len = 0;
+		switch (fs->state) {
 		case START:
-			state = scan_state(&buf[ix]);
-			if (state != START) {
-				gps_printf(gps, 3, "%s: processing %s\n",
-					   __func__, &buf[ix]);
-				gps_list_new(&lists, &cur, state);
+			fs->state = scan_state(p, end);
+			if (fs->state != START) {
+				gps_printf(gps, 3, "%s: processing %.*s\n",
+					   __func__, (int) (end - p), p);
+				fs->type = fs->state == WAYPOINTS ? CMD_WPT :
+					fs->state == ROUTES ? CMD_RTE : CMD_TRK;
+				return GPS_FORMAT_SECTION;
 			}
 			continue;
 		case WAYPOINTS:
-			entry = waypoints(gps, &buf[ix], state, &link);
+			len = waypoints(gps, p, end, fs->state, &link, pkt);
 			break;
 		case ROUTES:
-			if (buf[ix] == '*')
-				entry = routes(gps, &buf[ix]);
+			if (*p == '*')
+				len = routes(gps, p, end, pkt);
 			else {
-				entry = waypoints(gps, &buf[ix], state, &link);
+				len = waypoints(gps, p, end, fs->state, &link,
+						pkt);
 				if (link != -1) {
-					if (entry != NULL) {
-						gps_append_list(cur, entry);
-						entry = NULL;
+					if (len != 0) {
+						fs->len[fs->npkt++] = len;
+						pkt = fs->pkt[1];
 					}
-					rte = gps_get_rte_lnk_type(gps);
-					if (rte == D210)
-						entry = route_link(gps, link);
+					len = route_link(gps, link, pkt);
 				}
 			}
 			break;
 		case TRACKS:
-			if (strncmp((char *) &buf[ix], "Track:", 6) == 0) {
-				if (gps_get_trk_hdr_type(gps) != 0)
-					entry = track_hdr(gps, &buf[ix + 6]);
-			} else
-				entry = tracks(gps, &buf[ix]);
+			if (prefix(p, end, "Track:"))
+				len = track_hdr(gps, p + 6, end, pkt);
+			else
+				len = tracks(gps, p, end, pkt);
 			break;
 		}
+		if (len != 0)
+			fs->len[fs->npkt++] = len;
+		if (fs->npkt != 0)
+			return GPS_FORMAT_DATA;
+	}
+	if (fs->state != START) {
+		fs->state = START;
+		return GPS_FORMAT_END;
+	}
+	return GPS_FORMAT_EOF;
+}
+
+/*
+ * Parse the input, assumed to be in the same format output by
+ * gpsprint, up to the next event and return it:
+ *
+ *	GPS_FORMAT_SECTION	start of a section, fs->type is set
+ *	GPS_FORMAT_DATA		fs->npkt packets are in fs->pkt/fs->len
+ *	GPS_FORMAT_END		end of the section
+ *	GPS_FORMAT_EOF		end of file
+ *
+ * One input line gives at most two packets (a route waypoint and its
+ * link).  Saving and restoring fs->state and fs->pos returns to an
+ * earlier point in the input.
+ */
+int
+gps_format_next(gps_handle gps, struct gps_format_state *fs)
+{
+	int phase = gps_mem_phase(GPS_MEM_FORMAT);
+	int stat;
+	GPS_PROF_BEGIN(prof, GPS_PROF_FORMAT);
+
+	stat = format_next(gps, fs);
+	GPS_PROF_END(prof);
+	gps_mem_phase(phase);
+	return stat;
+}
 
-		/* If entry is not null link it into the current list */
-		if (entry != NULL) {
-			gps_append_list(cur, entry);
-			entry = NULL;
+/*
+ * Parallel conversion.
+ *
+ * The mapped input of each file is cut at line boundaries into chunks
+ * of about CHUNK_SIZE bytes.  Only section header and end lines change
+ * the decode state, but whether a header line starts a section depends
+ * on the state it is seen in.  The first pass therefore runs the state
+ * machine over the header lines of each chunk once for every possible
+ * starting state, giving the state at the end of the chunk as a
+ * function of the state at its start.  Chaining those functions in
+ * order gives the real starting state of every chunk.  The second pass
+ * converts each chunk from its starting state into its own lists.  A
+ * line is never split so a route waypoint and its link stay together.
+ * Both passes run on a pool of threads taking chunks in turn.  The
+ * chunk lists are then joined in input order: records that precede the
+ * first section header of a chunk continue the last list before it.
+ */
+
+#define CHUNK_SIZE	(1024 * 1024)
+#define NSTATES		(TRACKS + 1)
+
+struct chunk {
+	const char *buf;		/* input of the file */
+	size_t	beg;			/* offset of the chunk */
+	size_t	end;			/* offset past the chunk */
+	int	first;			/* first chunk of a file */
+	int	out[NSTATES];		/* end state for each start state */
+	int	state;			/* start state */
+	struct gps_list_head *cont;	/* records continuing a section */
+	struct gps_lists *lists;	/* sections started in the chunk */
+};
+
+struct pool {
+	gps_handle gps;
+	struct chunk *chunks;
+	int	nchunks;
+	int	next;			/* next chunk to work on */
+	int	pass;			/* 1 or 2 */
+	pthread_mutex_t lock;
+};
+
+/*
+ * The decode state after the line at p.  This must track the state
+ * changes made by gps_format_next.
+ */
+static int
+next_state(int state, const char *p, const char *end)
+{
+	if (prefix(p, end, "[end"))
+		return START;
+	if (state == START)
+		return scan_state(p, end);
+	return state;
+}
+
+/*
+ * First pass: the end state of the chunk for each start state
+ */
+static void
+scan_chunk(struct chunk *ch)
+{
+	const char *p = ch->buf + ch->beg;
+	const char *end = ch->buf + ch->end;
+	const char *eol;
+	int state;
+
+	for (state = START; state < NSTATES; state++)
+		ch->out[state] = state;
+	for (; p < end; p = eol + 1) {
+		if ((eol = memchr(p, '\n', end - p)) == NULL)
+			eol = end;
+		p = skip_space(p, eol);
+		if (p < eol && *p == '[')
+			for (state = START; state < NSTATES; state++)
+				ch->out[state] = next_state(ch->out[state],
+							    p, eol);
+	}
+}
+
+/*
+ * Second pass: convert the chunk
+ */
+static void
+parse_chunk(gps_handle gps, struct chunk *ch)
+{
+	struct gps_format_state fs;
+	struct gps_lists *cur = NULL;
+	struct gps_list_head *list;
+	int ix;
+	int rc;
+
+	memset(&fs, 0, sizeof fs);
+	fs.buf = ch->buf;
+	fs.size = ch->end;
+	fs.pos = ch->beg;
+	fs.state = ch->state;
+	if (fs.state != START) {
+		fs.type = fs.state == WAYPOINTS ? CMD_WPT :
+			fs.state == ROUTES ? CMD_RTE : CMD_TRK;
+		ch->cont = gps_list_new(fs.type);
+	}
+	while ((rc = gps_format_next(gps, &fs)) != GPS_FORMAT_EOF) {
+		if (rc == GPS_FORMAT_SECTION)
+			add_list(&ch->lists, &cur, fs.type);
+		list = cur ? cur->list : ch->cont;
+		for (ix = 0; ix < fs.npkt; ix++)
+			gps_list_append(list, fs.pkt[ix], fs.len[ix]);
+	}
+}
+
+static void *
+worker(void *arg)
+{
+	struct pool *pool = arg;
+	int ix;
+
+	gps_mem_phase(GPS_MEM_FORMAT);
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		ix = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+		if (ix >= pool->nchunks)
+			break;
+		if (pool->pass == 1)
+			scan_chunk(&pool->chunks[ix]);
+		else
+			parse_chunk(pool->gps, &pool->chunks[ix]);
+	}
+	return NULL;
+}
+
+/*
+ * Run a pass over all chunks with up to jobs threads, the calling
+ * thread being one of them.
+ */
+static void
+run_pass(struct pool *pool, int pass, int jobs)
+{
+	pthread_t *tids = NULL;
+	int nthreads = 0;
+	int ix;
+
+	pool->pass = pass;
+	pool->next = 0;
+	if (jobs > pool->nchunks)
+		jobs = pool->nchunks;
+	if (jobs > 1)
+		tids = gps_calloc(jobs - 1, sizeof *tids);
+	if (tids != NULL)
+		for (; nthreads < jobs - 1; nthreads++)
+			if (pthread_create(&tids[nthreads], NULL, worker,
+					   pool) != 0)
+				break;
+	worker(pool);
+	for (ix = 0; ix < nthreads; ix++)
+		pthread_join(tids[ix], NULL);
+	gps_free(tids);
+}
+
+/*
+ * Cut the input into chunks, appending them to *chunks.  Returns the
+ * new number of chunks or -1 if out of memory.
+ */
+static int
+cut_chunks(const struct gps_format_state *fs, struct chunk **chunks,
+	   int nchunks)
+{
+	struct chunk *new;
+	const char *eol;
+	size_t pos = fs->pos;
+	size_t end;
+	int n;
+
+	n = (fs->size - pos) / CHUNK_SIZE + 1;
+	new = gps_realloc(*chunks, (nchunks + n) * sizeof *new);
+	if (new == NULL)
+		return -1;
+	*chunks = new;
+	while (pos < fs->size) {
+		end = pos + CHUNK_SIZE;
+		if (end >= fs->size || (eol = memchr(fs->buf + end, '\n',
+						     fs->size - end)) == NULL)
+			end = fs->size;
+		else
+			end = eol - fs->buf + 1;
+		new = &(*chunks)[nchunks++];
+		memset(new, 0, sizeof *new);
+		new->buf = fs->buf;
+		new->beg = pos;
+		new->end = end;
+		new->first = pos == fs->pos;
+		pos = end;
+	}
+	return nchunks;
+}
+
+/*
+ * Convert the given files, each assumed to be in the same format
+ * output by gpsprint, to lists of gps records ready to upload to a gps
+ * unit using up to jobs threads.  The lists are in file order and in
+ * input order within a file; each file starts outside of any section.
+ * Track lists are simplified according to the track error and limit
+ * set on the handle.
+ *
+ * The lists come from the heap and should be released with
+ * gps_lists_free.  NULL is returned if the files hold no data or could
+ * not be read.
+ */
+struct gps_lists *
+gps_format_files(gps_handle gps, FILE **streams, int nstreams, int jobs)
+{
+	struct gps_format_state *fs;
+	struct gps_lists *lists = NULL;
+	struct gps_lists *cur = NULL;
+	struct chunk *chunks = NULL;
+	struct chunk *ch;
+	struct pool pool;
+	int nchunks = 0;
+	int state;
+	int ix;
+	int phase = gps_mem_phase(GPS_MEM_FORMAT);
+	GPS_PROF_BEGIN(prof, GPS_PROF_FORMAT);
+
+	fs = gps_calloc(nstreams, sizeof *fs);
+	if (fs == NULL) {
+		GPS_PROF_END(prof);
+		gps_mem_phase(phase);
+		return NULL;
+	}
+	for (ix = 0; ix < nstreams; ix++) {
+		if (gps_format_open(gps, &fs[ix], streams[ix]) == -1 ||
+		    (nchunks = cut_chunks(&fs[ix], &chunks, nchunks)) == -1) {
+			gps_printf(gps, 0, "%s: can't read input %d\n",
+				   __func__, ix + 1);
+			goto done;
 		}
 	}
+	gps_printf(gps, 2, "%s: %d chunks, %d jobs\n", __func__, nchunks,
+		   jobs);
+
+	memset(&pool, 0, sizeof pool);
+	pool.gps = gps;
+	pool.chunks = chunks;
+	pool.nchunks = nchunks;
+	pthread_mutex_init(&pool.lock, NULL);
+
+	/* find the start state of every chunk */
+	run_pass(&pool, 1, jobs);
+	for (ix = 0, state = START; ix < nchunks; ix++) {
+		ch = &chunks[ix];
+		if (ch->first)
+			state = START;
+		ch->state = state;
+		state = ch->out[state];
+	}
+
+	run_pass(&pool, 2, jobs);
+	pthread_mutex_destroy(&pool.lock);
+
+	/* join the chunk lists in order */
+	for (ix = 0; ix < nchunks; ix++) {
+		ch = &chunks[ix];
+		if (ch->cont != NULL) {
+			/* the section started in an earlier chunk */
+			if (cur != NULL)
+				gps_list_join(cur->list, ch->cont);
+			gps_list_free(ch->cont);
+		}
+		if (ch->lists == NULL)
+			continue;
+		if (cur)
+			cur->next = ch->lists;
+		else
+			lists = ch->lists;
+		for (cur = ch->lists; cur->next; cur = cur->next)
+			;
+	}
+
+	/* thin out the track logs if requested */
+	for (cur = lists; cur; cur = cur->next)
+		if (cur->list->type == CMD_TRK)
+			gps_simplify(gps, cur->list);
+
+done:
+	for (ix = 0; ix < nstreams; ix++)
+		gps_format_close(&fs[ix]);
+	gps_free(fs);
+	gps_free(chunks);
+	GPS_PROF_END(prof);
+	gps_mem_phase(phase);
 	return lists;
 }
+
+/*
+ * Convert a given file, assumed to be in the same format output
+ * by gpsprint, to lists of gps records ready to upload to a gps
+ * unit.  See gps_format_files.
+ */
+struct gps_lists *
+gps_format(gps_handle gps, FILE *stream)
+{
+	return gps_format_files(gps, &stream, 1, 1);
+}
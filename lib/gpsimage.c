@@ -0,0 +1,374 @@
+/*
+ * Public Domain, 2026, Marco S Hyman <marc@snafu.org>
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpslib.h"
+
+/*
+ * Upload images.
+ *
+ * An image holds the records of an upload already in layer two frame
+ * format, ready to be written to the port as is.  Loading the same
+ * data into many units then costs no parsing or framing.  Records are
+ * encoded for the packet types of one unit so the image starts with
+ * those types and is only loaded into units using the same types.
+ * All numbers are little endian.
+ *
+ *	magic		8 bytes, IMG_MAGIC
+ *	packet types	6 x 2 bytes: waypoint, route header, route
+ *			waypoint, route link, track header, track
+ *	sections	2 bytes
+ *	unused		2 bytes
+ *
+ * followed by each section:
+ *
+ *	command		2 bytes, CMD_WPT, CMD_RTE, or CMD_TRK
+ *	unused		2 bytes
+ *	records		4 bytes, at most GPS_XFER_MAX
+ *	size		4 bytes, of the frames that follow
+ *	frames		records x (2 byte length, frame)
+ */
+
+#define IMG_MAGIC	"GARIMG1\n"
+#define IMG_HDR_LEN	24
+#define IMG_SEC_LEN	12
+
+static u_int
+get16(const u_char *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static u_int32_t
+get32(const u_char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (u_int32_t) p[3] << 24;
+}
+
+static void
+put16(u_char *p, u_int val)
+{
+	p[0] = (u_char) val;
+	p[1] = (u_char) (val >> 8);
+}
+
+static void
+put32(u_char *p, u_int32_t val)
+{
+	put16(p, val & 0xffff);
+	put16(p + 2, val >> 16);
+}
+
+/*
+ * The packet types of the handle in image header order
+ */
+static void
+handle_types(gps_handle gps, int *types)
+{
+	types[0] = gps_get_wpt_type(gps);
+	types[1] = gps_get_rte_hdr_type(gps);
+	types[2] = gps_get_rte_wpt_type(gps);
+	types[3] = gps_get_rte_lnk_type(gps);
+	types[4] = gps_get_trk_hdr_type(gps);
+	types[5] = gps_get_trk_type(gps);
+}
+
+/*
+ * Frame the records of list into one section of the image
+ */
+static int
+write_section(gps_handle gps, const struct gps_list_head *list, FILE *fp)
+{
+	struct gps_list_head *frames;
+	u_char hdr[IMG_SEC_LEN];
+	u_char *frame;
+	size_t len;
+	int ix;
+
+	if (list->count > GPS_XFER_MAX) {
+		gps_printf(gps, 0, "%s: %d records, at most %d per section\n",
+			   __func__, list->count, GPS_XFER_MAX);
+		return -1;
+	}
+	frames = gps_list_new(list->type);
+	for (ix = 0; ix < list->count; ix++) {
+		len = GPS_LIST_LEN(list, ix);
+		frame = gps_frame(GPS_LIST_REC(list, ix), &len);
+		if (frame == NULL) {
+			gps_list_free(frames);
+			return -1;
+		}
+		gps_list_append(frames, frame, (int) len);
+		gps_free(frame);
+	}
+
+	put16(hdr, list->type);
+	put16(hdr + 2, 0);
+	put32(hdr + 4, list->count);
+	put32(hdr + 8, frames->off[frames->count] + 2 * frames->count);
+	fwrite(hdr, sizeof hdr, 1, fp);
+	for (ix = 0; ix < frames->count; ix++) {
+		put16(hdr, GPS_LIST_LEN(frames, ix));
+		fwrite(hdr, 2, 1, fp);
+		fwrite(GPS_LIST_REC(frames, ix), GPS_LIST_LEN(frames, ix), 1,
+		       fp);
+	}
+	gps_printf(gps, 2, "%s: %d records, %u bytes\n", __func__,
+		   list->count, frames->off[frames->count]);
+	gps_list_free(frames);
+	return ferror(fp) ? -1 : 0;
+}
+
+/*
+ * Write the lists to fp as an upload image for the packet types set
+ * on the handle.  Empty lists are left out.  Returns the number of
+ * records written or -1 on error.
+ */
+int
+gps_image_write(gps_handle gps, struct gps_lists *lists, FILE *fp)
+{
+	u_char hdr[IMG_HDR_LEN];
+	struct gps_lists *cur;
+	int types[6];
+	int sections = 0;
+	int records = 0;
+	int ix;
+
+	for (cur = lists; cur; cur = cur->next)
+		if (cur->list->count > 0)
+			sections += 1;
+	handle_types(gps, types);
+	memcpy(hdr, IMG_MAGIC, 8);
+	for (ix = 0; ix < 6; ix++)
+		put16(hdr + 8 + 2 * ix, types[ix]);
+	put16(hdr + 20, sections);
+	put16(hdr + 22, 0);
+	if (fwrite(hdr, sizeof hdr, 1, fp) != 1)
+		return -1;
+
+	for (cur = lists; cur; cur = cur->next) {
+		if (cur->list->count == 0)
+			continue;
+		if (write_section(gps, cur->list, fp) == -1)
+			return -1;
+		records += cur->list->count;
+	}
+	if (fflush(fp) == EOF)
+		return -1;
+	return records;
+}
+
+/*
+ * Read all of a stream that can't be mapped
+ */
+static int
+read_image(struct gps_image *img, FILE *fp)
+{
+	size_t size = 65536;
+	size_t len = 0;
+	u_char *buf = NULL;
+	u_char *new;
+	size_t cnt;
+
+	for (;;) {
+		if ((new = gps_realloc(buf, size)) == NULL) {
+			gps_free(buf);
+			return -1;
+		}
+		buf = new;
+		cnt = fread(buf + len, 1, size - len, fp);
+		len += cnt;
+		if (len < size)
+			break;
+		size *= 2;
+	}
+	if (ferror(fp)) {
+		gps_free(buf);
+		return -1;
+	}
+	img->buf = buf;
+	img->size = len;
+	return 0;
+}
+
+/*
+ * Check a frame of len bytes: DLE, escaped contents that sum to zero,
+ * DLE ETX.  Returns 0 if OK.
+ */
+static int
+check_frame(const u_char *frame, u_int len)
+{
+	u_int sum = 0;
+	u_int ix;
+
+	if (len < 6 || frame[0] != dle || frame[len - 2] != dle ||
+	    frame[len - 1] != etx)
+		return -1;
+	for (ix = 1; ix < len - 2; ix++) {
+		if (frame[ix] == dle && (++ix == len - 2 || frame[ix] != dle))
+			return -1;
+		sum += frame[ix];
+	}
+	return (sum & 0xff) == 0 ? 0 : -1;
+}
+
+/*
+ * Check the frames of a section: each must fit in the section and be
+ * a good frame.  Returns 0 if OK.
+ */
+static int
+check_frames(const struct gps_image_section *sec)
+{
+	const u_char *p = sec->frames;
+	const u_char *end = sec->frames + sec->size;
+	u_int len;
+	int ix;
+
+	for (ix = 0; ix < sec->count; ix++) {
+		if (end - p < 2)
+			return -1;
+		len = get16(p);
+		p += 2;
+		if (len > (u_int) (end - p) || check_frame(p, len) == -1)
+			return -1;
+		p += len;
+	}
+	return p == end ? 0 : -1;
+}
+
+/*
+ * Map or read the image in fp and locate its sections.  The image is
+ * checked for consistency but not against a unit, see gps_image_check.
+ * Returns 0 or -1 if fp does not hold a good image.  Release the image
+ * with gps_image_close in either case.
+ */
+int
+gps_image_open(gps_handle gps, struct gps_image *img, FILE *fp)
+{
+	struct gps_image_section *sec;
+	struct stat st;
+	const u_char *p;
+	const u_char *end;
+	void *map;
+	int ix;
+
+	memset(img, 0, sizeof *img);
+	if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode) &&
+	    st.st_size > 0 && (u_int64_t) st.st_size <= SIZE_MAX &&
+	    (map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED,
+			fileno(fp), 0)) != MAP_FAILED) {
+		img->buf = map;
+		img->size = (size_t) st.st_size;
+		img->mapped = 1;
+	} else if (read_image(img, fp) == -1) {
+		gps_printf(gps, 1, "%s: can't read image\n", __func__);
+		return -1;
+	}
+
+	p = img->buf;
+	end = img->buf + img->size;
+	if (img->size < IMG_HDR_LEN || memcmp(p, IMG_MAGIC, 8) != 0) {
+		gps_printf(gps, 1, "%s: not an upload image\n", __func__);
+		return -1;
+	}
+	for (ix = 0; ix < 6; ix++)
+		img->types[ix] = get16(p + 8 + 2 * ix);
+	img->nsections = get16(p + 20);
+	img->sections = gps_calloc(img->nsections + 1, sizeof *img->sections);
+	if (img->sections == NULL)
+		return -1;
+	p += IMG_HDR_LEN;
+	for (ix = 0; ix < img->nsections; ix++) {
+		sec = &img->sections[ix];
+		if (end - p < IMG_SEC_LEN)
+			goto bad;
+		sec->type = get16(p);
+		sec->count = get32(p + 4);
+		sec->size = get32(p + 8);
+		p += IMG_SEC_LEN;
+		if ((sec->type != CMD_WPT && sec->type != CMD_RTE &&
+		     sec->type != CMD_TRK) || sec->count < 0 ||
+		    sec->count > GPS_XFER_MAX || sec->size > (size_t) (end - p))
+			goto bad;
+		sec->frames = p;
+		if (check_frames(sec) == -1)
+			goto bad;
+		p += sec->size;
+	}
+	if (p != end) {
+		gps_printf(gps, 1, "%s: %ld bytes of trailing data\n",
+			   __func__, (long) (end - p));
+		return -1;
+	}
+	return 0;
+
+bad:
+	gps_printf(gps, 1, "%s: section %d is damaged\n", __func__, ix + 1);
+	return -1;
+}
+
+/*
+ * Check that the unit uses the packet types the image was made for.
+ * Only the types of the sections in the image matter.  Returns 0 if
+ * the image can be loaded or -1 if not.
+ */
+int
+gps_image_check(gps_handle gps, const struct gps_image *img)
+{
+	static const char *names[6] = {
+		"waypoint", "route header", "route waypoint", "route link",
+		"track header", "track"
+	};
+	int types[6];
+	int used[6];
+	int ok = 0;
+	int ix;
+
+	handle_types(gps, types);
+	memset(used, 0, sizeof used);
+	for (ix = 0; ix < img->nsections; ix++)
+		switch (img->sections[ix].type) {
+		case CMD_WPT:
+			used[0] = 1;
+			break;
+		case CMD_RTE:
+			used[1] = used[2] = used[3] = 1;
+			break;
+		case CMD_TRK:
+			used[4] = used[5] = 1;
+			break;
+		default:
+			break;
+		}
+	for (ix = 0; ix < 6; ix++)
+		if (used[ix] && types[ix] != img->types[ix]) {
+			gps_printf(gps, 1, "%s: %s type is D%d, image has "
+				   "D%d\n", __func__, names[ix], types[ix],
+				   img->types[ix]);
+			ok = -1;
+		}
+	return ok;
+}
+
+/*
+ * Release an image
+ */
+void
+gps_image_close(struct gps_image *img)
+{
+	if (img->mapped)
+		munmap((void *) img->buf, img->size);
+	else
+		gps_free((void *) img->buf);
+	gps_free(img->sections);
+	memset(img, 0, sizeof *img);
+}
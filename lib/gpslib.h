@@ -21,6 +21,7 @@
 #define p_rte_wpt_data	(u_char) 30
 #define p_trk_data	(u_char) 34
 #define p_wpt_data	(u_char) 35
+#define p_pvt_data	(u_char) 51
 #define p_scr_shot      (u_char) 69
 #define p_rte_link	(u_char) 98
 #define p_trk_hdr	(u_char) 99
@@ -39,6 +40,11 @@
  */
 #define GPS_FRAME_MAX	256
 
+/*
+ * The transfer begin packet holds a 16 bit record count.
+ */
+#define GPS_XFER_MAX	0xffff
+
 /*
  * Gps command (upload/download) types.
  */
@@ -48,7 +54,9 @@ enum gps_cmd_id {
     CMD_UTC = 5,
     CMD_TRK = 6,
     CMD_WPT = 7,
-    CMD_SCREEN = 32
+    CMD_SCREEN = 32,
+    CMD_START_PVT = 49,
+    CMD_STOP_PVT = 50
 };
 
 /*
@@ -81,24 +89,26 @@ enum gps_cmd_id {
 #define D310		310
 
 /*
- * list of data/length
+ * opaque type to identify a gps state structure
  */
-struct gps_list_entry {
-	struct gps_list_entry *next;	/* next item in list */
-	u_char *data;			/* pointer to data to send */
-	int data_len;			/* length of data to send */
-};
+typedef void * gps_handle;
 
 /*
- * list head
+ * list of records.  The records are stored back to back in data.
+ * Record n starts at off[n] and ends at off[n + 1].
  */
 struct gps_list_head {
 	int type;			/* protocol type */
-	struct gps_list_entry *head;	/* first entry in list */
-	struct gps_list_entry *tail;	/* last entry in list */
-	int count;			/* number of entries */
+	int count;			/* number of records */
+	int slots;			/* number of offsets allocated, less 1 */
+	u_int32_t *off;			/* offset of each record in data */
+	u_char *data;			/* record data */
+	size_t size;			/* bytes allocated for data */
 };
 
+#define GPS_LIST_REC(l, n)	((l)->data + (l)->off[n])
+#define GPS_LIST_LEN(l, n)	((int) ((l)->off[(n) + 1] - (l)->off[n]))
+
 /*
  * a list of list heads
  */
@@ -107,6 +117,287 @@ struct gps_lists {
 	struct gps_list_head *list;	/* head of this list */
 };
 
+/*
+ * Maximum length of a variable length string field including the
+ * terminating null.
+ */
+#define GPS_STRING_MAX	51
+
+/*
+ * A string field: len characters at str, not null terminated.  Decoded
+ * strings point into the packet and are only valid as long as the
+ * packet.  str is NULL if the field is not present.
+ */
+struct gps_str {
+	const char *str;
+	int	len;
+};
+
+/*
+ * Waypoint fields.  Filled in by a waypoint codec decode function and
+ * used by the encode function.  Numeric fields not found in a waypoint
+ * type decode as -1.
+ */
+struct gps_wpt {
+	const u_char *posn;		/* lat/long semicircles in packet */
+	double	lat;			/* latitude */
+	double	lon;			/* longitude */
+	float	alt;			/* altitude, no_val.f if none */
+	long	sym;			/* symbol */
+	long	dsp;			/* display mode */
+	long	class;			/* waypoint class */
+	const u_char *subclass;		/* subclass */
+	int	subclass_len;		/* length of subclass */
+	struct gps_str ident;		/* ident */
+	struct gps_str cmnt;		/* comment */
+};
+
+/*
+ * Route header and route link fields
+ */
+struct gps_rte {
+	long	num;			/* route number, -1 if none */
+	long	class;			/* link class, -1 if none */
+	struct gps_str ident;		/* route ident/comment */
+};
+
+/*
+ * Track header and track point fields
+ */
+struct gps_trk {
+	const u_char *posn;		/* lat/long semicircles in packet */
+	double	lat;			/* latitude */
+	double	lon;			/* longitude */
+	long	time;			/* GPS time, -1 if none */
+	float	alt;			/* altitude, no_val.f if none */
+	float	depth;			/* depth, no_val.f if none */
+	int	new_trk;		/* start of a new track segment */
+	struct gps_str ident;		/* track header ident */
+};
+
+/*
+ * Codecs convert between packets and the above structures.  decode
+ * returns 0 or -1 if the packet is too short to hold the essential
+ * fields.  encode fills in the packet after the packet id and returns
+ * the packet length.
+ */
+struct gps_wpt_codec {
+	int	type;
+	int	(*decode)(const u_char *, int, struct gps_wpt *);
+	int	(*encode)(const struct gps_wpt *, u_char *);
+};
+
+struct gps_rte_codec {
+	int	type;
+	int	(*decode)(const u_char *, int, struct gps_rte *);
+	int	(*encode)(const struct gps_rte *, u_char *);
+};
+
+struct gps_trk_codec {
+	int	type;
+	int	(*decode)(const u_char *, int, struct gps_trk *);
+	int	(*encode)(const struct gps_trk *, u_char *);
+};
+
+/*
+ * A position, velocity, and time fix decoded from a D800 packet.  when
+ * is the host time at which the last byte of the frame was read.
+ */
+#define GPS_FIX_UNUSABLE	0
+#define GPS_FIX_INVALID		1
+#define GPS_FIX_2D		2
+#define GPS_FIX_3D		3
+#define GPS_FIX_2D_DIFF		4
+#define GPS_FIX_3D_DIFF		5
+
+struct gps_pvt {
+	double	when;			/* frame received, UNIX seconds */
+	double	utc;			/* time of fix, UNIX seconds */
+	double	lat;			/* latitude, degrees */
+	double	lon;			/* longitude, degrees */
+	float	alt;			/* altitude above mean sea level */
+	float	epe;			/* estimated position error, meters */
+	float	eph;			/* horizontal position error */
+	float	epv;			/* vertical position error */
+	float	east;			/* velocity, meters/second */
+	float	north;
+	float	up;
+	int	fix;			/* GPS_FIX_ value */
+};
+
+/*
+ * Result of probing a port for a unit, see gps_probe
+ */
+#define GPS_PROBE_ERROR		-1	/* port could not be opened */
+#define GPS_PROBE_NONE		0	/* no answer */
+#define GPS_PROBE_FOUND		1	/* a unit sent its product data */
+
+struct gps_probe {
+	const char *port;		/* port to probe */
+	int	state;			/* GPS_PROBE_ value */
+	int	error;			/* errno if the port can't be opened */
+	int	product_id;
+	int	software_version;
+	char	*description;		/* malloc'd, may be NULL */
+};
+
+/*
+ * Protocol capability table: the protocols named in the capability
+ * array of a unit, each with the data types that follow it.
+ */
+#define GPS_PROTO_MAX	64		/* protocols in a table */
+#define GPS_PROTO_DATA	8		/* data types kept per protocol */
+
+struct gps_protocol {
+	char	tag;			/* 'P', 'L', or 'A' */
+	int	num;			/* protocol number */
+	int	ndata;			/* number of data types */
+	int	data[GPS_PROTO_DATA];	/* data (D) types */
+};
+
+struct gps_protocols {
+	int	count;			/* protocols in the table */
+	int	sent;			/* 0 if made up, the unit sent none */
+	struct gps_protocol proto[GPS_PROTO_MAX];
+};
+
+/*
+ * Transfer in progress on a handle, see gps_abort
+ */
+#define GPS_XFER_NONE	0
+#define GPS_XFER_DOWN	1		/* unit sending a transfer */
+#define GPS_XFER_UP	2		/* host sending a transfer */
+#define GPS_XFER_PVT	3		/* unit streaming fixes */
+#define GPS_XFER_ABORT	4		/* gps_abort ending one of the above */
+
+/*
+ * Frames held for their consumer (opaque), see gps_recv_type
+ */
+struct gps_queue;
+
+/*
+ * Screenshot decoder (opaque) and output formats
+ */
+struct gps_screen;
+
+#define GPS_SCREEN_PPM	0
+#define GPS_SCREEN_PNG	1
+
+/*
+ * gps_format_next state and return values.  The state is set up by
+ * gps_format_open.
+ */
+struct gps_format_state {
+	int	state;			/* decode state */
+	enum gps_cmd_id type;		/* type of the current section */
+	int	npkt;			/* packets from the last line */
+	int	len[2];			/* packet lengths */
+	u_char	pkt[2][GPS_FRAME_MAX];	/* packets */
+	const char *buf;		/* input text */
+	size_t	size;			/* size of input text */
+	size_t	pos;			/* offset of the next line */
+	int	mapped;			/* buf is mapped, not allocated */
+	FILE	*spool;			/* copy of unmappable input */
+};
+
+#define GPS_FORMAT_EOF		0
+#define GPS_FORMAT_SECTION	1
+#define GPS_FORMAT_DATA		2
+#define GPS_FORMAT_END		3
+
+/*
+ * An upload image opened by gps_image_open.  The frames of a section
+ * are each preceded by their length, two bytes little endian.
+ */
+struct gps_image_section {
+	enum gps_cmd_id type;		/* transfer type */
+	int	count;			/* number of records */
+	const u_char *frames;		/* framed records */
+	size_t	size;			/* bytes of frames */
+};
+
+struct gps_image {
+	int	types[6];		/* packet types the image is for */
+	int	nsections;		/* number of sections */
+	struct gps_image_section *sections;
+	const u_char *buf;		/* image contents */
+	size_t	size;			/* size of image */
+	int	mapped;			/* buf is mapped, not allocated */
+};
+
+/*
+ * Session phases timed when the library is built with -DGPS_PROFILE.
+ * A phase is timed from GPS_PROF_BEGIN to the GPS_PROF_END of the
+ * same name; the breakdown is printed to stderr at exit.  Without
+ * GPS_PROFILE the macros expand to nothing.
+ */
+#define GPS_PROF_OPEN		0	/* port open and termios */
+#define GPS_PROF_PRODUCT	1	/* product and capability probe */
+#define GPS_PROF_CMD		2	/* gps_cmd_xfer */
+#define GPS_PROF_LOAD		3	/* gps_load and friends */
+#define GPS_PROF_FORMAT		4	/* gps_format and friends */
+#define GPS_PROF_RECV		5	/* gps_recv_type */
+#define GPS_PROF_FRAME		6	/* frame decode */
+#define GPS_PROF_ACK		7	/* ack send */
+#define GPS_PROF_SELECT		8	/* select waits */
+#define GPS_PROF_READ		9	/* read syscalls */
+#define GPS_PROF_WRITE		10	/* write syscalls */
+#define GPS_PROF_DECODE		11	/* record decode */
+#define GPS_PROF_PRINT		12	/* gps_print */
+#define GPS_PROF_STDOUT		13	/* stdout flushes */
+#define GPS_PROF_PHASES		14
+
+struct gps_prof {
+	int	phase;
+	int	nested;			/* inside a phase of its own kind */
+	double	start;
+	double	child;			/* time in phases begun inside */
+	struct gps_prof *up;		/* enclosing phase */
+};
+
+#ifdef GPS_PROFILE
+#define GPS_PROF_BEGIN(p, phase) \
+	struct gps_prof p; gps_prof_begin(&p, phase)
+#define GPS_PROF_END(p)		gps_prof_end(&p)
+#else
+#define GPS_PROF_BEGIN(p, phase)
+#define GPS_PROF_END(p)
+#endif
+
+/*
+ * Library heap use by phase, kept once gps_mem_account turns it on.
+ * A thread's allocations are charged to the phase set by gps_mem_phase;
+ * gps_format, gps_load, gps_cmd_xfer, and gps_print set their own.
+ * gps_mem_stats with GPS_MEM_PHASES gives the totals.
+ */
+#define GPS_MEM_OTHER		0
+#define GPS_MEM_FORMAT		1
+#define GPS_MEM_LOAD		2
+#define GPS_MEM_DOWNLOAD	3
+#define GPS_MEM_PRINT		4
+#define GPS_MEM_PHASES		5
+
+struct gps_mem_stats {
+	long long allocs;		/* allocations */
+	long long frees;		/* frees */
+	long long bytes;		/* bytes allocated */
+	long long live;			/* bytes not yet freed */
+	long long peak;			/* high-water mark of live */
+};
+
+/*
+ * Function called with each packet of a transfer by gps_cmd_xfer.
+ * Returning a value greater than zero ends the transfer.
+ */
+typedef int (*gps_packet_fn)(gps_handle, enum gps_cmd_id, const u_char *,
+			     int, void *);
+
+/*
+ * Function called with each fix by gps_pvt.  Returning a value greater
+ * than zero ends the stream.
+ */
+typedef int (*gps_pvt_fn)(gps_handle, const struct gps_pvt *, void *);
+
 /*
  * The magic garmin "no value" value
  */
@@ -115,46 +406,128 @@ extern union no_val {
 	float f;
 } no_val;
 
-/*
- * opaque type to identify a gps state structure
- */
-typedef void * gps_handle;
-
+void	gps_abort(gps_handle);
+void	*gps_calloc(size_t, size_t);
+void	gps_cancel(gps_handle);
+int	gps_cancelled(gps_handle);
+void	gps_cap_parse(gps_handle, const u_char *, int);
+int	gps_cap_profile(gps_handle, const char *);
+int	gps_capabilities(gps_handle, int, int);
 void	gps_close(gps_handle);
+void	gps_close_all(void);
 int	gps_cmd(gps_handle, enum gps_cmd_id);
+int	gps_cmd_xfer(gps_handle, enum gps_cmd_id, gps_packet_fn, void *);
 int	gps_debug(gps_handle);
 void	gps_display(char, const u_char *, int);
+void	gps_drain(gps_handle);
+const struct gps_protocol *gps_find_protocol(gps_handle, int, int);
 struct gps_lists *gps_format(gps_handle, FILE *);
+void	gps_format_close(struct gps_format_state *);
+struct gps_lists *gps_format_files(gps_handle, FILE **, int, int);
+int	gps_format_next(gps_handle, struct gps_format_state *);
+int	gps_format_open(gps_handle, struct gps_format_state *, FILE *);
+u_char	*gps_frame(const u_char *, size_t *);
+void	gps_free(void *);
+double	gps_get_double(const u_char *);
 float	gps_get_float(const u_char *);
+struct gps_protocols *gps_get_protocols(gps_handle);
+struct gps_queue *gps_get_queue(gps_handle);
+const struct gps_rte_codec *gps_get_rte_hdr_codec(gps_handle);
 int	gps_get_rte_hdr_type(gps_handle);
+const struct gps_rte_codec *gps_get_rte_lnk_codec(gps_handle);
 int	gps_get_rte_lnk_type(gps_handle);
+const struct gps_wpt_codec *gps_get_rte_wpt_codec(gps_handle);
 int	gps_get_rte_wpt_type(gps_handle);
+struct gps_screen *gps_get_screen(gps_handle);
+int	gps_get_screen_format(gps_handle);
+const struct gps_trk_codec *gps_get_trk_codec(gps_handle);
+double	gps_get_trk_error(gps_handle);
+const struct gps_trk_codec *gps_get_trk_hdr_codec(gps_handle);
 int	gps_get_trk_hdr_type(gps_handle);
+int	gps_get_trk_limit(gps_handle);
 int	gps_get_trk_type(gps_handle);
+const struct gps_wpt_codec *gps_get_wpt_codec(gps_handle);
 int	gps_get_wpt_type(gps_handle);
+int	gps_get_xfer(gps_handle);
+int	gps_image_check(gps_handle, const struct gps_image *);
+void	gps_image_close(struct gps_image *);
+int	gps_image_open(gps_handle, struct gps_image *, FILE *);
+int	gps_image_write(gps_handle, struct gps_lists *, FILE *);
+void	gps_list_append(struct gps_list_head *, const u_char *, int);
+void	gps_list_free(struct gps_list_head *);
+void	gps_list_join(struct gps_list_head *, const struct gps_list_head *);
+struct gps_list_head *gps_list_new(int);
+int	gps_list_remove(struct gps_list_head *, const char *);
+void	gps_lists_free(struct gps_lists *);
 int	gps_load(gps_handle, struct gps_lists *);
+int	gps_load_image(gps_handle, const struct gps_image *);
+int	gps_load_stream(gps_handle, FILE *);
+void	*gps_malloc(size_t);
+void	gps_mem_account(int);
+int	gps_mem_phase(int);
+void	gps_mem_report(FILE *);
+void	gps_mem_reset(void);
+void	gps_mem_stats(int, struct gps_mem_stats *);
 gps_handle gps_open(const char *, int);
+gps_handle gps_open_profile(const char *, int);
 int	gps_print(gps_handle, enum gps_cmd_id, const u_char *, int);
 void	gps_printf(gps_handle, int, const char *, ...)
 	__attribute__((__format__(__printf__,3,4)));
+int	gps_probe(struct gps_probe *, int, double, int);
+void	gps_probe_free(struct gps_probe *, int);
 int	gps_product(gps_handle, int *, int *, char **);
+void	gps_prof_begin(struct gps_prof *, int);
+void	gps_prof_end(struct gps_prof *);
 int	gps_protocol_cap(gps_handle);
 int	gps_put_float(u_char *, float);
+int	gps_pvt(gps_handle, gps_pvt_fn, void *);
+int	gps_pvt_decode(const u_char *, int, struct gps_pvt *);
+int	gps_queue_acked(struct gps_queue *, int);
+void	gps_queue_clear(struct gps_queue *);
+void	gps_queue_free(struct gps_queue *);
+int	gps_queue_get(struct gps_queue *, int, u_char *, int *);
+struct gps_queue *gps_queue_new(void);
+int	gps_queue_put(struct gps_queue *, const u_char *, int);
+int	gps_queue_streamed(int);
 int	gps_read(gps_handle, u_char *, int);
+void	*gps_realloc(void *, size_t);
 int	gps_recv(gps_handle, int, u_char *, int *);
+int	gps_recv_type(gps_handle, int, int, u_char *, int *);
+const struct gps_rte_codec *gps_rte_codec(int);
+const u_char *gps_screen_color(const struct gps_screen *, u_int, u_int);
+int	gps_screen_delta(struct gps_screen *, FILE *);
+void	gps_screen_free(struct gps_screen *);
+u_int	gps_screen_height(const struct gps_screen *);
+struct gps_screen *gps_screen_new(void);
+int	gps_screen_packet(struct gps_screen *, const u_char *, int);
+void	gps_screen_reset(struct gps_screen *);
+u_int	gps_screen_width(const struct gps_screen *);
+int	gps_screen_write(const struct gps_screen *, FILE *, int);
 double	gps_semicircle2double(const u_char *);
 int	gps_send(gps_handle, const u_char *, int);
 int	gps_send_ack(gps_handle, u_char);
+int	gps_send_framed(gps_handle, const u_char *, size_t, int);
 int	gps_send_nak(gps_handle, u_char);
 int	gps_send_wait(gps_handle, const u_char *, int, int);
+void	gps_set_deadline(gps_handle, double);
 void	gps_set_rte_hdr_type(gps_handle, int);
 void	gps_set_rte_lnk_type(gps_handle, int);
 void	gps_set_rte_wpt_type(gps_handle, int);
+void	gps_set_screen_format(gps_handle, int);
+void	gps_set_trk_error(gps_handle, double);
 void	gps_set_trk_hdr_type(gps_handle, int);
+void	gps_set_trk_limit(gps_handle, int);
 void	gps_set_trk_type(gps_handle, int);
 void	gps_set_wpt_type(gps_handle, int);
+void	gps_set_xfer(gps_handle, int);
+int	gps_simplify(gps_handle, struct gps_list_head *);
+char	*gps_strdup(const char *);
+int	gps_sync(gps_handle, struct gps_lists *);
+const struct gps_trk_codec *gps_trk_codec(int);
+gps_handle gps_try_open(const char *, int);
 int	gps_version(gps_handle, int);
 int	gps_wait(gps_handle, u_char, int);
+const struct gps_wpt_codec *gps_wpt_codec(int);
 int	gps_write(gps_handle, const u_char *, size_t);
 
 /*
@@ -0,0 +1,159 @@
+/*
+ * Public Domain, 2026, Marco S Hyman <marc@snafu.org>
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpslib.h"
+
+/*
+ * Upload lists.
+ *
+ * The records of a list are packed back to back at their encoded
+ * length in one growing block.  An array of offsets, one longer than
+ * the number of records, locates each record; the length of a record
+ * is the difference between its offset and the next.  A list is two
+ * allocations no matter how many records it holds.
+ */
+
+#define LIST_DATA	4096		/* initial size of record data */
+#define LIST_SLOTS	64		/* initial number of offsets */
+
+/*
+ * Create an empty list of the given type
+ */
+struct gps_list_head *
+gps_list_new(int type)
+{
+	struct gps_list_head *list;
+
+	list = gps_malloc(sizeof(struct gps_list_head));
+	assert(list != NULL);
+	list->type = type;
+	list->count = 0;
+	list->slots = LIST_SLOTS;
+	list->off = gps_malloc((list->slots + 1) * sizeof *list->off);
+	assert(list->off != NULL);
+	list->off[0] = 0;
+	list->size = LIST_DATA;
+	list->data = gps_malloc(list->size);
+	assert(list->data != NULL);
+	return list;
+}
+
+/*
+ * Copy a record of the given length to the end of the list
+ */
+void
+gps_list_append(struct gps_list_head *list, const u_char *rec, int len)
+{
+	u_int32_t end = list->off[list->count];
+
+	if (list->count == list->slots) {
+		list->slots *= 2;
+		list->off = gps_realloc(list->off,
+				    (list->slots + 1) * sizeof *list->off);
+		assert(list->off != NULL);
+	}
+	if (end + len > list->size) {
+		while (end + len > list->size)
+			list->size *= 2;
+		list->data = gps_realloc(list->data, list->size);
+		assert(list->data != NULL);
+	}
+	memcpy(list->data + end, rec, len);
+	list->count += 1;
+	list->off[list->count] = end + len;
+}
+
+/*
+ * Remove the records whose entry in drop is non-zero, moving the
+ * remaining records down to close the gaps.  Returns the number of
+ * records removed.
+ */
+int
+gps_list_remove(struct gps_list_head *list, const char *drop)
+{
+	u_int32_t from;
+	u_int32_t to = 0;
+	u_int32_t len;
+	int kept = 0;
+	int removed;
+	int ix;
+
+	for (ix = 0; ix < list->count; ix++) {
+		from = list->off[ix];
+		len = list->off[ix + 1] - from;
+		if (drop[ix])
+			continue;
+		if (to != from)
+			memmove(list->data + to, list->data + from, len);
+		list->off[kept++] = to;
+		to += len;
+	}
+	list->off[kept] = to;
+	removed = list->count - kept;
+	list->count = kept;
+	return removed;
+}
+
+/*
+ * Append the records of src to dst
+ */
+void
+gps_list_join(struct gps_list_head *dst, const struct gps_list_head *src)
+{
+	u_int32_t end = dst->off[dst->count];
+	u_int32_t len = src->off[src->count];
+	int ix;
+
+	if (dst->count + src->count > dst->slots) {
+		while (dst->count + src->count > dst->slots)
+			dst->slots *= 2;
+		dst->off = gps_realloc(dst->off,
+				   (dst->slots + 1) * sizeof *dst->off);
+		assert(dst->off != NULL);
+	}
+	if (end + len > dst->size) {
+		while (end + len > dst->size)
+			dst->size *= 2;
+		dst->data = gps_realloc(dst->data, dst->size);
+		assert(dst->data != NULL);
+	}
+	memcpy(dst->data + end, src->data, len);
+	for (ix = 1; ix <= src->count; ix++)
+		dst->off[dst->count + ix] = end + src->off[ix];
+	dst->count += src->count;
+}
+
+/*
+ * Release a list and its records
+ */
+void
+gps_list_free(struct gps_list_head *list)
+{
+	gps_free(list->off);
+	gps_free(list->data);
+	gps_free(list);
+}
+
+/*
+ * Release the lists and all of their records
+ */
+void
+gps_lists_free(struct gps_lists *lists)
+{
+	struct gps_lists *next;
+
+	while (lists) {
+		next = lists->next;
+		gps_list_free(lists->list);
+		gps_free(lists);
+		lists = next;
+	}
+}
@@ -18,28 +18,38 @@
  */
 
 /*
- * Send a start transfer.
+ * Send a start transfer.  A section with more records than the count
+ * can hold is refused: splitting it would break routes and tracks.
  */
 static int
 start_load(gps_handle gps, int records)
 {
 	u_char buf[4];
 
+	if (records > GPS_XFER_MAX) {
+		gps_printf(gps, 0, "%s: %d records, at most %d per section\n",
+			   __func__, records, GPS_XFER_MAX);
+		return -1;
+	}
 	gps_printf(gps, 3, "%s: send\n", __func__);
 	buf[0] = p_xfr_begin;
 	buf[1] = (u_char) records;
 	buf[2] = (u_char) (records >> 8);
-	return gps_send_wait(gps, buf, 3, 2);
+	if (gps_send_wait(gps, buf, 3, 2) != 1)
+		return -1;
+	gps_set_xfer(gps, GPS_XFER_UP);
+	return 1;
 }
 
 static int
-do_load(gps_handle gps, struct gps_list_entry *entry)
+do_load(gps_handle gps, struct gps_list_head *list)
 {
-	while (entry) {
-		if (gps_send_wait(gps, entry->data, entry->data_len, 2) != 1)
+	int ix;
+
+	for (ix = 0; ix < list->count; ix++)
+		if (gps_send_wait(gps, GPS_LIST_REC(list, ix),
+				  GPS_LIST_LEN(list, ix), 2) != 1)
 			return -1;
-		entry = entry->next;
-	}
 	return 1;
 }
 
@@ -52,19 +62,38 @@ end_load(gps_handle gps, int type)
 	buf[0] = p_xfr_end;
 	buf[1] = (u_char) type;
 	buf[2] = (u_char) (type >> 8);
-	return gps_send_wait(gps, buf, 3, 2);
+	if (gps_send_wait(gps, buf, 3, 2) != 1) {
+		gps_abort(gps);
+		return -1;
+	}
+	gps_set_xfer(gps, GPS_XFER_NONE);
+	return 1;
 }
 
+/*
+ * The work of gps_load
+ */
 static int
-cancel_load(gps_handle gps)
+load_lists(gps_handle gps, struct gps_lists * lists)
 {
-	u_char buf[4];
-
-	gps_printf(gps, 3, "%s: send\n", __func__);
-	buf[0] = p_xfr_end;
-	buf[1] = (u_char) CMD_ABORT_XFR;
-	buf[2] = 0;
-	return gps_send_wait(gps, buf, 3, 5);
+	while (lists) {
+		if (lists->list->count == 0) {
+			/* nothing left to send, e.g. after gps_sync */
+			lists = lists->next;
+			continue;
+		}
+		if (start_load(gps, lists->list->count) != 1)
+			return -1;
+		if (do_load(gps, lists->list) != 1) {
+			gps_abort(gps);
+			return -1;
+		} else {
+			if (end_load(gps, lists->list->type) != 1)
+				return -1;
+		}
+		lists = lists->next;
+	}
+	return 1;
 }
 
 /*
@@ -74,17 +103,158 @@ cancel_load(gps_handle gps)
 int
 gps_load(gps_handle gps, struct gps_lists * lists)
 {
-	while (lists) {
-		if (start_load(gps, lists->list->count) != 1)
-			return -1;
-		if (do_load(gps, lists->list->head) != 1) {
-			cancel_load(gps);
+	int phase = gps_mem_phase(GPS_MEM_LOAD);
+	int stat;
+	GPS_PROF_BEGIN(prof, GPS_PROF_LOAD);
+
+	stat = load_lists(gps, lists);
+	GPS_PROF_END(prof);
+	gps_mem_phase(phase);
+	return stat;
+}
+
+/*
+ * The work of gps_load_image
+ */
+static int
+load_image(gps_handle gps, const struct gps_image *img)
+{
+	const struct gps_image_section *sec;
+	const u_char *p;
+	size_t len;
+	int ix;
+	int n;
+
+	for (ix = 0; ix < img->nsections; ix++) {
+		sec = &img->sections[ix];
+		if (sec->count == 0)
+			continue;
+		gps_printf(gps, 2, "%s: %d records\n", __func__, sec->count);
+		if (start_load(gps, sec->count) != 1)
 			return -1;
-		} else {
-			if (end_load(gps, lists->list->type) != 1)
+		p = sec->frames;
+		for (n = 0; n < sec->count; n++) {
+			len = p[0] | p[1] << 8;
+			if (gps_send_framed(gps, p + 2, len, 2) != 1) {
+				gps_abort(gps);
 				return -1;
+			}
+			p += 2 + len;
 		}
-		lists = lists->next;
+		if (end_load(gps, sec->type) != 1)
+			return -1;
 	}
 	return 1;
 }
+
+/*
+ * Load an upload image.  The image must have been checked against the
+ * unit with gps_image_check.  Return 1 if upload successful, -1
+ * otherwise.
+ */
+int
+gps_load_image(gps_handle gps, const struct gps_image *img)
+{
+	int phase = gps_mem_phase(GPS_MEM_LOAD);
+	int stat;
+	GPS_PROF_BEGIN(prof, GPS_PROF_LOAD);
+
+	stat = load_image(gps, img);
+	GPS_PROF_END(prof);
+	gps_mem_phase(phase);
+	return stat;
+}
+
+/*
+ * Count the records in the section that starts at the current input
+ * position, then return to that position.
+ */
+static int
+count_section(gps_handle gps, struct gps_format_state *fs)
+{
+	size_t pos = fs->pos;
+	int state = fs->state;
+	int count = 0;
+
+	while (gps_format_next(gps, fs) == GPS_FORMAT_DATA)
+		count += fs->npkt;
+	fs->pos = pos;
+	fs->state = state;
+	return count;
+}
+
+/*
+ * The work of gps_load_stream
+ */
+static int
+load_stream(gps_handle gps, FILE *stream)
+{
+	struct gps_format_state fs;
+	int sections = 0;
+	int count;
+	int ret = -1;
+	int ix;
+
+	if (gps_format_open(gps, &fs, stream) == -1) {
+		gps_printf(gps, 0, "%s: can't read input\n", __func__);
+		gps_format_close(&fs);
+		return -1;
+	}
+
+	for (;;) {
+		switch (gps_format_next(gps, &fs)) {
+		case GPS_FORMAT_EOF:
+			ret = sections ? 1 : 0;
+			goto done;
+		case GPS_FORMAT_SECTION:
+			break;
+		default:
+			continue;
+		}
+		sections += 1;
+		count = count_section(gps, &fs);
+		if (count == 0) {
+			/* skip to the end of the empty section */
+			while (gps_format_next(gps, &fs) == GPS_FORMAT_DATA)
+				;
+			continue;
+		}
+		gps_printf(gps, 2, "%s: %d records\n", __func__, count);
+		if (start_load(gps, count) != 1)
+			goto done;
+		while (gps_format_next(gps, &fs) == GPS_FORMAT_DATA)
+			for (ix = 0; ix < fs.npkt; ix++)
+				if (gps_send_wait(gps, fs.pkt[ix], fs.len[ix],
+						  2) != 1) {
+					gps_abort(gps);
+					goto done;
+				}
+		if (end_load(gps, fs.type) != 1)
+			goto done;
+	}
+
+done:
+	gps_format_close(&fs);
+	return ret;
+}
+
+/*
+ * Load the file given in the format output by gpsprint without
+ * building lists.  Each section is parsed twice: once to count its
+ * records for the transfer begin packet and once to encode and send
+ * them.  Only the packets of the current input line are held in
+ * memory.  Return 1 if upload successful, 0 if the file held no
+ * data, or -1 otherwise.
+ */
+int
+gps_load_stream(gps_handle gps, FILE *stream)
+{
+	int phase = gps_mem_phase(GPS_MEM_LOAD);
+	int stat;
+	GPS_PROF_BEGIN(prof, GPS_PROF_LOAD);
+
+	stat = load_stream(gps, stream);
+	GPS_PROF_END(prof);
+	gps_mem_phase(phase);
+	return stat;
+}
@@ -0,0 +1,263 @@
+/*
+ * Public Domain, 2026, Marco S Hyman <marc@snafu.org>
+ */
+
+#include <sys/types.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpslib.h"
+
+/*
+ * Library memory accounting.
+ *
+ * All library heap memory comes from gps_malloc and friends and goes
+ * back through gps_free.  Each block carries a small header holding
+ * its size and the phase it was allocated in, taken from the calling
+ * thread's current phase (see gps_mem_phase).  Once gps_mem_account
+ * turns accounting on the allocations, frees, bytes, live bytes, and
+ * high-water mark of live bytes are kept per phase and in total.  A
+ * block is charged to the phase that allocated it even when another
+ * phase frees it.  Blocks allocated while accounting is off are never
+ * counted.  Input files mapped by gps_format are not heap memory and
+ * are not counted.
+ */
+
+#define UNCOUNTED	-1
+
+union mem_hdr {
+	struct {
+		size_t	size;		/* bytes asked for */
+		int	phase;		/* charged to, or UNCOUNTED */
+	} h;
+	long double align_ld;		/* keep the block aligned */
+	void	*align_p;
+	long long align_ll;
+};
+
+static const char *phase_names[GPS_MEM_PHASES] = {
+	"other",
+	"format",
+	"load",
+	"download",
+	"print",
+};
+
+/* per phase counts, the last entry is the total */
+static struct gps_mem_stats stats[GPS_MEM_PHASES + 1];
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile int mem_on;
+static __thread int mem_phase;
+
+static void
+charge(int phase, size_t size)
+{
+	struct gps_mem_stats *st;
+	int ix;
+
+	pthread_mutex_lock(&mem_lock);
+	for (ix = 0; ix < 2; ix++) {
+		st = &stats[ix ? GPS_MEM_PHASES : phase];
+		st->allocs += 1;
+		st->bytes += size;
+		st->live += size;
+		if (st->live > st->peak)
+			st->peak = st->live;
+	}
+	pthread_mutex_unlock(&mem_lock);
+}
+
+static void
+credit(int phase, size_t size)
+{
+	struct gps_mem_stats *st;
+	int ix;
+
+	pthread_mutex_lock(&mem_lock);
+	for (ix = 0; ix < 2; ix++) {
+		st = &stats[ix ? GPS_MEM_PHASES : phase];
+		st->frees += 1;
+		st->live -= size;
+	}
+	pthread_mutex_unlock(&mem_lock);
+}
+
+/*
+ * Fill in a header for a block of size bytes and return the block
+ */
+static void *
+block(union mem_hdr *hdr, size_t size)
+{
+	hdr->h.size = size;
+	hdr->h.phase = UNCOUNTED;
+	if (mem_on) {
+		hdr->h.phase = mem_phase;
+		charge(mem_phase, size);
+	}
+	return hdr + 1;
+}
+
+/*
+ * malloc(3) for library memory.  Release with gps_free.
+ */
+void *
+gps_malloc(size_t size)
+{
+	union mem_hdr *hdr;
+
+	if (size > (size_t) -1 - sizeof *hdr ||
+	    (hdr = malloc(sizeof *hdr + size)) == NULL)
+		return NULL;
+	return block(hdr, size);
+}
+
+/*
+ * calloc(3) for library memory.  Release with gps_free.
+ */
+void *
+gps_calloc(size_t count, size_t size)
+{
+	void *p;
+
+	if (size != 0 && count > ((size_t) -1 - sizeof(union mem_hdr)) / size)
+		return NULL;
+	if ((p = gps_malloc(count * size)) != NULL)
+		memset(p, 0, count * size);
+	return p;
+}
+
+/*
+ * realloc(3) for library memory.  The block is charged to the current
+ * phase as a free of the old size and an allocation of the new.
+ */
+void *
+gps_realloc(void *ptr, size_t size)
+{
+	union mem_hdr *hdr;
+	union mem_hdr *new;
+
+	if (ptr == NULL)
+		return gps_malloc(size);
+	hdr = (union mem_hdr *) ptr - 1;
+	if (size > (size_t) -1 - sizeof *hdr ||
+	    (new = realloc(hdr, sizeof *new + size)) == NULL)
+		return NULL;
+	if (new->h.phase != UNCOUNTED)
+		credit(new->h.phase, new->h.size);
+	return block(new, size);
+}
+
+/*
+ * strdup(3) for library memory.  Release with gps_free.
+ */
+char *
+gps_strdup(const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *p;
+
+	if ((p = gps_malloc(len)) != NULL)
+		memcpy(p, str, len);
+	return p;
+}
+
+/*
+ * Release memory from gps_malloc, gps_calloc, gps_realloc, or
+ * gps_strdup, including memory the library hands to its callers such
+ * as the frames of gps_frame.
+ */
+void
+gps_free(void *ptr)
+{
+	union mem_hdr *hdr;
+
+	if (ptr == NULL)
+		return;
+	hdr = (union mem_hdr *) ptr - 1;
+	if (hdr->h.phase != UNCOUNTED)
+		credit(hdr->h.phase, hdr->h.size);
+	free(hdr);
+}
+
+/*
+ * Turn accounting on (non zero) or off.  Turning it on does not clear
+ * the counts, see gps_mem_reset.
+ */
+void
+gps_mem_account(int on)
+{
+	mem_on = on;
+}
+
+/*
+ * Charge the calling thread's allocations to phase, one of the
+ * GPS_MEM_ values, and return the phase it replaces.
+ */
+int
+gps_mem_phase(int phase)
+{
+	int old = mem_phase;
+
+	if (phase >= 0 && phase < GPS_MEM_PHASES)
+		mem_phase = phase;
+	return old;
+}
+
+/*
+ * Zero the counts.  Live bytes are kept as the blocks are still to be
+ * freed; the high-water marks restart from them.
+ */
+void
+gps_mem_reset(void)
+{
+	int ix;
+
+	pthread_mutex_lock(&mem_lock);
+	for (ix = 0; ix <= GPS_MEM_PHASES; ix++) {
+		stats[ix].allocs = 0;
+		stats[ix].frees = 0;
+		stats[ix].bytes = 0;
+		stats[ix].peak = stats[ix].live;
+	}
+	pthread_mutex_unlock(&mem_lock);
+}
+
+/*
+ * Copy the counts of a phase, or the totals if phase is
+ * GPS_MEM_PHASES, into st.
+ */
+void
+gps_mem_stats(int phase, struct gps_mem_stats *st)
+{
+	if (phase < 0 || phase > GPS_MEM_PHASES) {
+		memset(st, 0, sizeof *st);
+		return;
+	}
+	pthread_mutex_lock(&mem_lock);
+	*st = stats[phase];
+	pthread_mutex_unlock(&mem_lock);
+}
+
+/*
+ * Print the counts of every phase that allocated and the totals
+ */
+void
+gps_mem_report(FILE *fp)
+{
+	struct gps_mem_stats st;
+	int ix;
+
+	fprintf(fp, "%-9s %10s %10s %14s %12s %12s\n", "phase", "allocs",
+		"frees", "bytes", "live", "peak");
+	for (ix = 0; ix <= GPS_MEM_PHASES; ix++) {
+		gps_mem_stats(ix, &st);
+		if (st.allocs == 0 && st.live == 0 && ix != GPS_MEM_PHASES)
+			continue;
+		fprintf(fp, "%-9s %10lld %10lld %14lld %12lld %12lld\n",
+			ix == GPS_MEM_PHASES ? "total" : phase_names[ix],
+			st.allocs, st.frees, st.bytes, st.live, st.peak);
+	}
+}
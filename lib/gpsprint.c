@@ -31,50 +31,6 @@
  */
 #define UNIX_TIME_OFFSET	631065600L
 
-/*
- * Grab n strings from the given buffer.   Each string is
- * assumed to be NULL terminated with a maximum of 50 characters
- * before the NULL.   Enforce this by truncation if necessary.
- */
-#define STRING_MAX 51
-static void
-get_strings(const u_char *buf, int bufsiz, u_short off, char *strings[],
-	    int string_cnt)
-{
-	int ix;
-
-	for (ix = 0; ix < string_cnt; ix++) {
-		strings[ix] = malloc(STRING_MAX);
-		if (strings[ix] != NULL) {
-			if (off > 0 && bufsiz > off)
-				off += strlcpy(strings[ix],
-					       (const char *) &buf[off],
-					       STRING_MAX) + 1;
-			else
-				*strings[ix] = 0;
-		}
-	}
-}
-
-/*
- * Grab a string from a buffer given its offset and length.   Note,
- * the only size requirement is that the offset start before the
- * end of the buffer.
- */
-static char *
-get_string(const u_char *buf, int bufsiz, u_short off, u_short len)
-{
-	char *str = NULL;
-
-	if (off != 0 && bufsiz > off) {
-		str = malloc((size_t) len + 1);
-		if (str != NULL)
-			strlcpy(str, (const char *) &buf[off],
-				(size_t) len + 1);
-	}
-	return str;
-}
-
 /*
  * grab an integer value from a little endian buffer given its offset and
  * length.
@@ -96,115 +52,52 @@ get_int(const u_char *buf, int bufsiz, u_short off, u_short len)
 }
 
 /*
- * Table of offsets/lengths  for the various fields in each waypoint type
- * needed to print the waypoint.   An offset of 0 indicates that the field
- * does not exist in the given waypoint type.   A length of zero indicates
- * the beginning of a table of null terminated strings.
- * The packet type is at offset 0, thus the first character of the first
- * field starts at offset 1.
+ * True for the waypoint types with a fixed length ident and comment
  */
-struct wpt_info {
-	int	wpt_type;
-	u_short	lat_off;	/* length always 4 */
-	u_short	long_off;	/* length always 4 */
-	u_short	name_off;	/* length always 6 */
-	u_short	alt_off;	/* length always 4 */
-	u_short	sym_off;
-	u_short	sym_len;
-	u_short	disp_off;	/* length always 1 */
-	u_short	class_off;	/* length always 1 */
-	u_short	subclass_off;
-	u_short	subclass_len;
-	u_short	cmnt_off;
-	u_short	cmnt_len;
-};
-
-static struct wpt_info winfo[] = {
-/*	  typ  lat lon alt nam -sym- dsp cls -sub-  -cmnt- */
-	{ D100,  7, 11, 1,  0,  0, 0,  0, 0, 0, 0,  19, 40 },
-	{ D101,  7, 11, 1,  0, 63, 1,  0, 0, 0, 0,  19, 40 },
-	{ D102,  7, 11, 1,  0, 63, 2,  0, 0, 0, 0,  19, 40 },
-	{ D103,  7, 11, 1,  0, 59, 1, 60, 0, 0, 0,  19, 40 },
-	{ D104,  7, 11, 1,  0, 63, 2, 65, 0, 0, 0,  19, 40 },
-	{ D105,  1,  5, 0,  0,  9, 2,  0, 0, 0, 0,  11,  0 },
-	{ D106, 15, 19, 0,  0, 23, 2,  0, 1, 2, 13, 25,  0 },
-	{ D107,  7, 11, 1,  0, 59, 1, 60, 0, 0, 0,  19, 40 },
-	{ D108, 25, 29, 0, 33,  5, 2,  3, 1, 7, 18, 49,  0 },
-	{ D109, 25, 29, 0, 33,  5, 2,  0, 2, 7, 18, 53,  0 }
-};
-
-static struct wpt_info *
-find_wpt_info(int type)
+static int
+fixed_strings(int type)
 {
-	int ix;
-	for (ix = 0; ix < sizeof winfo / sizeof winfo[0]; ix++)
-		if (winfo[ix].wpt_type == type)
-			return &winfo[ix];
-	return NULL;
+	return type == D100 || type == D101 || type == D102 || type == D103 ||
+	    type == D104 || type == D107;
 }
 
 static void
-print_waypoint(const u_char *wpt, int len, int type)
+print_waypoint(const u_char *wpt, int len, const struct gps_wpt_codec *wc,
+	       int type)
 {
-	struct wpt_info *wi;
-	const u_char *w;
-	double lat;
-	double lon;
-	char *name;
-	char *cmnt[2];
-	long sym;
-	long dsp;
-	long class;
-	float alt;
-
-	wi = find_wpt_info(type);
-	if (wi != NULL) {
-		lat = gps_semicircle2double(&wpt[wi->lat_off]);
-		lon = gps_semicircle2double(&wpt[wi->long_off]);
-		printf("%12.8f %13.8f", lat, lon);
-
-		if (wi->alt_off)
-			alt = gps_get_float(&wpt[wi->alt_off]);
-		else
-			alt = no_val.f;
-		if ((alt != no_val.f) && alt < 5.0e24)
-			printf(" A:%11f",alt);
-
-		sym = get_int(wpt, len, wi->sym_off, wi->sym_len);
-		if (sym != -1)
-			printf(" S:%ld", sym);
-
-		dsp = get_int(wpt, len, wi->disp_off, 1);
-		if (dsp != -1) {
-			printf(" D:%ld", dsp);
+	struct gps_wpt w;
+	const u_char *s;
+	int ok;
+	GPS_PROF_BEGIN(prof, GPS_PROF_DECODE);
+
+	ok = wc != NULL && wc->decode(wpt, len, &w) == 0;
+	GPS_PROF_END(prof);
+	if (ok) {
+		printf("%12.8f %13.8f", w.lat, w.lon);
+
+		if ((w.alt != no_val.f) && w.alt < 5.0e24)
+			printf(" A:%11f", w.alt);
+
+		if (w.sym != -1)
+			printf(" S:%ld", w.sym);
+
+		/* D109 display and color are not printed */
+		if (w.dsp != -1 && wc->type != D109) {
+			printf(" D:%ld", w.dsp);
 		}
 
-		if (wi->name_off) {
-			/* old style: fixed len name/comment */
-			name = get_string(wpt, len, wi->name_off, 6);
-			if (name) {
-				printf(" I:%s", name);
-				free(name);
-			}
-			cmnt[0] = get_string(wpt, len, wi->cmnt_off,
-					     wi->cmnt_len);
-			if (cmnt[0]) {
-				printf(" C:%s", cmnt[0]);
-				free(cmnt[0]);
-			}
+		if (fixed_strings(wc->type)) {
+			/* old style: fixed len name/comment, always printed */
+			if (w.ident.str)
+				printf(" I:%.*s", w.ident.len, w.ident.str);
+			if (w.cmnt.str)
+				printf(" C:%.*s", w.cmnt.len, w.cmnt.str);
 		} else {
 			/* new style: null terminated ident/comment */
-			get_strings(wpt, len, wi->cmnt_off, cmnt, 2);
-			if (cmnt[0]) {
-				if (*cmnt[0])
-					printf(" I:%s", cmnt[0]);
-				free(cmnt[0]);
-			}
-			if (cmnt[1]) {
-				if (*cmnt[1])
-					printf(" C:%s", cmnt[1]);
-				free(cmnt[1]);
-			}
+			if (w.ident.len)
+				printf(" I:%.*s", w.ident.len, w.ident.str);
+			if (w.cmnt.len)
+				printf(" C:%.*s", w.cmnt.len, w.cmnt.str);
 		}
 
 		/*
@@ -213,113 +106,50 @@ print_waypoint(const u_char *wpt, int len, int type)
 		 * if it exists and is not zero (zero is a user waypoint).
 		 */
 
-		class = get_int(wpt, len, wi->class_off, 1);
-		if (class != -1 && class != 0) {
-			printf(" W:%02x", (int) class);
-			for (w = &wpt[wi->subclass_off];
-			     w < &wpt[wi->subclass_off + wi->subclass_len]; w++)
-				printf("%02x", *w);
+		if (w.class != -1 && w.class != 0) {
+			printf(" W:%02x", (int) w.class);
+			for (s = w.subclass; s < &w.subclass[w.subclass_len];
+			     s++)
+				printf("%02x", *s);
 		}
 	} else
 		warnx("unknown waypoint packet type: %d", type);
 }
 
-/*
- * Table of offsets and lengths for route related packets
- */
-struct rte_info {
-	int	rte_type;
-	int	num_off;
-	u_short	cmnt_off;	/* or ident */
-	u_short	cmnt_len;
-	u_short	class_off;
-	u_short class_len;
-};
-
-static struct rte_info rinfo[] = {
-	{ D200, 1,  0,  0, 0, 0 },
-	{ D201, 1,  2, 20, 0, 0 },
-	{ D202, 0,  1,  0, 0, 0 },
-	{ D210, 0, 21,  0, 1, 2 }
-};
-
-static struct rte_info *
-find_rte_info(int type)
-{
-	int ix;
-	for (ix = 0; ix < sizeof rinfo / sizeof rinfo[0]; ix++)
-		if (rinfo[ix].rte_type == type)
-			return &rinfo[ix];
-	return NULL;
-}
-
 static void
-print_route(const u_char *rte, int len, int type)
+print_route(const u_char *rte, int len, const struct gps_rte_codec *rc,
+	    int type)
 {
-	struct rte_info *ri;
-	long num;
-	char *id;
-
-	ri = find_rte_info(type);
-	if (ri != NULL) {
-		num = get_int(rte, len, ri->num_off, 1);
-		if (ri->cmnt_len)
-			id = get_string(rte, len, ri->cmnt_off, ri->cmnt_len);
-		else
-			get_strings(rte, len, ri->cmnt_off, &id, 1);
-		printf("**%ld %s\n", num == -1 ? 0 : num, id ? id : "");
+	struct gps_rte r;
+	int ok;
+	GPS_PROF_BEGIN(prof, GPS_PROF_DECODE);
+
+	ok = rc != NULL && rc->decode(rte, len, &r) == 0;
+	GPS_PROF_END(prof);
+	if (ok) {
+		printf("**%ld %.*s\n", r.num == -1 ? 0 : r.num, r.ident.len,
+		       r.ident.str ? r.ident.str : "");
 	} else
 		warnx("unknown route packet type: %d", type);
 }
 
 static void
-print_route_link(const u_char *rte, int len, int type)
+print_route_link(const u_char *rte, int len, const struct gps_rte_codec *rc,
+		 int type)
 {
-	struct rte_info *ri;
-	long class;
-
-	ri = find_rte_info(type);
-	if (ri != NULL) {
-		class = get_int(rte, len, ri->class_off, ri->class_len);
-		if (class != -1)
-			printf(" L:%ld\n", class);
+	struct gps_rte r;
+	int ok;
+	GPS_PROF_BEGIN(prof, GPS_PROF_DECODE);
+
+	ok = rc != NULL && rc->decode(rte, len, &r) == 0;
+	GPS_PROF_END(prof);
+	if (ok) {
+		if (r.class != -1)
+			printf(" L:%ld\n", r.class);
 	} else
 		warnx("unknown route link type: %d", type);
 }
 
-/*
- * Table of offsets and lengths for track related packets
- */
-struct trk_info {
-	int	trk_type;
-	u_short	lat_off;
-	u_short	long_off;
-	u_short time_off;
-	u_short time_len;
-	u_short	alt_off;
-	u_short	depth_off;
-	u_short	new_off;
-	u_short	new_len;
-	u_short ident_off;
-	u_short ident_len;
-};
-
-static struct trk_info tinfo[] = {
-	{ D300, 1, 5, 9, 4,  0,  0, 13, 1, 0,  0 },
-	{ D301, 1, 5, 9, 4, 13, 17, 21, 1, 0,  0 },
-	{ D310, 0, 0, 0, 0,  0,  0,  0, 0, 3, 51 }
-};
-
-static struct trk_info *
-find_trk_info(int type)
-{
-	int ix;
-	for (ix = 0; ix < sizeof tinfo / sizeof tinfo[0]; ix++)
-		if (tinfo[ix].trk_type == type)
-			return &tinfo[ix];
-	return NULL;
-}
-
 /*
  * print a track header or entry.  New entry format:
  *
@@ -327,44 +157,36 @@ find_trk_info(int type)
  *	[yyyy-mm-dd hh:mm:ss] 99.99999 999.99999 99.99 [start]
  */
 static void
-print_track(const u_char *trk, int len, int type)
+print_track(const u_char *trk, int len, const struct gps_trk_codec *tc,
+	    int type)
 {
-	struct trk_info *ti;
+	struct gps_trk t;
 	char buf[24];
-	char *id;
 	float lat;
 	float lon;
-	float alt;
 	time_t tim;
-	long new;
-
-	ti = find_trk_info(type);
-	if (ti != NULL) {
-		id = get_string(trk, len, ti->ident_off, ti->ident_len);
-		if (id) {
-			printf("Track: %s\n", id);
-			free(id);
-		} else {
-			lat = (float) gps_semicircle2double(&trk[ti->lat_off]);
-			lon = (float) gps_semicircle2double(&trk[ti->long_off]);
-			tim = (time_t) get_int(trk, len, ti->time_off,
-					       ti->time_len);
-			if (tim != -1) {
-				tim += UNIX_TIME_OFFSET;
+	int ok;
+	GPS_PROF_BEGIN(prof, GPS_PROF_DECODE);
+
+	ok = tc != NULL && tc->decode(trk, len, &t) == 0;
+	GPS_PROF_END(prof);
+	if (ok) {
+		if (t.ident.str)
+			printf("Track: %.*s\n", t.ident.len, t.ident.str);
+		else {
+			lat = (float) t.lat;
+			lon = (float) t.lon;
+			if (t.time != -1) {
+				tim = (time_t) t.time + UNIX_TIME_OFFSET;
 				strftime(buf, sizeof buf, "%Y-%m-%d %T ",
 					 gmtime(&tim));
 			} else
 				buf[0] = 0;
-			if (ti->alt_off)
-				alt = gps_get_float(&trk[ti->alt_off]);
-			else
-				alt = no_val.f;
 			/* skip depth for now */
-			new = get_int(trk, len, ti->new_off, ti->new_len);
 			printf("%s%12.8f %13.8f", buf, lat, lon);
-			if (alt != no_val.f)
-				printf(" %f", alt);
-			printf("%s\n", new ? " start" : "");
+			if (t.alt != no_val.f)
+				printf(" %f", t.alt);
+			printf("%s\n", t.new_trk ? " start" : "");
 		}
 	} else
 		warnx("unknown track packet type: %d", type);
@@ -385,11 +207,9 @@ print_time(const u_char *utc)
 }
 
 /*
- * print a screenshot in PPM format (use with redirect of stdout to a file)
- *
- * also trys to retrieve pressure reading from top left field of Altimeter
- * display and print it to stderr (only works if Altimeter display is
- * displayed in daytime mode and with pressure units set to inHg)
+ * Print the pressure reading from the top left field of the Altimeter
+ * display to stderr.  Only works if the Altimeter display is displayed
+ * in daytime mode and with pressure units set to inHg.
  *
  * (tested only on Garmin GPSmap 76CS)
  *
@@ -397,86 +217,85 @@ print_time(const u_char *utc)
  *
  */
 static void
-print_screenshot(const u_char *packet, int len)
+print_pressure(const struct gps_screen *scr)
 {
-	static int r[256], g[256], b[256];
-	static int j = 0;
-	static int x = 0, y = 0;
-	static unsigned char byte = 0;
-	static int bitcount = 0;
-	int i;
-	int k;
 	unsigned int digits_id[] = {
 		0x438, 0x249, 0x26B, 0x267, 0x3C6,
 		0x26F, 0x35F, 0x2A3, 0x4C7, 0x44F
 	};
+	unsigned int digit[4] = { 0, 0, 0, 0 };
+	u_int xlow[4] = { 8, 22, 40, 54 };
+	u_int xhigh[4] = { 20, 34, 52, 66 };
+	unsigned char byte = 0;
+	int bitcount = 0;
+	u_int x, y;
+	int i;
+	int k;
 
-	static unsigned int digit[4] = { 0, 0, 0, 0 };
-	int xlow[4] = { 8, 22, 40, 54 };
-	int xhigh[4] = { 20, 34, 52, 66 };
-  
-	static int printed = 0;
-
-	/* retrieve image size and output to PPM header  */
-	if ( j == 0 )
-		printf("P6\n%d,%d\n255\n", packet[17], packet[21]); 
-	else if (j >=1 && j <256) {
-		/* retrieve and store palette info */  
-		b[j-1] = packet[9];
-		g[j-1] = packet[10];
-		r[j-1] = packet[11];
-	} else if (j >= 257) {
-		/* image data */
-		/* process packet less header */
-		for (i=9; i<len; i++) { 
-			/* write RGB pixels */
-			fputc(r[packet[i]],stdout);
-			fputc(g[packet[i]],stdout);
-			fputc(b[packet[i]],stdout);
-
-			/* determine digits for pressure reading */
-	
-			for (k=0; k<4; k++) { 
-				if ((x >= xlow[k] && x <= xhigh[k]) &&
-				    (y >= 44 && y <=46 )) { 
-					byte = byte |
-					  ((r[packet[i]] != 255)<<(7-bitcount));
-					bitcount++;
-					if ((bitcount == 8) ||
-					    (x == xhigh[k])) {
-						digit[k] += byte;
-						bitcount = 0;
-						byte=0;
-					}
-				}
-			}
+	if (gps_screen_height(scr) <= 47 || gps_screen_width(scr) <= 66)
+		return;
 
-			/* update x and y coordinate counters of image */
-			x++;
-			if ( x == 160) {
-				x=0;
-				y++;
+	/* determine digits for pressure reading */
+	for (y = 44; y <= 46; y++) {
+		for (x = 0; x <= xhigh[3]; x++) {
+			for (k = 0; k < 4; k++) {
+				if (x < xlow[k] || x > xhigh[k])
+					continue;
+				byte = byte |
+				  ((gps_screen_color(scr, x, y)[0] != 255) <<
+				   (7 - bitcount));
+				bitcount++;
+				if ((bitcount == 8) || (x == xhigh[k])) {
+					digit[k] += byte;
+					bitcount = 0;
+					byte = 0;
+				}
 			}
 		}
+	}
 
-		/* convert and print pressure value */
-		if (y > 47 && !printed) { 
-			for (k = 0; k < 4; k++) {
-				i=0;
-				while ((digits_id[i] != digit[k]) && (i<=9))
-					i++;
-				digit[k]=i;
-			}
+	/* convert and print pressure value */
+	for (k = 0; k < 4; k++) {
+		i = 0;
+		while ((digits_id[i] != digit[k]) && (i <= 9))
+			i++;
+		digit[k] = i;
+	}
+	fprintf(stderr,
+		"[Altimeter Screen, "
+		"top left field: %d%d.%d%d inHg]\n",
+		digit[0], digit[1], digit[2], digit[3] );
+}
 
-			printed = 1;
+/*
+ * Add a packet to the screenshot of the handle.  When the image is
+ * complete print it (use with redirect of stdout to a file) in the
+ * format set on the handle, try to retrieve the pressure reading, and
+ * return 1 to end the transfer.
+ */
+static int
+print_screenshot(gps_handle gps, const u_char *packet, int len)
+{
+	struct gps_screen *scr = gps_get_screen(gps);
 
-			fprintf(stderr,
-				"[Altimeter Screen, "
-				"top left field: %d%d.%d%d inHg]\n",
-				digit[0], digit[1], digit[2], digit[3] );
-		} 
-	}  
-	j++;
+	if (scr == NULL) {
+		warnx("no memory for screenshot");
+		return 0;
+	}
+	switch (gps_screen_packet(scr, packet, len)) {
+	case 0:
+		return 0;
+	case 1:
+		if (gps_screen_write(scr, stdout, gps_get_screen_format(gps)))
+			warnx("can't write screenshot");
+		print_pressure(scr);
+		gps_screen_reset(scr);
+		return 1;
+	default:
+		/* the rest of the transfer is ignored by the decoder */
+		warnx("bad screenshot header");
+		return 0;
+	}
 }
 
 int
@@ -486,6 +305,9 @@ gps_print(gps_handle gps, enum gps_cmd_id cmd, const u_char *packet,
 	static int count;
 	static int limit;
 	static int rte_newline;
+	int done = 0;
+	int phase = gps_mem_phase(GPS_MEM_PRINT);
+	GPS_PROF_BEGIN(prof, GPS_PROF_PRINT);
 
 	if (packet[0] == p_xfr_end) {
 		if (rte_newline) {
@@ -493,6 +315,10 @@ gps_print(gps_handle gps, enum gps_cmd_id cmd, const u_char *packet,
 			printf("\n");
 		}
 		printf("[end transfer, %d/%d records]\n", count, limit);
+		/* the transfer is complete, let it out */
+		GPS_PROF_BEGIN(flush_prof, GPS_PROF_STDOUT);
+		fflush(stdout);
+		GPS_PROF_END(flush_prof);
 	} else {	
 		count += 1;
 		switch (packet[0]) {
@@ -527,7 +353,8 @@ gps_print(gps_handle gps, enum gps_cmd_id cmd, const u_char *packet,
 			}
 			break;
 		case p_wpt_data:
-			print_waypoint(packet, len, gps_get_wpt_type(gps));
+			print_waypoint(packet, len, gps_get_wpt_codec(gps),
+				       gps_get_wpt_type(gps));
 			printf("\n");
 			break;
 		case p_rte_hdr:
@@ -535,36 +362,43 @@ gps_print(gps_handle gps, enum gps_cmd_id cmd, const u_char *packet,
 				rte_newline = 0;
 				printf("\n");
 			}
-			print_route(packet, len, gps_get_rte_hdr_type(gps));
+			print_route(packet, len, gps_get_rte_hdr_codec(gps),
+				    gps_get_rte_hdr_type(gps));
 			break;
 		case p_rte_wpt_data:
 			if (rte_newline) {
 				rte_newline = 0;
 				printf("\n");
 			}
-			print_waypoint(packet, len, gps_get_rte_wpt_type(gps));
+			print_waypoint(packet, len, gps_get_rte_wpt_codec(gps),
+				       gps_get_rte_wpt_type(gps));
 			rte_newline = 1;
 			break;
 		case p_rte_link:
 			print_route_link(packet, len,
+					 gps_get_rte_lnk_codec(gps),
 					 gps_get_rte_lnk_type(gps));
 			rte_newline = 0;
 			break;
 		case p_trk_data:
-			print_track(packet, len, gps_get_trk_type(gps));
+			print_track(packet, len, gps_get_trk_codec(gps),
+				    gps_get_trk_type(gps));
 			break;
 		case p_utc_data:
 			print_time(packet);
 			break;
 		case p_trk_hdr:
-			print_track(packet, len, gps_get_trk_hdr_type(gps));
+			print_track(packet, len, gps_get_trk_hdr_codec(gps),
+				    gps_get_trk_hdr_type(gps));
 			break;
 		case p_scr_shot:
-			print_screenshot(packet, len);
+			done = print_screenshot(gps, packet, len);
 			break;
 		default:
 			printf("[unknown protocol %d]\n", packet[0]);
 		}
 	}
-	return 0;
+	GPS_PROF_END(prof);
+	gps_mem_phase(phase);
+	return done;
 }
@@ -0,0 +1,133 @@
+/*
+ * Public Domain, 2026, Marco S Hyman <marc@snafu.org>
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpslib.h"
+
+/*
+ * Port discovery.
+ *
+ * Every candidate port is opened and sent a product request at the
+ * same time, one thread per port.  All requests share one deadline so
+ * finding the units on many ports costs about one timeout instead of
+ * one per port.
+ */
+
+struct probe_arg {
+	struct gps_probe *probe;
+	int	debug;
+	double	deadline;
+};
+
+static double
+wall(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*
+ * Thread: ask the unit on one port for its product data
+ */
+static void *
+probe_port(void *arg)
+{
+	struct probe_arg *pa = arg;
+	struct gps_probe *p = pa->probe;
+	gps_handle gps;
+
+	if ((gps = gps_try_open(p->port, pa->debug)) == NULL) {
+		p->state = GPS_PROBE_ERROR;
+		p->error = errno;
+		return NULL;
+	}
+	gps_set_deadline(gps, pa->deadline);
+	if (gps_product(gps, &p->product_id, &p->software_version,
+			&p->description) == 0)
+		p->state = GPS_PROBE_FOUND;
+	else
+		p->state = GPS_PROBE_NONE;
+	gps_close(gps);
+	return NULL;
+}
+
+/*
+ * Probe the count ports named in probes for a unit, waiting no more
+ * than timeout seconds for any of them.  The port of each probe must
+ * be set; the other fields are filled in.  Ports that can't be probed
+ * in a thread of their own are probed in turn after the others.
+ * Returns the number of units found.  Free the descriptions with
+ * gps_probe_free.
+ */
+int
+gps_probe(struct gps_probe *probes, int count, double timeout, int debug)
+{
+	struct probe_arg *args;
+	pthread_t *tids;
+	int *started;
+	double deadline = wall() + timeout;
+	int found = 0;
+	int ix;
+
+	args = gps_calloc(count, sizeof *args);
+	tids = gps_calloc(count, sizeof *tids);
+	started = gps_calloc(count, sizeof *started);
+	if (args == NULL || tids == NULL || started == NULL) {
+		gps_free(args);
+		gps_free(tids);
+		gps_free(started);
+		return -1;
+	}
+	for (ix = 0; ix < count; ix++) {
+		probes[ix].state = GPS_PROBE_NONE;
+		probes[ix].error = 0;
+		probes[ix].product_id = 0;
+		probes[ix].software_version = 0;
+		probes[ix].description = NULL;
+		args[ix].probe = &probes[ix];
+		args[ix].debug = debug;
+		args[ix].deadline = deadline;
+		started[ix] = pthread_create(&tids[ix], NULL, probe_port,
+					     &args[ix]) == 0;
+	}
+	for (ix = 0; ix < count; ix++)
+		if (started[ix])
+			pthread_join(tids[ix], NULL);
+	for (ix = 0; ix < count; ix++) {
+		if (! started[ix]) {
+			args[ix].deadline = wall() + timeout;
+			probe_port(&args[ix]);
+		}
+		if (probes[ix].state == GPS_PROBE_FOUND)
+			found += 1;
+	}
+	gps_free(args);
+	gps_free(tids);
+	gps_free(started);
+	return found;
+}
+
+/*
+ * Release the product descriptions of the count probes
+ */
+void
+gps_probe_free(struct gps_probe *probes, int count)
+{
+	int ix;
+
+	for (ix = 0; ix < count; ix++) {
+		gps_free(probes[ix].description);
+		probes[ix].description = NULL;
+	}
+}
@@ -21,7 +21,7 @@
  * Retrieve the product information from the unit specified by
  * `gps' and return product information in productId, softwareVersion,
  * and productDescription.  *productDescription is allocated via
- * malloc and should be free'd when no longer needed.
+ * gps_malloc and should be gps_free'd when no longer needed.
  *
  * A product request is protocol ID 254, its response is 255.
  *
@@ -33,7 +33,7 @@ gps_product(gps_handle gps, int *product_id, int *software_version,
 {
 	u_char rqst = p_prod_rqst;
 	int retries = 5;
-	u_char *data = malloc(GPS_FRAME_MAX);
+	u_char *data = gps_malloc(GPS_FRAME_MAX);
 
 	if (! data) {
 		gps_printf(gps, 0, "%s: no memory\n", __func__);
@@ -45,7 +45,8 @@ gps_product(gps_handle gps, int *product_id, int *software_version,
 	while (retries--) {
 		if (gps_send_wait(gps, &rqst, 1, 5) == 1) {
 			int datalen = GPS_FRAME_MAX;
-			if (gps_recv(gps, 5, data, &datalen) == 1) {
+			if (gps_recv_type(gps, p_prod_resp, 5, data,
+					  &datalen) == 1) {
 				if (data[0] == p_prod_resp) {
 					gps_send_ack(gps, *data);
 					*product_id = data[1] + (data[2] << 8);
@@ -53,12 +54,12 @@ gps_product(gps_handle gps, int *product_id, int *software_version,
 						data[3] + (data[4] << 8);
 					if (datalen > 5)
 						*product_description =
-							strdup((char *) &data[5]);
+							gps_strdup((char *) &data[5]);
 					else
 						*product_description = 0;
 					gps_printf(gps, 3, 
 						   "%s: rcvd\n", __func__);
-					free(data);
+					gps_free(data);
 					return 0;
 				}
 			}
@@ -67,6 +68,6 @@ gps_product(gps_handle gps, int *product_id, int *software_version,
 		}
 	}
 	gps_printf(gps, 1, "%s: fail\n", __func__);
-	free(data);
+	gps_free(data);
 	return -1;
 }
@@ -0,0 +1,165 @@
+/*
+ * Public Domain, 2026, Marco S Hyman <marc@snafu.org>
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "gpslib.h"
+
+/*
+ * Session phase profiler.
+ *
+ * When the library is built with -DGPS_PROFILE the hot paths bracket
+ * their work with GPS_PROF_BEGIN and GPS_PROF_END.  Each phase keeps
+ * the number of calls, the total time from begin to end, and the self
+ * time: the total less the time spent in phases begun inside it.  A
+ * select wait inside a frame read inside gps_cmd_xfer is self time of
+ * the select phase only.  Times come from the monotonic clock and are
+ * summed over all threads.  The table is printed to stderr at exit.
+ *
+ * Without GPS_PROFILE the macros are empty and nothing here is called.
+ */
+
+static const char *phase_names[GPS_PROF_PHASES] = {
+	"open",			/* port open and termios setup */
+	"product",		/* product and capability probe */
+	"command",		/* gps_cmd, command and download */
+	"load",			/* gps_load, upload */
+	"format",		/* gps_format, text to packets */
+	"recv",			/* gps_recv, dispatch and queue */
+	"frame",		/* frame decode */
+	"ack",			/* ack send */
+	"select",		/* waiting for input */
+	"read",			/* read syscalls */
+	"write",		/* write syscalls to the unit */
+	"decode",		/* record decode */
+	"print",		/* gps_print output formatting */
+	"stdout",		/* stdout flushes */
+};
+
+struct phase {
+	long	calls;
+	double	total;
+	double	self;
+};
+
+static struct phase phases[GPS_PROF_PHASES];
+static pthread_mutex_t prof_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t prof_once = PTHREAD_ONCE_INIT;
+static __thread struct gps_prof *prof_top;	/* innermost open phase */
+static double prof_start;
+static struct rusage prof_ru;			/* usage at the first phase */
+
+/*
+ * Monotonic time in seconds
+ */
+static double
+prof_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+tv_secs(const struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/*
+ * Print the phase table and the process CPU time.  Waiting for the
+ * unit is the select time; the CPU columns against the session length
+ * tell whether a run was limited by the line or by the host.
+ */
+static void
+prof_report(void)
+{
+	struct rusage ru;
+	double session = prof_clock() - prof_start;
+	double user;
+	double sys;
+	int ix;
+
+	getrusage(RUSAGE_SELF, &ru);
+	user = tv_secs(&ru.ru_utime) - tv_secs(&prof_ru.ru_utime);
+	sys = tv_secs(&ru.ru_stime) - tv_secs(&prof_ru.ru_stime);
+	pthread_mutex_lock(&prof_lock);
+	fprintf(stderr, "%-8s %10s %12s %12s %10s %7s\n", "phase", "calls",
+		"self ms", "total ms", "self us", "self %");
+	for (ix = 0; ix < GPS_PROF_PHASES; ix++) {
+		if (phases[ix].calls == 0)
+			continue;
+		fprintf(stderr, "%-8s %10ld %12.3f %12.3f %10.3f %6.1f%%\n",
+			phase_names[ix], phases[ix].calls,
+			phases[ix].self * 1e3, phases[ix].total * 1e3,
+			phases[ix].self * 1e6 / phases[ix].calls,
+			session > 0 ? 100 * phases[ix].self / session : 0.0);
+	}
+	fprintf(stderr, "session %.3f s, cpu %.3f s user %.3f s system "
+		"(%.1f%%), select %.1f%%\n", session, user, sys,
+		session > 0 ? 100 * (user + sys) / session : 0.0,
+		session > 0 ?
+		100 * phases[GPS_PROF_SELECT].self / session : 0.0);
+	pthread_mutex_unlock(&prof_lock);
+}
+
+static void
+prof_init(void)
+{
+	getrusage(RUSAGE_SELF, &prof_ru);
+	prof_start = prof_clock();
+	atexit(prof_report);
+}
+
+/*
+ * Start timing a phase.  p lives on the caller's stack until the
+ * matching gps_prof_end.
+ */
+void
+gps_prof_begin(struct gps_prof *p, int phase)
+{
+	struct gps_prof *up;
+
+	pthread_once(&prof_once, prof_init);
+	p->phase = phase;
+	p->child = 0;
+	p->up = prof_top;
+	/* a phase begun inside itself adds to its self time only */
+	p->nested = 0;
+	for (up = prof_top; up; up = up->up)
+		if (up->phase == phase) {
+			p->nested = 1;
+			break;
+		}
+	prof_top = p;
+	p->start = prof_clock();
+}
+
+/*
+ * Stop timing the phase begun with p
+ */
+void
+gps_prof_end(struct gps_prof *p)
+{
+	double elapsed = prof_clock() - p->start;
+	struct phase *ph = &phases[p->phase];
+
+	prof_top = p->up;
+	if (p->up)
+		p->up->child += elapsed;
+	pthread_mutex_lock(&prof_lock);
+	ph->calls += 1;
+	ph->self += elapsed - p->child;
+	if (! p->nested)
+		ph->total += elapsed;
+	pthread_mutex_unlock(&prof_lock);
+}
@@ -0,0 +1,166 @@
+/*
+ * Public Domain, 2026, Marco S Hyman <marc@snafu.org>
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gpslib.h"
+
+/*
+ * Garmin GPS position, velocity, and time protocol (A800)
+ *
+ * host -> gps:	start pvt data command
+ * gps -> host:	pvt data, about once a second until stopped
+ * host -> gps:	stop pvt data command
+ *
+ * Every pvt packet is a D800.  Unlike a transfer there is no count and
+ * no end packet; the stream runs until the host stops it.
+ */
+
+/*
+ * The day numbers of a D800 count from Dec 31 1989, this many seconds
+ * after the start of UNIX time.
+ */
+#define UNIX_WEEK_OFFSET	631065600L
+
+#define D800_LEN	64		/* D800 packet length */
+#define PVT_TO		3		/* seconds to wait for a fix */
+#define PVT_NAKS	5		/* bad frames in a row to give up */
+
+#define RAD2DEG		(180.0 / M_PI)
+
+static long
+get16(const u_char *p)
+{
+	return (short) (p[0] | p[1] << 8);
+}
+
+static long
+get32(const u_char *p)
+{
+	return (long) (p[0] | p[1] << 8 | p[2] << 16 | (u_int32_t) p[3] << 24);
+}
+
+/*
+ * Decode the D800 pvt packet of the given length (including the packet
+ * id) into pvt.  pvt->when is not touched.  Returns 0 or -1 if the
+ * packet is not a pvt packet.
+ */
+int
+gps_pvt_decode(const u_char *pkt, int len, struct gps_pvt *pvt)
+{
+	const u_char *d = pkt + 1;
+
+	if (len < D800_LEN + 1 || *pkt != p_pvt_data)
+		return -1;
+	pvt->alt = gps_get_float(d) + gps_get_float(d + 54);
+	pvt->epe = gps_get_float(d + 4);
+	pvt->eph = gps_get_float(d + 8);
+	pvt->epv = gps_get_float(d + 12);
+	pvt->fix = (int) get16(d + 16);
+	pvt->lat = gps_get_double(d + 26) * RAD2DEG;
+	pvt->lon = gps_get_double(d + 34) * RAD2DEG;
+	pvt->east = gps_get_float(d + 42);
+	pvt->north = gps_get_float(d + 46);
+	pvt->up = gps_get_float(d + 50);
+	pvt->utc = UNIX_WEEK_OFFSET + (u_int32_t) get32(d + 60) * 86400.0 +
+		gps_get_double(d + 18) - get16(d + 58);
+	return 0;
+}
+
+/*
+ * Send a pvt start or stop command.  Returns the gps_send_wait status.
+ */
+static int
+pvt_cmd(gps_handle gps, enum gps_cmd_id cmd)
+{
+	u_char cmd_frame[3];
+
+	cmd_frame[0] = p_cmd_type;
+	cmd_frame[1] = (u_char) cmd;
+	cmd_frame[2] = 0;
+	gps_printf(gps, 3, "%s: send command %d\n", __func__, cmd);
+	return gps_send_wait(gps, cmd_frame, 3, 5);
+}
+
+/*
+ * Start the pvt stream and pass each fix to the given handler along
+ * with arg.  The time the frame of a fix was complete is taken before
+ * the fix is acked or decoded.  A frame with a bad checksum is nak'd
+ * and the stream goes on.  The stream is stopped when the handler
+ * returns a value greater than zero, the unit stops sending, or too
+ * many bad frames arrive in a row.
+ * Returns
+ *	-1:	command failed or the stream ended on its own
+ *	0:	command naked
+ *	1:	stream ended by the handler.
+ */
+int
+gps_pvt(gps_handle gps, gps_pvt_fn fn, void *arg)
+{
+	const struct gps_protocols *tab = gps_get_protocols(gps);
+	struct gps_pvt pvt;
+	struct timeval tv;
+	u_char data[GPS_FRAME_MAX];
+	int datalen;
+	int naks = 0;
+	int stat;
+	int ok;
+
+	if (tab != NULL && tab->sent &&
+	    gps_find_protocol(gps, 'A', 800) == NULL)
+		gps_printf(gps, 1, "%s: unit does not list A800\n", __func__);
+	if ((ok = pvt_cmd(gps, CMD_START_PVT)) != 1) {
+		gps_printf(gps, 1, "%s: start failed\n", __func__);
+		return ok;
+	}
+	gps_set_xfer(gps, GPS_XFER_PVT);
+
+	ok = -1;
+	for (;;) {
+		datalen = sizeof data;
+		stat = gps_recv_type(gps, p_pvt_data, PVT_TO, data, &datalen);
+		if (stat == -1 && ++naks <= PVT_NAKS && ! gps_cancelled(gps)) {
+			gps_printf(gps, 2, "%s: bad frame, nak\n", __func__);
+			gps_send_nak(gps, *data);
+			continue;
+		}
+		if (stat != 1) {
+			gps_printf(gps, 1, "%s: %s\n", __func__,
+				   naks > PVT_NAKS ? "too many bad frames" :
+				   "no fix from unit");
+			break;
+		}
+		naks = 0;
+		gettimeofday(&tv, NULL);
+		gps_send_ack(gps, *data);
+		if (gps_pvt_decode(data, datalen, &pvt) == -1) {
+			gps_printf(gps, 2, "%s: ignored packet %d\n",
+				   __func__, *data);
+			continue;
+		}
+		pvt.when = tv.tv_sec + tv.tv_usec / 1e6;
+		if (fn(gps, &pvt, arg) > 0) {
+			ok = 1;
+			break;
+		}
+	}
+
+	if (gps_cancelled(gps) || pvt_cmd(gps, CMD_STOP_PVT) != 1) {
+		gps_abort(gps);
+		return ok;
+	}
+	gps_set_xfer(gps, GPS_XFER_NONE);
+
+	/* drop fixes queued while the stop command waited for its ack */
+	datalen = sizeof data;
+	while (gps_queue_get(gps_get_queue(gps), p_pvt_data, data, &datalen))
+		datalen = sizeof data;
+	gps_queue_acked(gps_get_queue(gps), p_pvt_data);
+	return ok;
+}
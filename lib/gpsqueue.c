@@ -0,0 +1,160 @@
+/*
+ * Public Domain, 2026, Marco S Hyman <marc@snafu.org>
+ */
+
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpslib.h"
+
+/*
+ * Receive queue.
+ *
+ * Frames read from a unit while waiting for something else, e.g. a
+ * fix that arrives while a command waits for its ack, are held here
+ * for the consumer of their packet type.  Queued frames have already
+ * been acked; the ack a consumer sends when it takes the frame is
+ * dropped.  The queue is bounded in total and per packet type.  When
+ * either bound is hit the oldest frame of the type, or of any type if
+ * there is none, is dropped so a busy stream can't push out a frame of
+ * another type.
+ */
+
+#define QUEUE_LEN	32		/* frames held per handle */
+#define QUEUE_TYPE	8		/* frames held of one packet type */
+
+struct gps_queue {
+	int	count;			/* frames held, oldest first */
+	int	acked;			/* packet type + 1 of a taken frame */
+	int	len[QUEUE_LEN];
+	u_char	frame[QUEUE_LEN][GPS_FRAME_MAX];
+};
+
+struct gps_queue *
+gps_queue_new(void)
+{
+	return gps_calloc(1, sizeof(struct gps_queue));
+}
+
+/*
+ * Drop every frame held
+ */
+void
+gps_queue_clear(struct gps_queue *q)
+{
+	if (q != NULL) {
+		q->count = 0;
+		q->acked = 0;
+	}
+}
+
+void
+gps_queue_free(struct gps_queue *q)
+{
+	gps_free(q);
+}
+
+/*
+ * Returns 1 if packets of the given type are sent by a unit on its own
+ * rather than as part of a transfer.  They are only handed to a
+ * consumer that asks for the type.
+ */
+int
+gps_queue_streamed(int type)
+{
+	return type == p_pvt_data;
+}
+
+/*
+ * Index of the oldest frame of the given packet type, -1 for any type
+ * that is not streamed, and the number of frames of that type.
+ * Returns -1 if none.
+ */
+static int
+find(const struct gps_queue *q, int type, int *count)
+{
+	int first = -1;
+	int ix;
+
+	*count = 0;
+	for (ix = 0; ix < q->count; ix++)
+		if (q->frame[ix][0] == type || (type == -1 &&
+		    ! gps_queue_streamed(q->frame[ix][0]))) {
+			if (first == -1)
+				first = ix;
+			*count += 1;
+		}
+	return first;
+}
+
+static void
+drop(struct gps_queue *q, int ix)
+{
+	q->count -= 1;
+	memmove(&q->len[ix], &q->len[ix + 1],
+		(q->count - ix) * sizeof q->len[0]);
+	memmove(&q->frame[ix], &q->frame[ix + 1],
+		(q->count - ix) * sizeof q->frame[0]);
+}
+
+/*
+ * Add a received frame of len bytes, packet id first, to the queue.
+ * Returns 1 if an older frame was dropped to make room, otherwise 0.
+ */
+int
+gps_queue_put(struct gps_queue *q, const u_char *frame, int len)
+{
+	int dropped = 0;
+	int count;
+	int ix;
+
+	if (len > GPS_FRAME_MAX)
+		len = GPS_FRAME_MAX;
+	ix = find(q, frame[0], &count);
+	if (count >= QUEUE_TYPE || q->count == QUEUE_LEN) {
+		drop(q, ix == -1 ? 0 : ix);
+		dropped = 1;
+	}
+	q->len[q->count] = len;
+	memcpy(q->frame[q->count], frame, len);
+	q->count += 1;
+	return dropped;
+}
+
+/*
+ * Take the oldest frame of the given packet type, -1 for any type that
+ * is not streamed, from the queue.  The frame is copied to buf for up
+ * to *cnt bytes and *cnt is set to its length.  Returns 1 if a frame
+ * was taken or 0 if the queue holds none.
+ */
+int
+gps_queue_get(struct gps_queue *q, int type, u_char *buf, int *cnt)
+{
+	int count;
+	int ix;
+
+	if (q == NULL || (ix = find(q, type, &count)) == -1)
+		return 0;
+	if (*cnt > q->len[ix])
+		*cnt = q->len[ix];
+	memcpy(buf, q->frame[ix], *cnt);
+	q->acked = q->frame[ix][0] + 1;
+	drop(q, ix);
+	return 1;
+}
+
+/*
+ * Returns 1 if the frame of the given packet type last taken from the
+ * queue is the one being acked.  The ack need not be sent again.
+ */
+int
+gps_queue_acked(struct gps_queue *q, int type)
+{
+	if (q == NULL || q->acked != type + 1)
+		return 0;
+	q->acked = 0;
+	return 1;
+}
@@ -0,0 +1,447 @@
+/*
+ * Public Domain, 2026, Marco S Hyman <marc@snafu.org>
+ */
+
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpslib.h"
+
+/*
+ * Screenshot decoder.
+ *
+ * A screenshot arrives as a sequence of p_scr_shot packets: a header
+ * giving the image size, 256 palette entries, and then the image data
+ * as one palette index per pixel.
+ * Packet data starts at offset 9 of each packet.  The decoder collects
+ * the pixel indices in a framebuffer sized from the header and, once
+ * the image is complete, writes it as PPM or PNG.
+ *
+ * All state is in the decoder so any number of screenshots can be
+ * decoded, one after the other or concurrently from different units.
+ *
+ * For continuous capture the decoder also keeps the previous image and
+ * writes only what changed, see gps_screen_delta.
+ */
+
+#define SCR_DATA	9		/* offset of data in a packet */
+#define SCR_PALETTE	256		/* palette entries */
+#define SCR_MAX		4096		/* sanity limit on width/height */
+
+#define PNG_BLOCK	65535		/* max stored deflate block */
+
+struct gps_screen {
+	int	npkt;			/* packets seen */
+	u_int	width;			/* image width, pixels */
+	u_int	height;			/* image height, pixels */
+	size_t	fill;			/* pixels received */
+	u_char	*fb;			/* width * height palette indices */
+	u_char	palette[SCR_PALETTE][3]; /* r, g, b */
+	u_int32_t crc[256];		/* crc32 table for png */
+	u_char	*prev;			/* previous image for deltas */
+	u_int	pwidth;			/* previous image width, 0 if none */
+	u_int	pheight;		/* previous image height */
+	u_char	ppalette[SCR_PALETTE][3]; /* previous palette */
+};
+
+static u_int32_t
+get_u32(const u_char *p)
+{
+	return (u_int32_t) p[0] | (u_int32_t) p[1] << 8 |
+		(u_int32_t) p[2] << 16 | (u_int32_t) p[3] << 24;
+}
+
+/*
+ * Allocate a screenshot decoder.  Returns NULL if out of memory.
+ */
+struct gps_screen *
+gps_screen_new(void)
+{
+	struct gps_screen *s;
+	u_int32_t c;
+	int ix;
+	int bit;
+
+	s = gps_calloc(1, sizeof *s);
+	if (s == NULL)
+		return NULL;
+	for (ix = 0; ix < 256; ix++) {
+		c = (u_int32_t) ix;
+		for (bit = 0; bit < 8; bit++)
+			c = c & 1 ? 0xedb88320U ^ (c >> 1) : c >> 1;
+		s->crc[ix] = c;
+	}
+	return s;
+}
+
+void
+gps_screen_free(struct gps_screen *s)
+{
+	if (s != NULL) {
+		gps_free(s->fb);
+		gps_free(s->prev);
+		gps_free(s);
+	}
+}
+
+/*
+ * Forget any partial image so that the next packet is taken as the
+ * header of a new screenshot.  The framebuffer is kept for reuse.
+ */
+void
+gps_screen_reset(struct gps_screen *s)
+{
+	s->npkt = 0;
+	s->fill = 0;
+}
+
+/*
+ * Add a screenshot packet to the image.  Returns 1 when the image is
+ * complete, 0 if more packets are needed, or -1 if the header is bad or
+ * memory could not be allocated.  After an error or a complete image
+ * the decoder must be reset before the next screenshot.
+ */
+int
+gps_screen_packet(struct gps_screen *s, const u_char *pkt, int len)
+{
+	size_t size;
+	size_t cnt;
+	u_char *fb;
+	int ix;
+
+	ix = s->npkt++;
+	if (ix == 0) {
+		s->width = s->height = 0;
+		if (len < 25)
+			return -1;
+		s->width = get_u32(&pkt[17]);
+		s->height = get_u32(&pkt[21]);
+		if (s->width == 0 || s->width > SCR_MAX ||
+		    s->height == 0 || s->height > SCR_MAX) {
+			s->width = s->height = 0;
+			return -1;
+		}
+		size = (size_t) s->width * s->height;
+		fb = gps_realloc(s->fb, size);
+		if (fb == NULL) {
+			s->width = s->height = 0;
+			return -1;
+		}
+		s->fb = fb;
+		s->fill = 0;
+		memset(s->palette, 0, sizeof s->palette);
+	} else if (ix <= SCR_PALETTE) {
+		/* palette entries are stored b, g, r */
+		if (len >= SCR_DATA + 3) {
+			s->palette[ix - 1][0] = pkt[SCR_DATA + 2];
+			s->palette[ix - 1][1] = pkt[SCR_DATA + 1];
+			s->palette[ix - 1][2] = pkt[SCR_DATA];
+		}
+	} else if (s->width && len > SCR_DATA) {
+		size = (size_t) s->width * s->height;
+		cnt = (size_t) (len - SCR_DATA);
+		if (cnt > size - s->fill)
+			cnt = size - s->fill;
+		memcpy(&s->fb[s->fill], &pkt[SCR_DATA], cnt);
+		s->fill += cnt;
+	}
+	return s->width && s->fill == (size_t) s->width * s->height;
+}
+
+u_int
+gps_screen_width(const struct gps_screen *s)
+{
+	return s->width;
+}
+
+u_int
+gps_screen_height(const struct gps_screen *s)
+{
+	return s->height;
+}
+
+/*
+ * Return the r, g, b color of the pixel at x, y.  Pixels not yet
+ * received are palette entry 0.
+ */
+const u_char *
+gps_screen_color(const struct gps_screen *s, u_int x, u_int y)
+{
+	size_t ix = (size_t) y * s->width + x;
+
+	if (ix >= s->fill)
+		return s->palette[0];
+	return s->palette[s->fb[ix]];
+}
+
+/*
+ * Expand one row of palette indices into r, g, b triples
+ */
+static u_char *
+expand_row(const struct gps_screen *s, u_int y, u_char *out)
+{
+	const u_char *row = &s->fb[(size_t) y * s->width];
+	u_int x;
+
+	for (x = 0; x < s->width; x++) {
+		memcpy(out, s->palette[row[x]], 3);
+		out += 3;
+	}
+	return out;
+}
+
+static u_char *
+put_u32(u_char *p, u_int32_t val)
+{
+	p[0] = (u_char) (val >> 24);
+	p[1] = (u_char) (val >> 16);
+	p[2] = (u_char) (val >> 8);
+	p[3] = (u_char) val;
+	return p + 4;
+}
+
+/*
+ * Fill in the length and crc of the png chunk that starts at chunk
+ * (length field) and whose data ends at end.  Returns the end of the
+ * chunk.
+ */
+static u_char *
+png_chunk(const struct gps_screen *s, u_char *chunk, u_char *end)
+{
+	u_int32_t crc = 0xffffffffU;
+	u_char *p;
+
+	put_u32(chunk, (u_int32_t) (end - chunk - 8));
+	for (p = chunk + 4; p < end; p++)
+		crc = s->crc[(crc ^ *p) & 0xff] ^ (crc >> 8);
+	return put_u32(end, crc ^ 0xffffffffU);
+}
+
+/*
+ * Build a PNG image: 8 bit RGB, no interlace, every row with filter
+ * type 0 and the zlib stream made of stored (uncompressed) deflate
+ * blocks.  Screenshots are small, the point is a file any viewer can
+ * read without pulling in zlib.
+ */
+static size_t
+png_image(const struct gps_screen *s, u_char *buf)
+{
+	static const u_char sig[8] = {
+		0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+	};
+	size_t rowlen = (size_t) s->width * 3 + 1;
+	size_t raw = rowlen * s->height;
+	size_t left;
+	size_t blk;
+	u_int32_t a = 1;
+	u_int32_t b = 0;
+	u_char *chunk;
+	u_char *p = buf;
+	u_char *data;
+	u_char *end;
+	u_char *q;
+	u_int y;
+
+	memcpy(p, sig, sizeof sig);
+	p += sizeof sig;
+
+	chunk = p;
+	p += 4;
+	memcpy(p, "IHDR", 4);
+	p = put_u32(p + 4, s->width);
+	p = put_u32(p, s->height);
+	*p++ = 8;			/* bit depth */
+	*p++ = 2;			/* color type RGB */
+	*p++ = 0;			/* deflate */
+	*p++ = 0;			/* adaptive filtering */
+	*p++ = 0;			/* no interlace */
+	p = png_chunk(s, chunk, p);
+
+	/* The filtered rows are laid out past the space needed for all
+	   of the stored block headers then moved down as each block
+	   header is written in front of its data. */
+	chunk = p;
+	p += 4;
+	memcpy(p, "IDAT", 4);
+	p += 4;
+	*p++ = 0x78;			/* zlib header, 32K window */
+	*p++ = 0x01;
+	data = p + 5 * ((raw + PNG_BLOCK - 1) / PNG_BLOCK);
+	for (y = 0, q = data; y < s->height; y++) {
+		*q++ = 0;
+		q = expand_row(s, y, q);
+	}
+	end = q;
+
+	for (q = data; q < end; q++) {
+		a += *q;
+		if (a >= 65521)
+			a -= 65521;
+		b += a;
+		if (b >= 65521)
+			b -= 65521;
+	}
+
+	for (q = data, left = raw; left > 0; left -= blk, q += blk) {
+		blk = left > PNG_BLOCK ? PNG_BLOCK : left;
+		*p++ = left == blk;	/* BFINAL, BTYPE 00 */
+		*p++ = (u_char) blk;
+		*p++ = (u_char) (blk >> 8);
+		*p++ = (u_char) ~blk;
+		*p++ = (u_char) (~blk >> 8);
+		memmove(p, q, blk);
+		p += blk;
+	}
+	p = put_u32(p, b << 16 | a);
+	p = png_chunk(s, chunk, p);
+
+	chunk = p;
+	p += 4;
+	memcpy(p, "IEND", 4);
+	p = png_chunk(s, chunk, p + 4);
+	return (size_t) (p - buf);
+}
+
+/*
+ * Write the image to the given stream in one write.  Returns 0 on
+ * success or -1 if the image is not complete, memory could not be
+ * allocated, or the write failed.
+ */
+int
+gps_screen_write(const struct gps_screen *s, FILE *fp, int format)
+{
+	size_t raw;
+	size_t size;
+	size_t len;
+	u_char *buf;
+	u_char *p;
+	u_int y;
+	int hdr;
+	int rc;
+
+	if (s->width == 0 || s->fill != (size_t) s->width * s->height)
+		return -1;
+	raw = ((size_t) s->width * 3 + 1) * s->height;
+	if (format == GPS_SCREEN_PNG)
+		size = 8 + 25 + 12 + 2 + 5 * (raw / PNG_BLOCK + 1) + raw +
+			4 + 12;
+	else
+		size = 32 + raw;
+	buf = gps_malloc(size);
+	if (buf == NULL)
+		return -1;
+
+	if (format == GPS_SCREEN_PNG)
+		len = png_image(s, buf);
+	else {
+		hdr = snprintf((char *) buf, size, "P6\n%u %u\n255\n",
+			       s->width, s->height);
+		p = buf + hdr;
+		for (y = 0; y < s->height; y++)
+			p = expand_row(s, y, p);
+		len = (size_t) (p - buf);
+	}
+	rc = fwrite(buf, 1, len, fp) == len ? 0 : -1;
+	gps_free(buf);
+	return rc;
+}
+
+static u_char *
+put_u16le(u_char *p, u_int val)
+{
+	p[0] = (u_char) val;
+	p[1] = (u_char) (val >> 8);
+	return p + 2;
+}
+
+/*
+ * Write the changes between the complete image and the image given to
+ * the previous call as one delta frame, in one write:
+ *
+ *	'F' width(2) height(2)		start of frame
+ *	'P' r g b * 256			palette, if changed
+ *	'S' y(2) x(2) n(2) index * n	n changed pixels of row y from x
+ *	'E'				end of frame
+ *
+ * Numbers are little endian, pixels are palette indices.  Each changed
+ * row is sent as one span from its first to its last changed pixel.
+ * The first frame, and any frame after a size change, has the palette
+ * and every row.  The decoder is then reset for the next image.  Returns
+ * the number of changed rows, or -1 if the image is not complete, memory
+ * could not be allocated, or the write failed.
+ */
+int
+gps_screen_delta(struct gps_screen *s, FILE *fp)
+{
+	size_t size;
+	u_char *buf;
+	u_char *p;
+	u_char *tmp;
+	const u_char *cur;
+	const u_char *old;
+	u_int y;
+	u_int first;
+	u_int last;
+	int full;
+	int rows = 0;
+	int rc;
+
+	if (s->width == 0 || s->fill != (size_t) s->width * s->height)
+		return -1;
+	full = s->pwidth != s->width || s->pheight != s->height;
+	size = 5 + 1 + sizeof s->palette +
+		(size_t) s->height * (7 + s->width) + 1;
+	buf = gps_malloc(size);
+	if (buf == NULL)
+		return -1;
+
+	p = buf;
+	*p++ = 'F';
+	p = put_u16le(p, s->width);
+	p = put_u16le(p, s->height);
+	if (full || memcmp(s->palette, s->ppalette, sizeof s->palette)) {
+		*p++ = 'P';
+		memcpy(p, s->palette, sizeof s->palette);
+		p += sizeof s->palette;
+		memcpy(s->ppalette, s->palette, sizeof s->palette);
+	}
+	for (y = 0; y < s->height; y++) {
+		cur = &s->fb[(size_t) y * s->width];
+		first = 0;
+		last = s->width;
+		if (! full) {
+			old = &s->prev[(size_t) y * s->width];
+			while (first < s->width && cur[first] == old[first])
+				first++;
+			if (first == s->width)
+				continue;
+			while (cur[last - 1] == old[last - 1])
+				last--;
+		}
+		*p++ = 'S';
+		p = put_u16le(p, y);
+		p = put_u16le(p, first);
+		p = put_u16le(p, last - first);
+		memcpy(p, &cur[first], last - first);
+		p += last - first;
+		rows += 1;
+	}
+	*p++ = 'E';
+	rc = fwrite(buf, 1, (size_t) (p - buf), fp) == (size_t) (p - buf);
+	gps_free(buf);
+	if (! rc)
+		return -1;
+
+	/* the current image becomes the previous one, the old previous
+	   buffer is reused for the next image */
+	tmp = s->prev;
+	s->prev = s->fb;
+	s->fb = tmp;
+	s->pwidth = s->width;
+	s->pheight = s->height;
+	gps_screen_reset(s);
+	return rows;
+}
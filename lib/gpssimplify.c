@@ -0,0 +1,396 @@
+/*
+ * Public Domain, 2026, Marco S Hyman <marc@snafu.org>
+ */
+
+#include <sys/types.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gpslib.h"
+
+/*
+ * Upload time track simplification.
+ *
+ * Every track point costs a frame and an ack round trip on upload and
+ * a slot in the unit's track memory.  Dense logs carry many points that
+ * add nothing to the shape of the track.  This is Visvalingam's
+ * algorithm with the triangle area replaced by the cross-track distance
+ * of a point from the line joining its neighbors.  Points are kept in a
+ * heap ordered by that distance and the cheapest point is removed until
+ * the cheapest point would move the track by more than the allowed
+ * error and the track fits within the point budget.
+ *
+ * Each kept point carries a box, aligned with the line to the next
+ * kept point, that holds every point removed between the two.  The
+ * cost of removing a point is the largest distance from the line
+ * joining its neighbors of the point itself and of the corners of the
+ * boxes on either side.  Distance from a line is convex so no removed
+ * point is further away than the furthest corner.  The merged box is
+ * built from the same corners.  Each removal costs a fixed amount of
+ * work, O(n log n) in all, and unless the point budget forces more
+ * removals no point is moved by more than the error.
+ *
+ * The first and last point of each track segment (a track header, a
+ * point with the `start' flag set, or the end of the list begins a new
+ * segment) are never removed.
+ */
+
+#define EARTH_RADIUS	6371008.8	/* mean radius, meters */
+#define DEG2RAD		(M_PI / 180.0)
+
+struct trk_point {
+	int	rec;			/* list record holding the point */
+	double	lat;			/* latitude, degrees */
+	double	lon;			/* longitude, degrees */
+	double	err;			/* cost of removing the point */
+	double	t0, t1;			/* box of the removed points up to */
+	double	lo, hi;			/*   next: along and off the line */
+	int	prev;			/* previous kept point in segment */
+	int	next;			/* next kept point in segment */
+	int	heapix;			/* index into heap, -1 if not there */
+};
+
+/*
+ * A point on a plane tangent at a track point, meters east and north
+ */
+struct xy {
+	double	x;
+	double	y;
+};
+
+/*
+ * Put point p on the plane tangent at o.  Good enough for the short
+ * distances between neighboring track points.
+ */
+static struct xy
+plane(const struct trk_point *o, const struct trk_point *p)
+{
+	struct xy v;
+
+	v.x = remainder(p->lon - o->lon, 360.0) * EARTH_RADIUS * DEG2RAD *
+		cos(o->lat * DEG2RAD);
+	v.y = (p->lat - o->lat) * EARTH_RADIUS * DEG2RAD;
+	return v;
+}
+
+/*
+ * Unit vector along a-b, east if the points are the same
+ */
+static struct xy
+along(struct xy a, struct xy b)
+{
+	struct xy u;
+	double d = hypot(b.x - a.x, b.y - a.y);
+
+	u.x = d > 0 ? (b.x - a.x) / d : 1;
+	u.y = d > 0 ? (b.y - a.y) / d : 0;
+	return u;
+}
+
+/*
+ * Distance of q from the segment a-b
+ */
+static double
+seg_dist(struct xy a, struct xy b, struct xy q)
+{
+	double dx = b.x - a.x;
+	double dy = b.y - a.y;
+	double t = dx * dx + dy * dy;
+
+	if (t > 0) {
+		/* parameter of the projection of q on a-b */
+		t = ((q.x - a.x) * dx + (q.y - a.y) * dy) / t;
+		if (t < 0)
+			t = 0;
+		else if (t > 1)
+			t = 1;
+	}
+	return hypot(q.x - a.x - t * dx, q.y - a.y - t * dy);
+}
+
+/*
+ * Add the corners of the box of the points removed after pts[ix] on
+ * the plane tangent at o to q.  Returns the number added.
+ */
+static int
+corners(const struct trk_point *pts, int ix, const struct trk_point *o,
+	struct xy *q)
+{
+	const struct trk_point *a = &pts[ix];
+	struct xy pa = plane(o, a);
+	struct xy u = along(pa, plane(o, &pts[a->next]));
+	int n = 0;
+	int jx;
+
+	for (jx = 0; jx < 4; jx++) {
+		double t = jx & 1 ? a->t1 : a->t0;
+		double h = jx & 2 ? a->hi : a->lo;
+
+		q[n].x = pa.x + t * u.x - h * u.y;
+		q[n].y = pa.y + t * u.y + h * u.x;
+		n += 1;
+	}
+	return n;
+}
+
+/*
+ * The points that bound what removing pts[ix] moves: the point and the
+ * box corners on either side, on the plane tangent at the point.
+ * Returns the number of points in q.
+ */
+static int
+bounds(const struct trk_point *pts, int ix, struct xy *q)
+{
+	const struct trk_point *p = &pts[ix];
+	int n;
+
+	n = corners(pts, p->prev, p, q);
+	n += corners(pts, ix, p, q + n);
+	q[n].x = q[n].y = 0;
+	return n + 1;
+}
+
+/*
+ * Binary min heap of point indices ordered by the point error.
+ */
+static void
+heap_swap(struct trk_point *pts, int *heap, int i, int j)
+{
+	int t = heap[i];
+
+	heap[i] = heap[j];
+	heap[j] = t;
+	pts[heap[i]].heapix = i;
+	pts[heap[j]].heapix = j;
+}
+
+static void
+heap_up(struct trk_point *pts, int *heap, int ix)
+{
+	while (ix > 0) {
+		int parent = (ix - 1) / 2;
+		if (pts[heap[parent]].err <= pts[heap[ix]].err)
+			break;
+		heap_swap(pts, heap, ix, parent);
+		ix = parent;
+	}
+}
+
+static void
+heap_down(struct trk_point *pts, int *heap, int cnt, int ix)
+{
+	for (;;) {
+		int min = ix;
+		int child = 2 * ix + 1;
+
+		if (child < cnt && pts[heap[child]].err < pts[heap[min]].err)
+			min = child;
+		child += 1;
+		if (child < cnt && pts[heap[child]].err < pts[heap[min]].err)
+			min = child;
+		if (min == ix)
+			break;
+		heap_swap(pts, heap, ix, min);
+		ix = min;
+	}
+}
+
+/*
+ * The cost of removing point ix: the largest distance of its bounds
+ * from the line joining its neighbors.
+ */
+static double
+cost(const struct trk_point *pts, int ix)
+{
+	const struct trk_point *p = &pts[ix];
+	struct xy a = plane(p, &pts[p->prev]);
+	struct xy b = plane(p, &pts[p->next]);
+	struct xy q[9];
+	double err = 0;
+	double d;
+	int n;
+
+	n = bounds(pts, ix, q);
+	while (n--)
+		if ((d = seg_dist(a, b, q[n])) > err)
+			err = d;
+	return err;
+}
+
+/*
+ * Point ix is being removed: make the box of its previous point hold
+ * every point removed between its neighbors.
+ */
+static void
+merge(struct trk_point *pts, int ix)
+{
+	struct trk_point *p = &pts[ix];
+	struct trk_point *a = &pts[p->prev];
+	struct xy pa = plane(p, a);
+	struct xy u = along(pa, plane(p, &pts[p->next]));
+	struct xy q[9];
+	double t;
+	double h;
+	int n;
+
+	n = bounds(pts, ix, q);
+	a->t0 = a->t1 = a->lo = a->hi = 0;
+	while (n--) {
+		t = (q[n].x - pa.x) * u.x + (q[n].y - pa.y) * u.y;
+		h = (q[n].y - pa.y) * u.x - (q[n].x - pa.x) * u.y;
+		if (t < a->t0)
+			a->t0 = t;
+		if (t > a->t1)
+			a->t1 = t;
+		if (h < a->lo)
+			a->lo = h;
+		if (h > a->hi)
+			a->hi = h;
+	}
+}
+
+/*
+ * Recompute the error of point ix after one of its neighbors was
+ * removed.
+ */
+static void
+update(struct trk_point *pts, int *heap, int cnt, int ix)
+{
+	struct trk_point *p = &pts[ix];
+	double old;
+
+	if (p->heapix < 0)
+		return;
+	old = p->err;
+	p->err = cost(pts, ix);
+	if (p->err < old)
+		heap_up(pts, heap, p->heapix);
+	else
+		heap_down(pts, heap, cnt, p->heapix);
+}
+
+/*
+ * Simplify the track points in the given list according to the track
+ * error and point limit set on the gps handle.  The limit applies to
+ * all the track points of the list.  Removed records are dropped from
+ * the list.  Returns the number of points removed or -1 if memory could
+ * not be allocated in which case the list is not changed.
+ */
+int
+gps_simplify(gps_handle gps, struct gps_list_head *list)
+{
+	double maxerr = gps_get_trk_error(gps);
+	int limit = gps_get_trk_limit(gps);
+	const struct gps_trk_codec *tc = gps_get_trk_codec(gps);
+	struct gps_trk t;
+	struct trk_point *pts;
+	const u_char *rec;
+	char *drop;
+	int *heap;
+	int npts;
+	int cnt;
+	int seg;
+	int removed;
+	int ix;
+	int n;
+
+	if ((maxerr <= 0 && limit <= 0) || tc == NULL)
+		return 0;
+
+	npts = 0;
+	for (n = 0; n < list->count; n++)
+		if (*GPS_LIST_REC(list, n) == p_trk_data)
+			npts += 1;
+	if (npts < 3 || (maxerr <= 0 && npts <= limit))
+		return 0;
+
+	pts = gps_malloc(npts * sizeof *pts);
+	heap = gps_malloc(npts * sizeof *heap);
+	drop = gps_calloc(list->count, 1);
+	if (pts == NULL || heap == NULL || drop == NULL) {
+		gps_printf(gps, 0, "%s: no memory\n", __func__);
+		gps_free(pts);
+		gps_free(heap);
+		gps_free(drop);
+		return -1;
+	}
+
+	/* Collect the points linking neighbors within each segment.  seg
+	   is the index of the first point of the current segment or -1
+	   when the next point starts a new segment. */
+	ix = 0;
+	seg = -1;
+	for (n = 0; n < list->count; n++) {
+		struct trk_point *p;
+
+		rec = GPS_LIST_REC(list, n);
+		if (*rec != p_trk_data) {
+			seg = -1;
+			continue;
+		}
+		p = &pts[ix];
+		p->rec = n;
+		if (tc->decode(rec, GPS_LIST_LEN(list, n), &t) == 0) {
+			p->lat = t.lat;
+			p->lon = t.lon;
+		} else {
+			p->lat = p->lon = 0;
+			t.new_trk = 1;
+		}
+		p->heapix = -1;
+		p->next = -1;
+		p->t0 = p->t1 = p->lo = p->hi = 0;
+		if (t.new_trk)
+			seg = -1;
+		if (seg == -1) {
+			p->prev = -1;
+			seg = ix;
+		} else {
+			p->prev = ix - 1;
+			pts[ix - 1].next = ix;
+		}
+		ix += 1;
+	}
+
+	/* interior points go in the heap */
+	cnt = 0;
+	for (ix = 0; ix < npts; ix++) {
+		struct trk_point *p = &pts[ix];
+
+		if (p->prev != -1 && p->next != -1) {
+			p->err = cost(pts, ix);
+			p->heapix = cnt;
+			heap[cnt++] = ix;
+			heap_up(pts, heap, p->heapix);
+		}
+	}
+
+	removed = 0;
+	while (cnt > 0) {
+		struct trk_point *p = &pts[ix = heap[0]];
+
+		if (p->err > maxerr && (limit <= 0 || npts - removed <= limit))
+			break;
+		heap_swap(pts, heap, 0, --cnt);
+		p->heapix = -1;
+		heap_down(pts, heap, cnt, 0);
+
+		merge(pts, ix);
+		pts[p->prev].next = p->next;
+		pts[p->next].prev = p->prev;
+		update(pts, heap, cnt, p->prev);
+		update(pts, heap, cnt, p->next);
+		drop[p->rec] = 1;
+		removed += 1;
+	}
+	gps_list_remove(list, drop);
+
+	gps_printf(gps, 2, "%s: %d of %d track points removed\n", __func__,
+		   removed, npts);
+	gps_free(pts);
+	gps_free(heap);
+	gps_free(drop);
+	return removed;
+}
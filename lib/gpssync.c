@@ -0,0 +1,370 @@
+/*
+ * Public Domain, 2026, Marco S Hyman <marc@snafu.org>
+ */
+
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpslib.h"
+
+/*
+ * Differential upload.
+ *
+ * The waypoints and routes currently stored in the unit are downloaded
+ * and reduced to a table of (key, value) hashes.  The key hashes the
+ * waypoint ident or route number and name, the value hashes the ident,
+ * position, symbol and comment of a waypoint or every packet of a
+ * route.  Records in the upload lists whose key and value are both
+ * found in the table are already on the unit and are removed from the
+ * lists.
+ *
+ * Hashing is done on decoded packets, not on raw packet data, as the
+ * unit fills in fields (colors, depth, padding) that garload does not
+ * send.  Upload packets are encoded for the unit's packet types so the
+ * same decoder handles both sides.
+ */
+
+#define FNV_OFFSET	0xcbf29ce484222325ULL
+#define FNV_PRIME	0x100000001b3ULL
+
+/*
+ * Hash table of key/value pairs.  Open addressing, a key of 0 marks
+ * an empty slot.
+ */
+struct sync_table {
+	u_int64_t *keys;
+	u_int64_t *vals;
+	size_t	size;			/* power of 2 */
+	size_t	used;
+};
+
+/*
+ * Route packets are accumulated into one key/value pair
+ */
+struct rte_hash {
+	int	active;			/* a route header was seen */
+	u_int64_t key;
+	u_int64_t val;
+};
+
+struct sync_state {
+	struct sync_table table;
+	struct rte_hash rte;
+	int	failed;			/* out of memory */
+};
+
+static u_int64_t
+fnv(u_int64_t h, const void *buf, size_t len)
+{
+	const u_char *p = buf;
+
+	while (len--) {
+		h ^= *p++;
+		h *= FNV_PRIME;
+	}
+	return h;
+}
+
+/*
+ * Hash a string ignoring trailing blanks.  Fixed length fields are
+ * blank padded, variable length fields are not.
+ */
+static u_int64_t
+fnv_str(u_int64_t h, const struct gps_str *s)
+{
+	size_t len = 0;
+
+	if (s->str != NULL) {
+		len = (size_t) s->len;
+		while (len > 0 && s->str[len - 1] == ' ')
+			len -= 1;
+	}
+	h = fnv(h, s->str, len);
+	/* terminate so that "ab" "c" and "a" "bc" differ */
+	return fnv(h, "", 1);
+}
+
+static u_int64_t
+fnv_long(u_int64_t h, long val)
+{
+	u_char b[4];
+
+	b[0] = (u_char) val;
+	b[1] = (u_char) (val >> 8);
+	b[2] = (u_char) (val >> 16);
+	b[3] = (u_char) (val >> 24);
+	return fnv(h, b, sizeof b);
+}
+
+static int
+table_grow(struct sync_table *t)
+{
+	struct sync_table n;
+	size_t ix;
+	size_t slot;
+
+	n.size = t->size ? t->size * 2 : 256;
+	n.used = t->used;
+	n.keys = gps_calloc(n.size, sizeof *n.keys);
+	n.vals = gps_calloc(n.size, sizeof *n.vals);
+	if (n.keys == NULL || n.vals == NULL) {
+		gps_free(n.keys);
+		gps_free(n.vals);
+		return -1;
+	}
+	for (ix = 0; ix < t->size; ix++) {
+		if (t->keys[ix] == 0)
+			continue;
+		slot = t->keys[ix] & (n.size - 1);
+		while (n.keys[slot] != 0)
+			slot = (slot + 1) & (n.size - 1);
+		n.keys[slot] = t->keys[ix];
+		n.vals[slot] = t->vals[ix];
+	}
+	gps_free(t->keys);
+	gps_free(t->vals);
+	*t = n;
+	return 0;
+}
+
+static int
+table_add(struct sync_table *t, u_int64_t key, u_int64_t val)
+{
+	size_t slot;
+
+	if (key == 0)
+		key = 1;
+	if (2 * (t->used + 1) > t->size && table_grow(t) == -1)
+		return -1;
+	slot = key & (t->size - 1);
+	while (t->keys[slot] != 0 && t->keys[slot] != key)
+		slot = (slot + 1) & (t->size - 1);
+	if (t->keys[slot] == 0)
+		t->used += 1;
+	t->keys[slot] = key;
+	t->vals[slot] = val;
+	return 0;
+}
+
+/*
+ * Return 1 if the key is in the table with the given value
+ */
+static int
+table_match(const struct sync_table *t, u_int64_t key, u_int64_t val)
+{
+	size_t slot;
+
+	if (t->size == 0)
+		return 0;
+	if (key == 0)
+		key = 1;
+	slot = key & (t->size - 1);
+	while (t->keys[slot] != 0) {
+		if (t->keys[slot] == key)
+			return t->vals[slot] == val;
+		slot = (slot + 1) & (t->size - 1);
+	}
+	return 0;
+}
+
+/*
+ * Compute the key and value hashes of a waypoint packet.  Returns -1
+ * if the packet can not be decoded.
+ */
+static int
+wpt_hash(const u_char *pkt, int len, const struct gps_wpt_codec *wc,
+	 u_int64_t *key, u_int64_t *val)
+{
+	struct gps_wpt w;
+
+	if (wc == NULL || wc->decode(pkt, len, &w) == -1)
+		return -1;
+	*key = fnv_str(FNV_OFFSET, &w.ident);
+	*val = fnv(*key, w.posn, 8);
+	*val = fnv_long(*val, w.sym);
+	*val = fnv_str(*val, &w.cmnt);
+	return 0;
+}
+
+/*
+ * Add a route packet to the route hash.  Returns 1 when a route header
+ * ends the previous route leaving its key/value in *prev, otherwise 0.
+ * A NULL packet ends the current route.
+ */
+static int
+rte_hash_add(gps_handle gps, struct rte_hash *rh, const u_char *pkt,
+	     int len, struct rte_hash *prev)
+{
+	const struct gps_rte_codec *rc;
+	struct gps_rte r;
+	u_int64_t key;
+	u_int64_t val;
+	int done = 0;
+
+	if (pkt == NULL || *pkt == p_rte_hdr) {
+		if (rh->active) {
+			*prev = *rh;
+			done = 1;
+		}
+		rh->active = 0;
+		rc = gps_get_rte_hdr_codec(gps);
+		if (pkt == NULL || rc == NULL || rc->decode(pkt, len, &r))
+			return done;
+		rh->active = 1;
+		rh->key = fnv_long(FNV_OFFSET, r.num);
+		rh->key = fnv_str(rh->key, &r.ident);
+		rh->val = rh->key;
+		return done;
+	}
+	if (! rh->active)
+		return 0;
+	switch (*pkt) {
+	case p_rte_wpt_data:
+		if (wpt_hash(pkt, len, gps_get_rte_wpt_codec(gps), &key, &val))
+			rh->val = fnv(rh->val, pkt, len);
+		else
+			rh->val = fnv(rh->val, &val, sizeof val);
+		break;
+	case p_rte_link:
+		rc = gps_get_rte_lnk_codec(gps);
+		if (rc != NULL && rc->decode(pkt, len, &r) == 0)
+			rh->val = fnv_long(rh->val, r.class);
+		break;
+	}
+	return 0;
+}
+
+/*
+ * gps_cmd_xfer packet handler: add unit waypoints and routes to the
+ * table.
+ */
+static int
+sync_packet(gps_handle gps, enum gps_cmd_id cmd, const u_char *pkt, int len,
+	    void *arg)
+{
+	struct sync_state *ss = arg;
+	struct rte_hash prev;
+	u_int64_t key;
+	u_int64_t val;
+
+	switch (*pkt) {
+	case p_wpt_data:
+		if (wpt_hash(pkt, len, gps_get_wpt_codec(gps), &key, &val) == 0 &&
+		    table_add(&ss->table, key, val) == -1)
+			ss->failed = 1;
+		break;
+	case p_rte_hdr:
+	case p_rte_wpt_data:
+	case p_rte_link:
+	case p_xfr_end:
+		if (rte_hash_add(gps, &ss->rte, *pkt == p_xfr_end ? NULL : pkt,
+				 len, &prev) &&
+		    table_add(&ss->table, prev.key, prev.val) == -1)
+			ss->failed = 1;
+		break;
+	}
+	return 0;
+}
+
+/*
+ * Mark waypoints that are already on the unit
+ */
+static void
+sync_waypoints(gps_handle gps, struct sync_state *ss,
+	       struct gps_list_head *list, char *drop)
+{
+	u_int64_t key;
+	u_int64_t val;
+	int ix;
+
+	for (ix = 0; ix < list->count; ix++)
+		if (wpt_hash(GPS_LIST_REC(list, ix), GPS_LIST_LEN(list, ix),
+			     gps_get_wpt_codec(gps), &key, &val) == 0 &&
+		    table_match(&ss->table, key, val))
+			drop[ix] = 1;
+}
+
+/*
+ * Mark whole routes that are already on the unit
+ */
+static void
+sync_routes(gps_handle gps, struct sync_state *ss,
+	    struct gps_list_head *list, char *drop)
+{
+	const u_char *rec;
+	struct rte_hash rh;
+	struct rte_hash prev;
+	int start = 0;
+	int ix;
+
+	memset(&rh, 0, sizeof rh);
+	for (ix = 0; ix <= list->count; ix++) {
+		rec = ix < list->count ? GPS_LIST_REC(list, ix) : NULL;
+		if (rte_hash_add(gps, &rh, rec, rec ? GPS_LIST_LEN(list, ix) : 0,
+				 &prev) &&
+		    table_match(&ss->table, prev.key, prev.val))
+			memset(&drop[start], 1, ix - start);
+		if (rec != NULL && *rec == p_rte_hdr)
+			start = ix;
+	}
+}
+
+/*
+ * Download the waypoints and routes currently on the unit and remove
+ * any records from the upload lists that would not change the unit.
+ * Returns the number of records removed or -1 if the unit contents
+ * could not be read in which case the lists are unchanged.
+ */
+int
+gps_sync(gps_handle gps, struct gps_lists *lists)
+{
+	struct sync_state ss;
+	struct gps_lists *cur;
+	char *drop;
+	int dropped = 0;
+	int wpt = 0;
+	int rte = 0;
+
+	for (cur = lists; cur; cur = cur->next) {
+		if (cur->list->type == CMD_WPT)
+			wpt = 1;
+		else if (cur->list->type == CMD_RTE)
+			rte = 1;
+	}
+
+	memset(&ss, 0, sizeof ss);
+	if ((wpt && gps_cmd_xfer(gps, CMD_WPT, sync_packet, &ss) != 1) ||
+	    (rte && gps_cmd_xfer(gps, CMD_RTE, sync_packet, &ss) != 1) ||
+	    ss.failed) {
+		gps_printf(gps, 1, "%s: can't read unit contents\n", __func__);
+		gps_free(ss.table.keys);
+		gps_free(ss.table.vals);
+		return -1;
+	}
+	gps_printf(gps, 2, "%s: %lu records on unit\n", __func__,
+		   (u_long) ss.table.used);
+
+	for (cur = lists; cur; cur = cur->next) {
+		if (cur->list->type != CMD_WPT && cur->list->type != CMD_RTE)
+			continue;
+		drop = gps_calloc(cur->list->count + 1, 1);
+		if (drop == NULL) {
+			gps_printf(gps, 0, "%s: no memory\n", __func__);
+			continue;
+		}
+		if (cur->list->type == CMD_WPT)
+			sync_waypoints(gps, &ss, cur->list, drop);
+		else
+			sync_routes(gps, &ss, cur->list, drop);
+		dropped += gps_list_remove(cur->list, drop);
+		gps_free(drop);
+	}
+
+	gps_printf(gps, 2, "%s: %d records unchanged\n", __func__, dropped);
+	gps_free(ss.table.keys);
+	gps_free(ss.table.vals);
+	return dropped;
+}
@@ -23,10 +23,12 @@ gps_version(gps_handle gps, int print)
 	int product_id;
 	int software_version;
 	char *product_description;
+	GPS_PROF_BEGIN(prof, GPS_PROF_PRODUCT);
 
 	if (gps_product(gps, &product_id, &software_version,
 			&product_description)) {
 		gps_printf(gps, 1, "%s: failed\n", __func__);
+		GPS_PROF_END(prof);
 		return -1;
 	}
 	if (print)
@@ -34,12 +36,14 @@ gps_version(gps_handle gps, int print)
 		       product_id, software_version,
 		       product_description ? product_description : "unknown");
 	if (product_description)
-		free(product_description);
+		gps_free(product_description);
 
 	/* Grab the protocol capabilities packet if it is there so it doesn't
-	   screw up anything else.  We don't use it.  Some units send it
-	   every time the product description is requested. */
+	   screw up anything else.  Some units send it every time the
+	   product description is requested.  Units known not to send it
+	   are not waited for. */
 
-	gps_protocol_cap(gps);
+	gps_capabilities(gps, product_id, software_version);
+	GPS_PROF_END(prof);
 	return 1;
 }